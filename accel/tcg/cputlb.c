@@ -89,6 +89,10 @@ QEMU_BUILD_BUG_ON(sizeof(vaddr) > sizeof(run_on_cpu_data));
 QEMU_BUILD_BUG_ON(NB_MMU_MODES > 16);
 #define ALL_MMUIDX_BITS ((1 << NB_MMU_MODES) - 1)
 
+/* Set from the tcg accelerator properties. */
+unsigned tcg_victim_tlb_size = CPU_VTLB_DEFAULT_SIZE;
+bool tcg_victim_tlb_lru;
+
 static inline size_t tlb_n_entries(CPUTLBDescFast *fast)
 {
     return (fast->mask >> CPU_TLB_ENTRY_BITS) + 1;
@@ -291,7 +295,8 @@ static void tlb_mmu_flush_locked(CPUTLBDesc *desc, CPUTLBDescFast *fast)
     desc->large_page_mask = -1;
     desc->vindex = 0;
     memset(fast->table, -1, sizeof_tlb(fast));
-    memset(desc->vtable, -1, sizeof(desc->vtable));
+    memset(desc->vtable, -1, desc->vsize * sizeof(CPUTLBEntry));
+    memset(desc->vstamp, 0, desc->vsize * sizeof(size_t));
 }
 
 static void tlb_flush_one_mmuidx_locked(CPUState *cpu, int mmu_idx,
@@ -299,12 +304,18 @@ static void tlb_flush_one_mmuidx_locked(CPUState *cpu, int mmu_idx,
 {
     CPUTLBDesc *desc = &cpu->neg.tlb.d[mmu_idx];
     CPUTLBDescFast *fast = &cpu->neg.tlb.f[mmu_idx];
+    size_t old_size = tlb_n_entries(fast);
 
     tlb_mmu_resize_locked(desc, fast, now);
+    if (tlb_n_entries(fast) != old_size) {
+        qatomic_set(&cpu->neg.tlb.c.resize_count,
+                    cpu->neg.tlb.c.resize_count + 1);
+    }
     tlb_mmu_flush_locked(desc, fast);
 }
 
-static void tlb_mmu_init(CPUTLBDesc *desc, CPUTLBDescFast *fast, int64_t now)
+static void tlb_mmu_init(CPUTLBDesc *desc, CPUTLBDescFast *fast, int64_t now,
+                         size_t vsize)
 {
     size_t n_entries = 1 << CPU_TLB_DYN_DEFAULT_BITS;
 
@@ -313,6 +324,10 @@ static void tlb_mmu_init(CPUTLBDesc *desc, CPUTLBDescFast *fast, int64_t now)
     fast->mask = (n_entries - 1) << CPU_TLB_ENTRY_BITS;
     fast->table = g_new(CPUTLBEntry, n_entries);
     desc->fulltlb = g_new(CPUTLBEntryFull, n_entries);
+    desc->vsize = vsize;
+    desc->vtable = g_new(CPUTLBEntry, vsize);
+    desc->vfulltlb = g_new(CPUTLBEntryFull, vsize);
+    desc->vstamp = g_new(size_t, vsize);
     tlb_mmu_flush_locked(desc, fast);
 }
 
@@ -335,9 +350,11 @@ void tlb_init(CPUState *cpu)
 
     /* All tlbs are initialized flushed. */
     cpu->neg.tlb.c.dirty = 0;
+    cpu->neg.tlb.c.vtlb_lru = tcg_victim_tlb_lru;
 
     for (i = 0; i < NB_MMU_MODES; i++) {
-        tlb_mmu_init(&cpu->neg.tlb.d[i], &cpu->neg.tlb.f[i], now);
+        tlb_mmu_init(&cpu->neg.tlb.d[i], &cpu->neg.tlb.f[i], now,
+                     tcg_victim_tlb_size);
     }
 }
 
@@ -352,6 +369,9 @@ void tlb_destroy(CPUState *cpu)
 
         g_free(fast->table);
         g_free(desc->fulltlb);
+        g_free(desc->vtable);
+        g_free(desc->vfulltlb);
+        g_free(desc->vstamp);
     }
 }
 
@@ -494,7 +514,7 @@ static void tlb_flush_vtlb_page_mask_locked(CPUState *cpu, int mmu_idx,
     int k;
 
     assert_cpu_is_self(cpu);
-    for (k = 0; k < CPU_VTLB_SIZE; k++) {
+    for (k = 0; k < d->vsize; k++) {
         if (tlb_flush_entry_mask_locked(&d->vtable[k], page, mask)) {
             tlb_n_used_entries_dec(cpu, mmu_idx);
         }
@@ -945,7 +965,7 @@ void tlb_reset_dirty(CPUState *cpu, ram_addr_t start1, ram_addr_t length)
                                          start1, length);
         }
 
-        for (i = 0; i < CPU_VTLB_SIZE; i++) {
+        for (i = 0; i < cpu->neg.tlb.d[mmu_idx].vsize; i++) {
             tlb_reset_dirty_range_locked(&cpu->neg.tlb.d[mmu_idx].vtable[i],
                                          start1, length);
         }
@@ -978,7 +998,7 @@ static void tlb_set_dirty(CPUState *cpu, vaddr addr)
 
     for (mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
         int k;
-        for (k = 0; k < CPU_VTLB_SIZE; k++) {
+        for (k = 0; k < cpu->neg.tlb.d[mmu_idx].vsize; k++) {
             tlb_set_dirty1_locked(&cpu->neg.tlb.d[mmu_idx].vtable[k], addr);
         }
     }
@@ -1028,15 +1048,37 @@ static inline void tlb_set_compare(CPUTLBEntryFull *full, CPUTLBEntry *ent,
 }
 
 /*
- * Add a new TLB entry. At most one entry for a given virtual address
- * is permitted. Only a single TARGET_PAGE_SIZE region is mapped, the
- * supplied size is only used by tlb_flush_page.
- *
- * Called from TCG-generated code, which is under an RCU read-side
- * critical section.
+ * Choose the victim tlb entry to be replaced by an entry evicted from
+ * the fast path tlb.  Called with tlb_c.lock held.
  */
-void tlb_set_page_full(CPUState *cpu, int mmu_idx,
-                       vaddr addr, CPUTLBEntryFull *full)
+static size_t tlb_victim_index_locked(CPUState *cpu, CPUTLBDesc *desc)
+{
+    size_t i, vidx = 0;
+
+    if (!cpu->neg.tlb.c.vtlb_lru) {
+        return desc->vindex++ % desc->vsize;
+    }
+
+    for (i = 0; i < desc->vsize; i++) {
+        if (tlb_entry_is_empty(&desc->vtable[i])) {
+            vidx = i;
+            break;
+        }
+        if (desc->vstamp[i] < desc->vstamp[vidx]) {
+            vidx = i;
+        }
+    }
+    desc->vstamp[vidx] = ++desc->vindex;
+    return vidx;
+}
+
+/*
+ * Install the TLB entry for the single TARGET_PAGE_SIZE region at ADDR.
+ * If PREFILL, this is a speculative entry for another page of a large
+ * guest page: only RAM is mapped, and only into an empty slot.
+ */
+static void tlb_set_page_one(CPUState *cpu, int mmu_idx, vaddr addr,
+                             CPUTLBEntryFull *full, bool prefill)
 {
     CPUTLB *tlb = &cpu->neg.tlb;
     CPUTLBDesc *desc = &tlb->d[mmu_idx];
@@ -1055,7 +1097,6 @@ void tlb_set_page_full(CPUState *cpu, int mmu_idx,
         sz = TARGET_PAGE_SIZE;
     } else {
         sz = (hwaddr)1 << full->lg_page_size;
-        tlb_add_large_page(cpu, mmu_idx, addr, sz);
     }
     addr_page = addr & TARGET_PAGE_MASK;
     paddr_page = full->phys_addr & TARGET_PAGE_MASK;
@@ -1079,6 +1120,10 @@ void tlb_set_page_full(CPUState *cpu, int mmu_idx,
     is_ram = memory_region_is_ram(section->mr);
     is_romd = memory_region_is_romd(section->mr);
 
+    if (prefill && (!is_ram || (prot & PAGE_WRITE_INV))) {
+        return;
+    }
+
     if (is_ram || is_romd) {
         /* RAM and ROMD both have associated host memory. */
         addend = (uintptr_t)memory_region_get_ram_ptr(section->mr) + xlat;
@@ -1131,6 +1176,12 @@ void tlb_set_page_full(CPUState *cpu, int mmu_idx,
      */
     qemu_spin_lock(&tlb->c.lock);
 
+    /* Never evict an entry for the sake of a speculative one.  */
+    if (prefill && !tlb_entry_is_empty(te)) {
+        qemu_spin_unlock(&tlb->c.lock);
+        return;
+    }
+
     /* Note that the tlb is no longer clean.  */
     tlb->c.dirty |= 1 << mmu_idx;
 
@@ -1142,7 +1193,7 @@ void tlb_set_page_full(CPUState *cpu, int mmu_idx,
      * different page; otherwise just overwrite the stale data.
      */
     if (!tlb_hit_page_anyprot(te, addr_page) && !tlb_entry_is_empty(te)) {
-        unsigned vidx = desc->vindex++ % CPU_VTLB_SIZE;
+        size_t vidx = tlb_victim_index_locked(cpu, desc);
         CPUTLBEntry *tv = &desc->vtable[vidx];
 
         /* Evict the old entry into the victim tlb.  */
@@ -1195,6 +1246,71 @@ void tlb_set_page_full(CPUState *cpu, int mmu_idx,
     copy_tlb_helper_locked(te, &tn);
     tlb_n_used_entries_inc(cpu, mmu_idx);
     qemu_spin_unlock(&tlb->c.lock);
+
+    if (!prefill) {
+        qatomic_set(&tlb->c.fill_count, tlb->c.fill_count + 1);
+    }
+}
+
+/*
+ * Populate the entries for the other pages of a large guest page which
+ * lie within an aligned window of TLB_LARGE_PAGE_PREFILL pages around
+ * ADDR.  These share the guest translation just computed by tlb_fill,
+ * so a single fill serves neighbouring accesses.  The whole large page
+ * has been registered with tlb_add_large_page, so a flush of any page
+ * within it drops the prefilled entries as well.
+ */
+#define TLB_LARGE_PAGE_PREFILL  16
+
+static void tlb_prefill_large_page(CPUState *cpu, int mmu_idx, vaddr addr,
+                                   const CPUTLBEntryFull *full)
+{
+    vaddr addr_page = addr & TARGET_PAGE_MASK;
+    hwaddr paddr_page = full->phys_addr & TARGET_PAGE_MASK;
+    vaddr win = (vaddr)TLB_LARGE_PAGE_PREFILL << TARGET_PAGE_BITS;
+    vaddr start;
+    int i, n;
+
+    win = MIN(win, (vaddr)1 << full->lg_page_size);
+    start = addr_page & -win;
+    n = win >> TARGET_PAGE_BITS;
+
+    for (i = 0; i < n; i++) {
+        vaddr page = start + ((vaddr)i << TARGET_PAGE_BITS);
+        CPUTLBEntryFull nfull;
+
+        if (page == addr_page ||
+            !tlb_entry_is_empty(tlb_entry(cpu, mmu_idx, page))) {
+            continue;
+        }
+        nfull = *full;
+        nfull.phys_addr = paddr_page + (page - addr_page);
+        tlb_set_page_one(cpu, mmu_idx, page, &nfull, true);
+    }
+}
+
+/*
+ * Add a new TLB entry. At most one entry for a given virtual address
+ * is permitted. For a large page, up to TLB_LARGE_PAGE_PREFILL of its
+ * TARGET_PAGE_SIZE regions are mapped; the supplied size is otherwise
+ * only used by tlb_flush_page.
+ *
+ * Called from TCG-generated code, which is under an RCU read-side
+ * critical section.
+ */
+void tlb_set_page_full(CPUState *cpu, int mmu_idx,
+                       vaddr addr, CPUTLBEntryFull *full)
+{
+    if (full->lg_page_size > TARGET_PAGE_BITS) {
+        tlb_add_large_page(cpu, mmu_idx, addr,
+                           (vaddr)1 << full->lg_page_size);
+    }
+
+    tlb_set_page_one(cpu, mmu_idx, addr, full, false);
+
+    if (full->lg_page_size > TARGET_PAGE_BITS) {
+        tlb_prefill_large_page(cpu, mmu_idx, addr, full);
+    }
 }
 
 void tlb_set_page_with_attrs(CPUState *cpu, vaddr addr,
@@ -1284,11 +1400,14 @@ static void io_failed(CPUState *cpu, CPUTLBEntryFull *full, vaddr addr,
 static bool victim_tlb_hit(CPUState *cpu, size_t mmu_idx, size_t index,
                            MMUAccessType access_type, vaddr page)
 {
+    CPUTLBDesc *desc = &cpu->neg.tlb.d[mmu_idx];
     size_t vidx;
 
     assert_cpu_is_self(cpu);
-    for (vidx = 0; vidx < CPU_VTLB_SIZE; ++vidx) {
-        CPUTLBEntry *vtlb = &cpu->neg.tlb.d[mmu_idx].vtable[vidx];
+    qatomic_set(&cpu->neg.tlb.c.miss_count, cpu->neg.tlb.c.miss_count + 1);
+
+    for (vidx = 0; vidx < desc->vsize; ++vidx) {
+        CPUTLBEntry *vtlb = &desc->vtable[vidx];
         uint64_t cmp = tlb_read_idx(vtlb, access_type);
 
         if (cmp == page) {
@@ -1296,15 +1415,28 @@ static bool victim_tlb_hit(CPUState *cpu, size_t mmu_idx, size_t index,
             CPUTLBEntry tmptlb, *tlb = &cpu->neg.tlb.f[mmu_idx].table[index];
 
             qemu_spin_lock(&cpu->neg.tlb.c.lock);
+            /*
+             * Stamp the slot for the hit, before the swap.  The stamp is
+             * per slot: the promoted entry gets a fresh one in whichever
+             * slot it is evicted to later, and until then this slot keeps
+             * the entry it traded places with, which is just as likely
+             * to come back when two pages conflict in the fast path tlb.
+             */
+            if (cpu->neg.tlb.c.vtlb_lru) {
+                desc->vstamp[vidx] = ++desc->vindex;
+            }
             copy_tlb_helper_locked(&tmptlb, tlb);
             copy_tlb_helper_locked(tlb, vtlb);
             copy_tlb_helper_locked(vtlb, &tmptlb);
             qemu_spin_unlock(&cpu->neg.tlb.c.lock);
 
-            CPUTLBEntryFull *f1 = &cpu->neg.tlb.d[mmu_idx].fulltlb[index];
-            CPUTLBEntryFull *f2 = &cpu->neg.tlb.d[mmu_idx].vfulltlb[vidx];
+            CPUTLBEntryFull *f1 = &desc->fulltlb[index];
+            CPUTLBEntryFull *f2 = &desc->vfulltlb[vidx];
             CPUTLBEntryFull tmpf;
             tmpf = *f1; *f1 = *f2; *f2 = tmpf;
+
+            qatomic_set(&cpu->neg.tlb.c.victim_hit_count,
+                        cpu->neg.tlb.c.victim_hit_count + 1);
             return true;
         }
     }
@@ -17,6 +17,9 @@ extern int64_t max_advance;
 
 extern bool one_insn_per_tb;
 
+extern unsigned tcg_victim_tlb_size;
+extern bool tcg_victim_tlb_lru;
+
 /*
  * Return true if CS is not running in parallel with other cpus, either
  * because there are no other cpus or we are within an exclusive context.
@@ -56,4 +59,6 @@ void cpu_restore_state_from_tb(CPUState *cpu, TranslationBlock *tb,
 bool tcg_exec_realizefn(CPUState *cpu, Error **errp);
 void tcg_exec_unrealizefn(CPUState *cpu);
 
+void tcg_stats_init(void);
+
 #endif
@@ -12,9 +12,11 @@
 #include "qapi/error.h"
 #include "qapi/type-helpers.h"
 #include "qapi/qapi-commands-machine.h"
+#include "qapi/qapi-types-stats.h"
 #include "monitor/monitor.h"
 #include "sysemu/cpus.h"
 #include "sysemu/cpu-timers.h"
+#include "sysemu/stats.h"
 #include "sysemu/tcg.h"
 #include "tcg/tcg.h"
 #include "internal-common.h"
@@ -235,6 +237,121 @@ HumanReadableText *qmp_x_query_opcount(Error **errp)
     return human_readable_text_from_str(buf);
 }
 
+/*
+ * Statistics for query-stats.  Hits in the fast path tlb are resolved
+ * entirely within generated code and are not counted.
+ */
+static const struct {
+    const char *name;
+    size_t offset;
+} tcg_vcpu_stats[] = {
+    { "tlb-misses", offsetof(CPUTLBCommon, miss_count) },
+    { "tlb-victim-hits", offsetof(CPUTLBCommon, victim_hit_count) },
+    { "tlb-fills", offsetof(CPUTLBCommon, fill_count) },
+    { "tlb-resizes", offsetof(CPUTLBCommon, resize_count) },
+    { "tlb-full-flushes", offsetof(CPUTLBCommon, full_flush_count) },
+    { "tlb-partial-flushes", offsetof(CPUTLBCommon, part_flush_count) },
+    { "tlb-elided-flushes", offsetof(CPUTLBCommon, elide_flush_count) },
+};
+
+static StatsList *tcg_stats_add(StatsList *list, strList *names,
+                                const char *name, uint64_t val)
+{
+    Stats *stats;
+
+    if (!apply_str_list_filter(name, names)) {
+        return list;
+    }
+
+    stats = g_new0(Stats, 1);
+    stats->name = g_strdup(name);
+    stats->value = g_new0(StatsValue, 1);
+    stats->value->type = QTYPE_QNUM;
+    stats->value->u.scalar = val;
+
+    QAPI_LIST_PREPEND(list, stats);
+    return list;
+}
+
+static void tcg_stats_cb(StatsResultList **result, StatsTarget target,
+                         strList *names, strList *targets, Error **errp)
+{
+    StatsList *stats_list = NULL;
+    CPUState *cpu;
+    int i;
+
+    switch (target) {
+    case STATS_TARGET_VM:
+        stats_list = tcg_stats_add(stats_list, names, "tb-flushes",
+                                   qatomic_read(&tb_ctx.tb_flush_count));
+        stats_list = tcg_stats_add(stats_list, names, "tb-invalidates",
+                        qatomic_read(&tb_ctx.tb_phys_invalidate_count));
+        if (stats_list) {
+            add_stats_entry(result, STATS_PROVIDER_TCG, NULL, stats_list);
+        }
+        break;
+    case STATS_TARGET_VCPU:
+        CPU_FOREACH(cpu) {
+            const char *path = cpu->parent_obj.canonical_path;
+            void *c = &cpu->neg.tlb.c;
+
+            if (!apply_str_list_filter(path, targets)) {
+                continue;
+            }
+            stats_list = NULL;
+            for (i = 0; i < ARRAY_SIZE(tcg_vcpu_stats); i++) {
+                size_t *val = c + tcg_vcpu_stats[i].offset;
+
+                stats_list = tcg_stats_add(stats_list, names,
+                                           tcg_vcpu_stats[i].name,
+                                           qatomic_read(val));
+            }
+            if (stats_list) {
+                add_stats_entry(result, STATS_PROVIDER_TCG, path, stats_list);
+            }
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+static StatsSchemaValueList *tcg_schema_add(StatsSchemaValueList *list,
+                                            const char *name)
+{
+    StatsSchemaValueList *schema_entry = g_new0(StatsSchemaValueList, 1);
+
+    schema_entry->value = g_new0(StatsSchemaValue, 1);
+    schema_entry->value->type = STATS_TYPE_CUMULATIVE;
+    schema_entry->value->name = g_strdup(name);
+    schema_entry->next = list;
+
+    return schema_entry;
+}
+
+static void tcg_stats_schemas_cb(StatsSchemaList **result, Error **errp)
+{
+    StatsSchemaValueList *stats_list = NULL;
+    int i;
+
+    stats_list = tcg_schema_add(stats_list, "tb-flushes");
+    stats_list = tcg_schema_add(stats_list, "tb-invalidates");
+    add_stats_schema(result, STATS_PROVIDER_TCG, STATS_TARGET_VM, stats_list);
+
+    stats_list = NULL;
+    for (i = 0; i < ARRAY_SIZE(tcg_vcpu_stats); i++) {
+        stats_list = tcg_schema_add(stats_list, tcg_vcpu_stats[i].name);
+    }
+    add_stats_schema(result, STATS_PROVIDER_TCG, STATS_TARGET_VCPU,
+                     stats_list);
+}
+
+void tcg_stats_init(void)
+{
+    add_stats_callbacks(STATS_PROVIDER_TCG, tcg_stats_cb,
+                        tcg_stats_schemas_cb);
+}
+
 static void hmp_tcg_register(void)
 {
     monitor_register_hmp_info_hrt("jit", qmp_x_query_jit);
@@ -37,6 +37,7 @@
 #include "qemu/units.h"
 #if !defined(CONFIG_USER_ONLY)
 #include "hw/boards.h"
+#include "hw/core/cpu.h"
 #endif
 #include "internal-common.h"
 
@@ -47,6 +48,10 @@ struct TCGState {
     bool one_insn_per_tb;
     int splitwx_enabled;
     unsigned long tb_size;
+#ifndef CONFIG_USER_ONLY
+    uint32_t victim_tlb_size;
+    bool victim_tlb_lru;
+#endif
 };
 typedef struct TCGState TCGState;
 
@@ -95,6 +100,10 @@ static void tcg_accel_instance_init(Object *obj)
 #else
     s->splitwx_enabled = 0;
 #endif
+
+#ifndef CONFIG_USER_ONLY
+    s->victim_tlb_size = CPU_VTLB_DEFAULT_SIZE;
+#endif
 }
 
 bool mttcg_enabled;
@@ -111,6 +120,10 @@ static int tcg_init_machine(MachineState *ms)
 
     tcg_allowed = true;
     mttcg_enabled = s->mttcg_enabled;
+#ifndef CONFIG_USER_ONLY
+    tcg_victim_tlb_size = s->victim_tlb_size;
+    tcg_victim_tlb_lru = s->victim_tlb_lru;
+#endif
 
     page_init();
     tb_htable_init();
@@ -124,6 +137,10 @@ static int tcg_init_machine(MachineState *ms)
     tcg_prologue_init();
 #endif
 
+#ifndef CONFIG_USER_ONLY
+    tcg_stats_init();
+#endif
+
     return 0;
 }
 
@@ -181,6 +198,58 @@ static void tcg_set_tb_size(Object *obj, Visitor *v,
     s->tb_size = value;
 }
 
+#ifndef CONFIG_USER_ONLY
+static void tcg_get_victim_tlb_size(Object *obj, Visitor *v,
+                                    const char *name, void *opaque,
+                                    Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+    uint32_t value = s->victim_tlb_size;
+
+    visit_type_uint32(v, name, &value, errp);
+}
+
+static void tcg_set_victim_tlb_size(Object *obj, Visitor *v,
+                                    const char *name, void *opaque,
+                                    Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+    uint32_t value;
+
+    if (!visit_type_uint32(v, name, &value, errp)) {
+        return;
+    }
+    if (value < 1 || value > CPU_VTLB_MAX_SIZE) {
+        error_setg(errp, "victim-tlb-size must be between 1 and %d",
+                   CPU_VTLB_MAX_SIZE);
+        return;
+    }
+
+    s->victim_tlb_size = value;
+}
+
+static char *tcg_get_victim_tlb_policy(Object *obj, Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+
+    return g_strdup(s->victim_tlb_lru ? "lru" : "fifo");
+}
+
+static void tcg_set_victim_tlb_policy(Object *obj, const char *value,
+                                      Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+
+    if (strcmp(value, "lru") == 0) {
+        s->victim_tlb_lru = true;
+    } else if (strcmp(value, "fifo") == 0) {
+        s->victim_tlb_lru = false;
+    } else {
+        error_setg(errp, "Invalid 'victim-tlb-policy' setting %s", value);
+    }
+}
+#endif
+
 static bool tcg_get_splitwx(Object *obj, Error **errp)
 {
     TCGState *s = TCG_STATE(obj);
@@ -242,6 +311,20 @@ static void tcg_accel_class_init(ObjectClass *oc, void *data)
     object_class_property_set_description(oc, "tb-size",
         "TCG translation block cache size");
 
+#ifndef CONFIG_USER_ONLY
+    object_class_property_add(oc, "victim-tlb-size", "int",
+        tcg_get_victim_tlb_size, tcg_set_victim_tlb_size,
+        NULL, NULL);
+    object_class_property_set_description(oc, "victim-tlb-size",
+        "Number of entries in the per-MMU-mode victim TLB");
+
+    object_class_property_add_str(oc, "victim-tlb-policy",
+                                  tcg_get_victim_tlb_policy,
+                                  tcg_set_victim_tlb_policy);
+    object_class_property_set_description(oc, "victim-tlb-policy",
+        "Victim TLB replacement policy (fifo or lru)");
+#endif
+
     object_class_property_add_bool(oc, "split-wx",
         tcg_get_splitwx, tcg_set_splitwx);
     object_class_property_set_description(oc, "split-wx",
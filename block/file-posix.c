@@ -32,6 +32,7 @@
 #include "qemu/option.h"
 #include "qemu/units.h"
 #include "qemu/memalign.h"
+#include "exec/memory.h" /* for ram_block_discard_disable() */
 #include "trace.h"
 #include "block/thread-pool.h"
 #include "qemu/iov.h"
@@ -161,6 +162,8 @@ typedef struct BDRVRawState {
     bool use_linux_aio:1;
     bool has_laio_fdsync:1;
     bool use_linux_io_uring:1;
+    bool io_uring_fixed_buffers:1;
+    bool io_uring_fixed_files:1;
     int page_cache_inconsistent; /* errno from fdatasync failure */
     bool has_fallocate;
     bool needs_alignment;
@@ -174,6 +177,9 @@ typedef struct BDRVRawState {
     } stats;
 
     PRManager *pr_mgr;
+
+    /* host -> size of the memory given to luring_register_buf() */
+    GHashTable *io_uring_bufs;
 } BDRVRawState;
 
 typedef struct BDRVRawReopenState {
@@ -561,6 +567,18 @@ static QemuOptsList raw_runtime_opts = {
             .type = QEMU_OPT_NUMBER,
             .help = "AIO max batch size (0 = auto handled by AIO backend, default: 0)",
         },
+#ifdef CONFIG_LINUX_IO_URING
+        {
+            .name = "io-uring-fixed-buffers",
+            .type = QEMU_OPT_BOOL,
+            .help = "register guest memory with io_uring (default: off)",
+        },
+        {
+            .name = "io-uring-fixed-files",
+            .type = QEMU_OPT_BOOL,
+            .help = "register the file with io_uring (default: off)",
+        },
+#endif
         {
             .name = "locking",
             .type = QEMU_OPT_STRING,
@@ -638,6 +656,31 @@ static int raw_open_common(BlockDriverState *bs, QDict *options,
     s->use_linux_aio = (aio == BLOCKDEV_AIO_OPTIONS_NATIVE);
 #ifdef CONFIG_LINUX_IO_URING
     s->use_linux_io_uring = (aio == BLOCKDEV_AIO_OPTIONS_IO_URING);
+    s->io_uring_fixed_buffers = qemu_opt_get_bool(opts,
+                                                  "io-uring-fixed-buffers",
+                                                  false);
+    s->io_uring_fixed_files = qemu_opt_get_bool(opts, "io-uring-fixed-files",
+                                                false);
+    if ((s->io_uring_fixed_buffers || s->io_uring_fixed_files) &&
+        !s->use_linux_io_uring) {
+        error_setg(errp, "io-uring-fixed-buffers and io-uring-fixed-files "
+                         "require aio=io_uring");
+        ret = -EINVAL;
+        goto fail;
+    }
+    if (s->io_uring_fixed_buffers) {
+        /*
+         * Fixed buffers pin guest memory, so discarding it (e.g. with
+         * virtio-mem or a balloon) would leave requests using stale pages.
+         */
+        ret = ram_block_discard_disable(true);
+        if (ret < 0) {
+            error_setg_errno(errp, -ret, "ram_block_discard_disable() failed");
+            s->io_uring_fixed_buffers = false;
+            goto fail;
+        }
+        s->io_uring_bufs = g_hash_table_new(NULL, NULL);
+    }
 #endif
 
     s->aio_max_batch = qemu_opt_get_number(opts, "aio-max-batch", 0);
@@ -814,6 +857,12 @@ fail:
     if (ret < 0 && s->fd != -1) {
         qemu_close(s->fd);
     }
+#ifdef CONFIG_LINUX_IO_URING
+    if (ret < 0 && s->io_uring_fixed_buffers) {
+        g_clear_pointer(&s->io_uring_bufs, g_hash_table_destroy);
+        ram_block_discard_disable(false);
+    }
+#endif
     if (filename && (bdrv_flags & BDRV_O_TEMPORARY)) {
         unlink(filename);
     }
@@ -2508,7 +2557,9 @@ static int coroutine_fn raw_co_prw(BlockDriverState *bs, int64_t *offset_ptr,
 #ifdef CONFIG_LINUX_IO_URING
     } else if (raw_check_linux_io_uring(s)) {
         assert(qiov->size == bytes);
-        ret = luring_co_submit(bs, s->fd, offset, qiov, type);
+        ret = luring_co_submit(bs, s->fd, offset, qiov, type,
+                               s->io_uring_fixed_buffers,
+                               s->io_uring_fixed_files);
         goto out;
 #endif
 #ifdef CONFIG_LINUX_AIO
@@ -2600,7 +2651,8 @@ static int coroutine_fn raw_co_flush_to_disk(BlockDriverState *bs)
 
 #ifdef CONFIG_LINUX_IO_URING
     if (raw_check_linux_io_uring(s)) {
-        return luring_co_submit(bs, s->fd, 0, NULL, QEMU_AIO_FLUSH);
+        return luring_co_submit(bs, s->fd, 0, NULL, QEMU_AIO_FLUSH,
+                                false, s->io_uring_fixed_files);
     }
 #endif
 #ifdef CONFIG_LINUX_AIO
@@ -2611,15 +2663,67 @@ static int coroutine_fn raw_co_flush_to_disk(BlockDriverState *bs)
     return raw_thread_pool_submit(handle_aiocb_flush, &acb);
 }
 
+/* Close s->fd, which must not have requests in flight */
+static void raw_close_fd(BDRVRawState *s)
+{
+#ifdef CONFIG_LINUX_IO_URING
+    if (s->io_uring_fixed_files) {
+        luring_unregister_file(s->fd);
+    }
+#endif
+    qemu_close(s->fd);
+}
+
+#ifdef CONFIG_LINUX_IO_URING
+static bool raw_register_buf(BlockDriverState *bs, void *host, size_t size,
+                             Error **errp)
+{
+    BDRVRawState *s = bs->opaque;
+
+    /* Failing to register only loses the optimization, so never fail */
+    if (s->io_uring_fixed_buffers &&
+        g_hash_table_insert(s->io_uring_bufs, host, GSIZE_TO_POINTER(size))) {
+        luring_register_buf(host, size);
+    }
+    return true;
+}
+
+static void raw_unregister_buf(BlockDriverState *bs, void *host, size_t size)
+{
+    BDRVRawState *s = bs->opaque;
+
+    if (s->io_uring_fixed_buffers &&
+        g_hash_table_remove(s->io_uring_bufs, host)) {
+        luring_unregister_buf(host, size);
+    }
+}
+
+static gboolean raw_unregister_buf_cb(gpointer key, gpointer value,
+                                      gpointer opaque)
+{
+    luring_unregister_buf(key, GPOINTER_TO_SIZE(value));
+    return TRUE;
+}
+#endif
+
 static void raw_close(BlockDriverState *bs)
 {
     BDRVRawState *s = bs->opaque;
 
+#ifdef CONFIG_LINUX_IO_URING
+    if (s->io_uring_bufs) {
+        g_hash_table_foreach_remove(s->io_uring_bufs, raw_unregister_buf_cb,
+                                    NULL);
+        g_clear_pointer(&s->io_uring_bufs, g_hash_table_destroy);
+        ram_block_discard_disable(false);
+    }
+#endif
+
     if (s->fd >= 0) {
 #if defined(CONFIG_BLKZONED)
         g_free(bs->wps);
 #endif
-        qemu_close(s->fd);
+        raw_close_fd(s);
         s->fd = -1;
     }
 }
@@ -3809,7 +3913,7 @@ static void raw_set_perm(BlockDriverState *bs, uint64_t perm, uint64_t shared)
     /* For reopen, we have already switched to the new fd (.bdrv_set_perm is
      * called after .bdrv_reopen_commit) */
     if (s->perm_change_fd && s->fd != s->perm_change_fd) {
-        qemu_close(s->fd);
+        raw_close_fd(s);
         s->fd = s->perm_change_fd;
         s->open_flags = s->perm_change_flags;
     }
@@ -3916,6 +4020,10 @@ BlockDriver bdrv_file = {
     .bdrv_check_perm = raw_check_perm,
     .bdrv_set_perm   = raw_set_perm,
     .bdrv_abort_perm_update = raw_abort_perm_update,
+#ifdef CONFIG_LINUX_IO_URING
+    .bdrv_register_buf = raw_register_buf,
+    .bdrv_unregister_buf = raw_unregister_buf,
+#endif
     .create_opts = &raw_create_opts,
     .mutable_opts = mutable_opts,
 };
@@ -4282,6 +4390,10 @@ static BlockDriver bdrv_host_device = {
     .bdrv_abort_perm_update = raw_abort_perm_update,
     .bdrv_probe_blocksizes = hdev_probe_blocksizes,
     .bdrv_probe_geometry = hdev_probe_geometry,
+#ifdef CONFIG_LINUX_IO_URING
+    .bdrv_register_buf = raw_register_buf,
+    .bdrv_unregister_buf = raw_unregister_buf,
+#endif
 
     /* generic scsi device */
 #ifdef __linux__
@@ -14,8 +14,13 @@
 #include "qemu/queue.h"
 #include "block/block.h"
 #include "block/raw-aio.h"
+#include "qemu/bitmap.h"
 #include "qemu/coroutine.h"
 #include "qemu/defer-call.h"
+#include "qemu/error-report.h"
+#include "qemu/lockable.h"
+#include "qemu/rcu.h"
+#include "qemu/units.h"
 #include "qapi/error.h"
 #include "sysemu/block-backend.h"
 #include "trace.h"
@@ -26,6 +31,13 @@
 /* io_uring ring size */
 #define MAX_ENTRIES 128
 
+/* The kernel does not take fixed buffers larger than 1 GiB */
+#define LURING_FIXED_BUF_SIZE (1 * GiB)
+
+/* Size of the sparse fixed buffer and fixed file tables of each ring */
+#define LURING_MAX_FIXED_BUFS 4096
+#define LURING_MAX_FIXED_FILES 64
+
 typedef struct LuringAIOCB {
     Coroutine *co;
     struct io_uring_sqe sqeq;
@@ -58,8 +70,432 @@ struct LuringState {
     LuringQueue io_q;
 
     QEMUBH *completion_bh;
+
+    /* Whether the ring mirrors the fixed buffers, see luring_fixed */
+    bool fixed_bufs;
+
+    /* Whether the ring has a fixed file table */
+    bool fixed_files;
+
+    /*
+     * Whether creating the tables was tried.  They are only created once a
+     * node asks for fixed buffers or fixed files.
+     */
+    bool fixed_bufs_setup;
+    bool fixed_files_setup;
+
+    /* fd held by each slot of the fixed file table, -1 if free */
+    int fixed_fds[LURING_MAX_FIXED_FILES];
+
+    QLIST_ENTRY(LuringState) next;
 };
 
+#ifdef HAVE_IO_URING_REGISTER_SPARSE
+/*
+ * Memory given to luring_register_buf() is registered as fixed buffers with
+ * every ring, so that the kernel does not pin its pages again for each
+ * request.  A range takes one slot of the fixed buffer table for every
+ * LURING_FIXED_BUF_SIZE bytes, at the same index in all rings.
+ *
+ * The ranges are looked up under RCU when preparing requests, and only
+ * change under luring_fixed.lock, which also protects the list of rings
+ * and the contents of their fixed file tables.
+ */
+typedef struct LuringFixedBuf {
+    void *host;
+    size_t size;
+    unsigned int slot;          /* first slot of the range */
+    unsigned int refcnt;
+} LuringFixedBuf;
+
+typedef struct LuringFixedBufs {
+    struct rcu_head rcu;
+    unsigned int nr;
+    LuringFixedBuf buf[];       /* sorted by host address */
+} LuringFixedBufs;
+
+static struct {
+    QemuMutex lock;
+    LuringFixedBufs *bufs;
+    DECLARE_BITMAP(used_slots, LURING_MAX_FIXED_BUFS);
+    QLIST_HEAD(, LuringState) rings;
+} luring_fixed;
+
+static void __attribute__((__constructor__)) luring_fixed_init(void)
+{
+    qemu_mutex_init(&luring_fixed.lock);
+}
+
+static unsigned int luring_fixed_buf_slots(size_t size)
+{
+    return DIV_ROUND_UP(size, LURING_FIXED_BUF_SIZE);
+}
+
+/* Fill the slots of @buf in the fixed buffer table of @s, or clear them */
+static int luring_fixed_buf_update(LuringState *s, const LuringFixedBuf *buf,
+                                   bool add)
+{
+    unsigned int nr = luring_fixed_buf_slots(buf->size);
+    g_autofree struct iovec *iov = g_new0(struct iovec, nr);
+    unsigned int i;
+    int ret;
+
+    for (i = 0; add && i < nr; i++) {
+        size_t offset = (size_t)i * LURING_FIXED_BUF_SIZE;
+
+        iov[i].iov_base = buf->host + offset;
+        iov[i].iov_len = MIN(buf->size - offset, LURING_FIXED_BUF_SIZE);
+    }
+
+    ret = io_uring_register_buffers_update_tag(&s->ring, buf->slot, iov,
+                                               NULL, nr);
+    return ret < 0 ? ret : 0;
+}
+
+/* Copy of @old with @n entries dropped or inserted at @pos */
+static LuringFixedBufs *luring_fixed_bufs_resize(LuringFixedBufs *old,
+                                                 unsigned int pos, int n)
+{
+    unsigned int old_nr = old ? old->nr : 0;
+    LuringFixedBufs *bufs;
+
+    bufs = g_malloc0(sizeof(*bufs) + (old_nr + n) * sizeof(bufs->buf[0]));
+    bufs->nr = old_nr + n;
+    if (old_nr) {
+        memcpy(bufs->buf, old->buf, pos * sizeof(bufs->buf[0]));
+        if (n > 0) {
+            memcpy(&bufs->buf[pos + n], &old->buf[pos],
+                   (old_nr - pos) * sizeof(bufs->buf[0]));
+        } else {
+            memcpy(&bufs->buf[pos], &old->buf[pos - n],
+                   (old_nr - pos + n) * sizeof(bufs->buf[0]));
+        }
+    }
+    return bufs;
+}
+
+/* Index of the first range that ends after @host */
+static unsigned int luring_fixed_bufs_find(LuringFixedBufs *bufs, void *host)
+{
+    unsigned int lo = 0, hi = bufs ? bufs->nr : 0;
+
+    while (lo < hi) {
+        unsigned int mid = lo + (hi - lo) / 2;
+        LuringFixedBuf *buf = &bufs->buf[mid];
+
+        if ((uintptr_t)buf->host + buf->size <= (uintptr_t)host) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+/*
+ * Create the fixed buffer table of @s and fill it with the registered
+ * ranges, unless that was already tried.  luring_fixed.lock must be held.
+ */
+static void luring_fixed_bufs_setup(LuringState *s)
+{
+    LuringFixedBufs *bufs = luring_fixed.bufs;
+    unsigned int i;
+
+    if (s->fixed_bufs_setup) {
+        return;
+    }
+    s->fixed_bufs_setup = true;
+
+    /* Needs Linux 5.19, otherwise the ring goes without */
+    if (io_uring_register_buffers_sparse(&s->ring,
+                                         LURING_MAX_FIXED_BUFS) < 0) {
+        return;
+    }
+
+    for (i = 0; bufs && i < bufs->nr; i++) {
+        int ret = luring_fixed_buf_update(s, &bufs->buf[i], true);
+
+        if (ret < 0) {
+            trace_luring_register_buf_failed(bufs->buf[i].host,
+                                             bufs->buf[i].size, ret);
+            return;
+        }
+    }
+    qatomic_set(&s->fixed_bufs, true);
+}
+
+/**
+ * luring_register_buf:
+ * @host: start of the memory range
+ * @size: size of the memory range
+ *
+ * Register the memory range as fixed buffers with all rings, current and
+ * future.  This is only an optimization: if the range cannot be registered,
+ * requests on it keep working as before.  Registering the same range again
+ * only takes a reference.
+ */
+void luring_register_buf(void *host, size_t size)
+{
+    unsigned int nr = luring_fixed_buf_slots(size);
+    LuringFixedBufs *old, *bufs;
+    LuringFixedBuf *buf, new_buf;
+    unsigned int pos;
+    unsigned long slot;
+    LuringState *s;
+
+    QEMU_LOCK_GUARD(&luring_fixed.lock);
+
+    old = luring_fixed.bufs;
+    pos = luring_fixed_bufs_find(old, host);
+    buf = old && pos < old->nr ? &old->buf[pos] : NULL;
+    if (buf && buf->host == host && buf->size == size) {
+        /* Readers do not look at refcnt, no need for a copy */
+        buf->refcnt++;
+        return;
+    }
+    if (buf && (uintptr_t)buf->host < (uintptr_t)host + size) {
+        trace_luring_register_buf_failed(host, size, -EEXIST);
+        return;
+    }
+
+    slot = bitmap_find_next_zero_area(luring_fixed.used_slots,
+                                      LURING_MAX_FIXED_BUFS, 0, nr, 0);
+    if (slot + nr > LURING_MAX_FIXED_BUFS) {
+        trace_luring_register_buf_failed(host, size, -ENOSPC);
+        return;
+    }
+
+    new_buf = (LuringFixedBuf) {
+        .host = host,
+        .size = size,
+        .slot = slot,
+        .refcnt = 1,
+    };
+    QLIST_FOREACH(s, &luring_fixed.rings, next) {
+        int ret;
+
+        luring_fixed_bufs_setup(s);
+        if (!s->fixed_bufs) {
+            continue;
+        }
+        ret = luring_fixed_buf_update(s, &new_buf, true);
+        if (ret < 0) {
+            /* Typically RLIMIT_MEMLOCK; the ring stops using fixed buffers */
+            trace_luring_register_buf_failed(host, size, ret);
+            qatomic_set(&s->fixed_bufs, false);
+        }
+    }
+    bitmap_set(luring_fixed.used_slots, slot, nr);
+
+    bufs = luring_fixed_bufs_resize(old, pos, 1);
+    bufs->buf[pos] = new_buf;
+    qatomic_rcu_set(&luring_fixed.bufs, bufs);
+    if (old) {
+        g_free_rcu(old, rcu);
+    }
+    trace_luring_register_buf(host, size, slot, nr);
+}
+
+/**
+ * luring_unregister_buf:
+ * @host: start of the memory range
+ * @size: size of the memory range
+ *
+ * Drop a reference to a range given to luring_register_buf().  The caller
+ * must ensure that no requests on the range are in flight.
+ */
+void luring_unregister_buf(void *host, size_t size)
+{
+    LuringFixedBufs *old, *bufs;
+    LuringFixedBuf buf;
+    unsigned int pos;
+    LuringState *s;
+
+    QEMU_LOCK_GUARD(&luring_fixed.lock);
+
+    old = luring_fixed.bufs;
+    pos = luring_fixed_bufs_find(old, host);
+    if (!old || pos == old->nr || old->buf[pos].host != host ||
+        old->buf[pos].size != size) {
+        return;
+    }
+    if (--old->buf[pos].refcnt) {
+        return;
+    }
+
+    buf = old->buf[pos];
+    bufs = luring_fixed_bufs_resize(old, pos, -1);
+    qatomic_rcu_set(&luring_fixed.bufs, bufs);
+    g_free_rcu(old, rcu);
+
+    QLIST_FOREACH(s, &luring_fixed.rings, next) {
+        if (s->fixed_bufs) {
+            luring_fixed_buf_update(s, &buf, false);
+        }
+    }
+    bitmap_clear(luring_fixed.used_slots, buf.slot,
+                 luring_fixed_buf_slots(buf.size));
+    trace_luring_unregister_buf(host, size);
+}
+
+/* Returns the fixed buffer slot that holds all of @qiov, or -1 */
+static int luring_fixed_buf(LuringState *s, QEMUIOVector *qiov)
+{
+    LuringFixedBufs *bufs;
+    LuringFixedBuf *buf;
+    uintptr_t start, offset;
+    unsigned int pos;
+
+    /* Fixed buffer requests are not vectored */
+    if (!qiov || qiov->niov != 1 || !qatomic_read(&s->fixed_bufs)) {
+        return -1;
+    }
+
+    RCU_READ_LOCK_GUARD();
+
+    bufs = qatomic_rcu_read(&luring_fixed.bufs);
+    start = (uintptr_t)qiov->iov[0].iov_base;
+    pos = luring_fixed_bufs_find(bufs, qiov->iov[0].iov_base);
+    if (!bufs || pos == bufs->nr || (uintptr_t)bufs->buf[pos].host > start) {
+        return -1;
+    }
+
+    buf = &bufs->buf[pos];
+    offset = start - (uintptr_t)buf->host;
+    if (qiov->size > buf->size - offset ||
+        offset / LURING_FIXED_BUF_SIZE !=
+        (offset + qiov->size - 1) / LURING_FIXED_BUF_SIZE) {
+        return -1;
+    }
+    return buf->slot + offset / LURING_FIXED_BUF_SIZE;
+}
+
+/* Returns the fixed file slot that holds @fd, registering it if needed */
+static int luring_fixed_file(LuringState *s, int fd)
+{
+    int i;
+
+    if (s->fixed_files_setup && !s->fixed_files) {
+        return -1;
+    }
+
+    for (i = 0; i < LURING_MAX_FIXED_FILES; i++) {
+        if (qatomic_read(&s->fixed_fds[i]) == fd) {
+            return i;
+        }
+    }
+
+    QEMU_LOCK_GUARD(&luring_fixed.lock);
+
+    if (!s->fixed_files_setup) {
+        /* Needs Linux 5.19, otherwise the ring goes without */
+        s->fixed_files_setup = true;
+        s->fixed_files = io_uring_register_files_sparse(
+            &s->ring, LURING_MAX_FIXED_FILES) == 0;
+    }
+    if (!s->fixed_files) {
+        return -1;
+    }
+
+    for (i = 0; i < LURING_MAX_FIXED_FILES; i++) {
+        if (s->fixed_fds[i] == -1) {
+            break;
+        }
+    }
+    if (i == LURING_MAX_FIXED_FILES ||
+        io_uring_register_files_update(&s->ring, i, &fd, 1) < 0) {
+        return -1;
+    }
+
+    qatomic_set(&s->fixed_fds[i], fd);
+    trace_luring_register_file(s, fd, i);
+    return i;
+}
+
+/**
+ * luring_unregister_file:
+ * @fd: file descriptor
+ *
+ * Remove @fd from the fixed file tables.  Users of luring_co_submit() with
+ * @fixed_file must call this before closing @fd, with no requests on it in
+ * flight: the tables hold a reference to the file, which would otherwise
+ * stay open and be used in place of whatever gets the same fd later.
+ */
+void luring_unregister_file(int fd)
+{
+    LuringState *s;
+    int i;
+
+    QEMU_LOCK_GUARD(&luring_fixed.lock);
+
+    QLIST_FOREACH(s, &luring_fixed.rings, next) {
+        for (i = 0; i < LURING_MAX_FIXED_FILES; i++) {
+            if (s->fixed_fds[i] == fd) {
+                int none = -1;
+
+                io_uring_register_files_update(&s->ring, i, &none, 1);
+                qatomic_set(&s->fixed_fds[i], -1);
+                trace_luring_unregister_file(s, fd, i);
+            }
+        }
+    }
+}
+
+static void luring_fixed_add_ring(LuringState *s)
+{
+    unsigned int i;
+
+    for (i = 0; i < LURING_MAX_FIXED_FILES; i++) {
+        s->fixed_fds[i] = -1;
+    }
+
+    QEMU_LOCK_GUARD(&luring_fixed.lock);
+
+    /* The fixed file table is created on first use by luring_fixed_file() */
+    if (luring_fixed.bufs && luring_fixed.bufs->nr) {
+        luring_fixed_bufs_setup(s);
+    }
+
+    QLIST_INSERT_HEAD(&luring_fixed.rings, s, next);
+}
+
+static void luring_fixed_del_ring(LuringState *s)
+{
+    QEMU_LOCK_GUARD(&luring_fixed.lock);
+    QLIST_REMOVE(s, next);
+}
+#else
+void luring_register_buf(void *host, size_t size)
+{
+}
+
+void luring_unregister_buf(void *host, size_t size)
+{
+}
+
+static int luring_fixed_buf(LuringState *s, QEMUIOVector *qiov)
+{
+    return -1;
+}
+
+static int luring_fixed_file(LuringState *s, int fd)
+{
+    return -1;
+}
+
+void luring_unregister_file(int fd)
+{
+}
+
+static void luring_fixed_add_ring(LuringState *s)
+{
+}
+
+static void luring_fixed_del_ring(LuringState *s)
+{
+}
+#endif /* HAVE_IO_URING_REGISTER_SPARSE */
+
 /**
  * luring_resubmit:
  *
@@ -90,6 +526,15 @@ static void luring_resubmit_short_read(LuringState *s, LuringAIOCB *luringcb,
     luringcb->total_read += nread;
     remaining = luringcb->qiov->size - luringcb->total_read;
 
+    if (luringcb->sqeq.opcode == IORING_OP_READ_FIXED) {
+        /* The buffer is contiguous, just move past what was read */
+        luringcb->sqeq.off += nread;
+        luringcb->sqeq.addr += nread;
+        luringcb->sqeq.len = remaining;
+        luring_resubmit(s, luringcb);
+        return;
+    }
+
     /* Shorten qiov */
     resubmit_qiov = &luringcb->resubmit_qiov;
     if (resubmit_qiov->iov == NULL) {
@@ -330,18 +775,33 @@ static void luring_deferred_fn(void *opaque)
  * @s: AIO state
  * @offset: offset for request
  * @type: type of request
+ * @fixed_bufs: whether to use the fixed buffers that hold the request
+ * @fixed_file: whether to go through the fixed file table
  *
  * Fetches sqes from ring, adds to pending queue and preps them
  *
  */
 static int luring_do_submit(int fd, LuringAIOCB *luringcb, LuringState *s,
-                            uint64_t offset, int type)
+                            uint64_t offset, int type, bool fixed_bufs,
+                            bool fixed_file)
 {
     int ret;
     struct io_uring_sqe *sqes = &luringcb->sqeq;
+    QEMUIOVector *qiov = luringcb->qiov;
+    int buf_index = -1;
+    int file_index = fixed_file ? luring_fixed_file(s, fd) : -1;
+
+    if (fixed_bufs && (type == QEMU_AIO_READ || type == QEMU_AIO_WRITE)) {
+        buf_index = luring_fixed_buf(s, qiov);
+    }
 
     switch (type) {
     case QEMU_AIO_WRITE:
+        if (buf_index >= 0) {
+            io_uring_prep_write_fixed(sqes, fd, qiov->iov[0].iov_base,
+                                      qiov->size, offset, buf_index);
+            break;
+        }
         io_uring_prep_writev(sqes, fd, luringcb->qiov->iov,
                              luringcb->qiov->niov, offset);
         break;
@@ -350,6 +810,11 @@ static int luring_do_submit(int fd, LuringAIOCB *luringcb, LuringState *s,
                              luringcb->qiov->niov, offset);
         break;
     case QEMU_AIO_READ:
+        if (buf_index >= 0) {
+            io_uring_prep_read_fixed(sqes, fd, qiov->iov[0].iov_base,
+                                     qiov->size, offset, buf_index);
+            break;
+        }
         io_uring_prep_readv(sqes, fd, luringcb->qiov->iov,
                             luringcb->qiov->niov, offset);
         break;
@@ -361,6 +826,10 @@ static int luring_do_submit(int fd, LuringAIOCB *luringcb, LuringState *s,
                         __func__, type);
         abort();
     }
+    if (file_index >= 0) {
+        sqes->fd = file_index;
+        sqes->flags |= IOSQE_FIXED_FILE;
+    }
     io_uring_sqe_set_data(sqes, luringcb);
 
     QSIMPLEQ_INSERT_TAIL(&s->io_q.submit_queue, luringcb, next);
@@ -380,7 +849,8 @@ static int luring_do_submit(int fd, LuringAIOCB *luringcb, LuringState *s,
 }
 
 int coroutine_fn luring_co_submit(BlockDriverState *bs, int fd, uint64_t offset,
-                                  QEMUIOVector *qiov, int type)
+                                  QEMUIOVector *qiov, int type,
+                                  bool fixed_bufs, bool fixed_file)
 {
     int ret;
     AioContext *ctx = qemu_get_current_aio_context();
@@ -393,7 +863,8 @@ int coroutine_fn luring_co_submit(BlockDriverState *bs, int fd, uint64_t offset,
     };
     trace_luring_co_submit(bs, s, &luringcb, fd, offset, qiov ? qiov->size : 0,
                            type);
-    ret = luring_do_submit(fd, &luringcb, s, offset, type);
+    ret = luring_do_submit(fd, &luringcb, s, offset, type, fixed_bufs,
+                           fixed_file);
 
     if (ret < 0) {
         return ret;
@@ -422,7 +893,37 @@ void luring_attach_aio_context(LuringState *s, AioContext *new_context)
                        qemu_luring_poll_cb, qemu_luring_poll_ready, s);
 }
 
-LuringState *luring_init(Error **errp)
+/*
+ * With a non-zero @sqpoll_idle, a kernel thread polls the submission queue
+ * and goes to sleep after @sqpoll_idle milliseconds without requests.
+ */
+static int luring_queue_init(struct io_uring *ring, int64_t sqpoll_idle)
+{
+#ifdef HAVE_IO_URING_REGISTER_SPARSE
+    if (sqpoll_idle) {
+        struct io_uring_params params = {
+            .flags = IORING_SETUP_SQPOLL,
+            .sq_thread_idle = MIN(sqpoll_idle, UINT32_MAX),
+        };
+        int rc = io_uring_queue_init_params(MAX_ENTRIES, ring, &params);
+
+        if (rc == 0) {
+            return 0;
+        }
+        warn_report_once("io_uring SQPOLL is not available: %s, "
+                         "submitting requests with system calls",
+                         strerror(-rc));
+    }
+#else
+    if (sqpoll_idle) {
+        warn_report_once("io_uring SQPOLL is not supported by this build");
+    }
+#endif
+
+    return io_uring_queue_init(MAX_ENTRIES, ring, 0);
+}
+
+LuringState *luring_init(int64_t sqpoll_idle, Error **errp)
 {
     int rc;
     LuringState *s = g_new0(LuringState, 1);
@@ -430,7 +931,7 @@ LuringState *luring_init(Error **errp)
 
     trace_luring_init_state(s, sizeof(*s));
 
-    rc = io_uring_queue_init(MAX_ENTRIES, ring, 0);
+    rc = luring_queue_init(ring, sqpoll_idle);
     if (rc < 0) {
         error_setg_errno(errp, -rc, "failed to init linux io_uring ring");
         g_free(s);
@@ -438,12 +939,14 @@ LuringState *luring_init(Error **errp)
     }
 
     ioq_init(&s->io_q);
+    luring_fixed_add_ring(s);
     return s;
 
 }
 
 void luring_cleanup(LuringState *s)
 {
+    luring_fixed_del_ring(s);
     io_uring_queue_exit(&s->ring);
     trace_luring_cleanup_state(s);
     g_free(s);
@@ -74,6 +74,9 @@ typedef struct {
 #define  QCOW2_EXT_MAGIC_BITMAPS 0x23852875
 #define  QCOW2_EXT_MAGIC_DATA_FILE 0x44415441
 
+static void qcow2_decompress_cache_init(BlockDriverState *bs);
+static void qcow2_decompress_cache_cleanup(BlockDriverState *bs);
+
 static int coroutine_fn
 qcow2_co_preadv_compressed(BlockDriverState *bs,
                            uint64_t l2_entry,
@@ -1888,6 +1891,8 @@ qcow2_do_open(BlockDriverState *bs, QDict *options, int flags,
 #endif
 
     qemu_co_queue_init(&s->thread_task_queue);
+    s->max_threads = MAX(QCOW2_MIN_THREADS, g_get_num_processors());
+    qcow2_decompress_cache_init(bs);
 
     return ret;
 
@@ -2806,6 +2811,7 @@ qcow2_do_close(BlockDriverState *bs, bool close_data_file)
     cache_clean_timer_del(bs);
     qcow2_cache_destroy(s->l2_table_cache);
     qcow2_cache_destroy(s->refcount_block_cache);
+    qcow2_decompress_cache_cleanup(bs);
 
     qcrypto_block_free(s->crypto);
     s->crypto = NULL;
@@ -4671,6 +4677,113 @@ fail:
     return ret;
 }
 
+static void qcow2_decompress_cache_init(BlockDriverState *bs)
+{
+    BDRVQcow2State *s = bs->opaque;
+
+    s->decompress_cache_size =
+        MAX(1, MIN(QCOW2_DECOMPRESS_CACHE_MAX,
+                   QCOW2_DECOMPRESS_CACHE_BYTES / s->cluster_size));
+    s->decompress_cache = g_new0(Qcow2DecompressedCluster,
+                                 s->decompress_cache_size);
+    qemu_mutex_init(&s->decompress_cache_lock);
+}
+
+static void qcow2_decompress_cache_cleanup(BlockDriverState *bs)
+{
+    BDRVQcow2State *s = bs->opaque;
+    int i;
+
+    if (!s->decompress_cache) {
+        return;
+    }
+
+    for (i = 0; i < s->decompress_cache_size; i++) {
+        g_free(s->decompress_cache[i].data);
+    }
+    g_free(s->decompress_cache);
+    s->decompress_cache = NULL;
+    qemu_mutex_destroy(&s->decompress_cache_lock);
+}
+
+static void qcow2_decompress_cache_invalidate(BlockDriverState *bs)
+{
+    BDRVQcow2State *s = bs->opaque;
+    int i;
+
+    QEMU_LOCK_GUARD(&s->decompress_cache_lock);
+    s->decompress_cache_gen++;
+    for (i = 0; i < s->decompress_cache_size; i++) {
+        s->decompress_cache[i].csize = 0;
+        s->decompress_cache[i].lru_counter = 0;
+    }
+}
+
+/*
+ * Copy @bytes at @offset_in_cluster of the cluster compressed at @coffset
+ * into @qiov, if it is cached.  Return whether it was.
+ */
+static bool qcow2_decompress_cache_read(BlockDriverState *bs,
+                                        uint64_t coffset, int csize,
+                                        int offset_in_cluster, uint64_t bytes,
+                                        QEMUIOVector *qiov, size_t qiov_offset)
+{
+    BDRVQcow2State *s = bs->opaque;
+    int i;
+
+    QEMU_LOCK_GUARD(&s->decompress_cache_lock);
+    for (i = 0; i < s->decompress_cache_size; i++) {
+        Qcow2DecompressedCluster *c = &s->decompress_cache[i];
+
+        if (c->csize == csize && c->coffset == coffset) {
+            c->lru_counter = ++s->decompress_cache_lru_counter;
+            qemu_iovec_from_buf(qiov, qiov_offset,
+                                c->data + offset_in_cluster, bytes);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/*
+ * Keep the decompressed cluster @data, unless compressed data was written
+ * since @gen was read from s->decompress_cache_gen.
+ */
+static void qcow2_decompress_cache_add(BlockDriverState *bs, uint64_t gen,
+                                       uint64_t coffset, int csize,
+                                       const uint8_t *data)
+{
+    BDRVQcow2State *s = bs->opaque;
+    Qcow2DecompressedCluster *victim = NULL;
+    int i;
+
+    QEMU_LOCK_GUARD(&s->decompress_cache_lock);
+    if (gen != s->decompress_cache_gen) {
+        return;
+    }
+
+    for (i = 0; i < s->decompress_cache_size; i++) {
+        Qcow2DecompressedCluster *c = &s->decompress_cache[i];
+
+        if (c->csize == csize && c->coffset == coffset) {
+            /* Another request got here first */
+            return;
+        }
+        if (!victim || c->lru_counter < victim->lru_counter) {
+            victim = c;
+        }
+    }
+
+    if (!victim->data) {
+        victim->data = g_malloc(s->cluster_size);
+    }
+    memcpy(victim->data, data, s->cluster_size);
+    victim->coffset = coffset;
+    victim->csize = csize;
+    victim->lru_counter = ++s->decompress_cache_lru_counter;
+}
+
 static int coroutine_fn GRAPH_RDLOCK
 qcow2_co_pwritev_compressed_task(BlockDriverState *bs,
                                  uint64_t offset, uint64_t bytes,
@@ -4724,6 +4837,8 @@ qcow2_co_pwritev_compressed_task(BlockDriverState *bs,
 
     BLKDBG_CO_EVENT(s->data_file, BLKDBG_WRITE_COMPRESSED);
     ret = bdrv_co_pwrite(s->data_file, cluster_offset, out_len, out_buf, 0);
+    /* The space may have held other compressed data, even if this failed */
+    qcow2_decompress_cache_invalidate(bs);
     if (ret < 0) {
         goto fail;
     }
@@ -4828,12 +4943,24 @@ qcow2_co_preadv_compressed(BlockDriverState *bs,
 {
     BDRVQcow2State *s = bs->opaque;
     int ret = 0, csize;
-    uint64_t coffset;
+    uint64_t coffset, gen;
     uint8_t *buf, *out_buf;
     int offset_in_cluster = offset_into_cluster(s, offset);
 
     qcow2_parse_compressed_l2_entry(bs, l2_entry, &coffset, &csize);
 
+    /*
+     * Reads smaller than a cluster, such as the sequential reads of a
+     * booting guest, would otherwise decompress each cluster many times.
+     */
+    if (qcow2_decompress_cache_read(bs, coffset, csize, offset_in_cluster,
+                                    bytes, qiov, qiov_offset)) {
+        return 0;
+    }
+    qemu_mutex_lock(&s->decompress_cache_lock);
+    gen = s->decompress_cache_gen;
+    qemu_mutex_unlock(&s->decompress_cache_lock);
+
     buf = g_try_malloc(csize);
     if (!buf) {
         return -ENOMEM;
@@ -4852,6 +4979,9 @@ qcow2_co_preadv_compressed(BlockDriverState *bs,
         goto fail;
     }
 
+    if (bytes < s->cluster_size) {
+        qcow2_decompress_cache_add(bs, gen, coffset, csize, out_buf);
+    }
     qemu_iovec_from_buf(qiov, qiov_offset, out_buf + offset_in_cluster, bytes);
 
 fail:
@@ -5244,6 +5374,7 @@ qcow2_co_get_info(BlockDriverState *bs, BlockDriverInfo *bdi)
     bdi->subcluster_size = s->subcluster_size;
     bdi->vm_state_offset = qcow2_vm_state_offset(s);
     bdi->is_dirty = s->incompatible_features & QCOW2_INCOMPAT_DIRTY;
+    bdi->multi_cluster_compressed_writes = true;
     return 0;
 }
 
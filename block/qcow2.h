@@ -71,6 +71,10 @@
 /* Maximum of parallel sub-request per guest request */
 #define QCOW2_MAX_WORKERS 8
 
+/* Memory for clusters kept after decompression, and maximum cluster count */
+#define QCOW2_DECOMPRESS_CACHE_BYTES (2 * MiB)
+#define QCOW2_DECOMPRESS_CACHE_MAX 16
+
 /* indicate that the refcount of the referenced cluster is exactly one. */
 #define QCOW_OFLAG_COPIED     (1ULL << 63)
 /* indicate that the cluster is compressed (they never have the copied flag) */
@@ -322,7 +326,19 @@ typedef struct Qcow2BitmapHeaderExt {
     uint64_t bitmap_directory_offset;
 } QEMU_PACKED Qcow2BitmapHeaderExt;
 
-#define QCOW2_MAX_THREADS 4
+/*
+ * Threads used at once for compression and encryption: one per host CPU,
+ * but at least QCOW2_MIN_THREADS
+ */
+#define QCOW2_MIN_THREADS 4
+
+typedef struct Qcow2DecompressedCluster {
+    /* compressed data that was decompressed, csize == 0 if unused */
+    uint64_t coffset;
+    int csize;
+    uint64_t lru_counter;
+    uint8_t *data;
+} Qcow2DecompressedCluster;
 
 typedef struct BDRVQcow2State {
     int cluster_bits;
@@ -410,6 +426,20 @@ typedef struct BDRVQcow2State {
 
     CoQueue thread_task_queue;
     int nb_threads;
+    int max_threads;
+
+    /*
+     * Clusters that were decompressed recently, so that reads of the other
+     * parts of the same cluster do not decompress it again.  A
+     * decompressed cluster is only added if decompress_cache_gen did not
+     * change while it was read; it changes whenever compressed data is
+     * written.
+     */
+    QemuMutex decompress_cache_lock;
+    Qcow2DecompressedCluster *decompress_cache;
+    int decompress_cache_size;
+    uint64_t decompress_cache_lru_counter;
+    uint64_t decompress_cache_gen;
 
     BdrvChild *data_file;
 
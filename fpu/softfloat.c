@@ -84,6 +84,7 @@ this code that are retained.
  */
 #include "qemu/osdep.h"
 #include <math.h>
+#include <float.h>
 #include "qemu/bitops.h"
 #include "fpu/softfloat.h"
 
@@ -217,8 +218,9 @@ GEN_INPUT_FLUSH3(float64_input_flush3, float64)
 
 /*
  * Some targets clear the FP flags before most FP operations. This prevents
- * the use of hardfloat, since hardfloat relies on the inexact flag being
- * already set.
+ * the use of the plain hardfloat path, since it relies on the inexact flag
+ * being already set; those targets go through the error-free transform
+ * path below instead.
  */
 #if defined(TARGET_PPC) || defined(__FAST_MATH__)
 # if defined(__FAST_MATH__)
@@ -226,9 +228,23 @@ GEN_INPUT_FLUSH3(float64_input_flush3, float64)
     IEEE implementation
 # endif
 # define QEMU_NO_HARDFLOAT 1
-# define QEMU_SOFTFLOAT_ATTR QEMU_FLATTEN
 #else
 # define QEMU_NO_HARDFLOAT 0
+#endif
+
+/*
+ * The error-free transforms rely on every host operation being rounded
+ * exactly once to the precision of its type.
+ */
+#if defined(__FAST_MATH__) || !defined(FLT_EVAL_METHOD) || FLT_EVAL_METHOD != 0
+# define QEMU_NO_HARDFLOAT_EFT 1
+#else
+# define QEMU_NO_HARDFLOAT_EFT 0
+#endif
+
+#if QEMU_NO_HARDFLOAT && QEMU_NO_HARDFLOAT_EFT
+# define QEMU_SOFTFLOAT_ATTR QEMU_FLATTEN
+#else
 # define QEMU_SOFTFLOAT_ATTR QEMU_FLATTEN __attribute__((noinline))
 #endif
 
@@ -241,6 +257,23 @@ static inline bool can_use_fpu(const float_status *s)
                   s->float_rounding_mode == float_round_nearest_even);
 }
 
+/*
+ * When the inexact flag is clear we may still use the host result, as long
+ * as the caller determines whether it is exact with an error-free transform
+ * and raises inexact itself. This only works when rounding to nearest-even,
+ * which is the host's rounding mode.
+ */
+static inline bool can_use_fpu_eft(const float_status *s)
+{
+    if (QEMU_NO_HARDFLOAT_EFT) {
+        return false;
+    }
+    return likely(s->float_rounding_mode == float_round_nearest_even);
+}
+
+/* Set by softfloat_init() when the host fma() cannot be trusted. */
+static bool force_soft_fma;
+
 /*
  * Hardfloat generation functions. Each operation can have two flavors:
  * either using softfloat primitives (e.g. float32_is_zero_or_normal) for
@@ -266,6 +299,15 @@ typedef union {
 typedef bool (*f32_check_fn)(union_float32 a, union_float32 b);
 typedef bool (*f64_check_fn)(union_float64 a, union_float64 b);
 
+/*
+ * Error-free transform checks. Given the normal, nearest-even result @r of
+ * a hardfloat operation on @a and @b, return 0 if @r is exact, 1 if it is
+ * inexact, or -1 if that cannot be determined cheaply, in which case the
+ * caller falls back to softfloat.
+ */
+typedef int (*f32_eft_fn)(union_float32 a, union_float32 b, union_float32 r);
+typedef int (*f64_eft_fn)(union_float64 a, union_float64 b, union_float64 r);
+
 typedef float32 (*soft_f32_op2_fn)(float32 a, float32 b, float_status *s);
 typedef float64 (*soft_f64_op2_fn)(float64 a, float64 b, float_status *s);
 typedef float   (*hard_f32_op2_fn)(float a, float b);
@@ -342,15 +384,19 @@ static inline bool f64_is_inf(union_float64 a)
 static inline float32
 float32_gen2(float32 xa, float32 xb, float_status *s,
              hard_f32_op2_fn hard, soft_f32_op2_fn soft,
-             f32_check_fn pre, f32_check_fn post)
+             f32_check_fn pre, f32_check_fn post, f32_eft_fn eft)
 {
     union_float32 ua, ub, ur;
+    bool need_eft = false;
 
     ua.s = xa;
     ub.s = xb;
 
     if (unlikely(!can_use_fpu(s))) {
-        goto soft;
+        if (!can_use_fpu_eft(s)) {
+            goto soft;
+        }
+        need_eft = true;
     }
 
     float32_input_flush2(&ua.s, &ub.s, s);
@@ -360,9 +406,20 @@ float32_gen2(float32 xa, float32 xb, float_status *s,
 
     ur.h = hard(ua.h, ub.h);
     if (unlikely(f32_is_inf(ur))) {
-        float_raise(float_flag_overflow, s);
-    } else if (unlikely(fabsf(ur.h) <= FLT_MIN) && post(ua, ub)) {
-        goto soft;
+        float_raise(float_flag_overflow | float_flag_inexact, s);
+    } else if (unlikely(fabsf(ur.h) <= FLT_MIN)) {
+        if (post(ua, ub)) {
+            goto soft;
+        }
+    } else if (need_eft) {
+        int inexact = eft(ua, ub, ur);
+
+        if (unlikely(inexact < 0)) {
+            goto soft;
+        }
+        if (inexact) {
+            float_raise(float_flag_inexact, s);
+        }
     }
     return ur.s;
 
@@ -373,15 +430,19 @@ float32_gen2(float32 xa, float32 xb, float_status *s,
 static inline float64
 float64_gen2(float64 xa, float64 xb, float_status *s,
              hard_f64_op2_fn hard, soft_f64_op2_fn soft,
-             f64_check_fn pre, f64_check_fn post)
+             f64_check_fn pre, f64_check_fn post, f64_eft_fn eft)
 {
     union_float64 ua, ub, ur;
+    bool need_eft = false;
 
     ua.s = xa;
     ub.s = xb;
 
     if (unlikely(!can_use_fpu(s))) {
-        goto soft;
+        if (!can_use_fpu_eft(s)) {
+            goto soft;
+        }
+        need_eft = true;
     }
 
     float64_input_flush2(&ua.s, &ub.s, s);
@@ -391,9 +452,20 @@ float64_gen2(float64 xa, float64 xb, float_status *s,
 
     ur.h = hard(ua.h, ub.h);
     if (unlikely(f64_is_inf(ur))) {
-        float_raise(float_flag_overflow, s);
-    } else if (unlikely(fabs(ur.h) <= DBL_MIN) && post(ua, ub)) {
-        goto soft;
+        float_raise(float_flag_overflow | float_flag_inexact, s);
+    } else if (unlikely(fabs(ur.h) <= DBL_MIN)) {
+        if (post(ua, ub)) {
+            goto soft;
+        }
+    } else if (need_eft) {
+        int inexact = eft(ua, ub, ur);
+
+        if (unlikely(inexact < 0)) {
+            goto soft;
+        }
+        if (inexact) {
+            float_raise(float_flag_inexact, s);
+        }
     }
     return ur.s;
 
@@ -1951,6 +2023,46 @@ static double hard_f64_sub(double a, double b)
     return a - b;
 }
 
+/*
+ * TwoSum (Knuth): with r = a + b rounded, a + b == r + err exactly.
+ * The error is always representable; it can only be non-finite if an
+ * intermediate step overflowed, which may happen when r is close to the
+ * largest finite number.
+ */
+static int f32_add_eft(union_float32 a, union_float32 b, union_float32 r)
+{
+    float bv = r.h - a.h;
+    float err = (a.h - (r.h - bv)) + (b.h - bv);
+
+    if (likely(err == 0)) {
+        return 0;
+    }
+    return isfinite(err) ? 1 : -1;
+}
+
+static int f32_sub_eft(union_float32 a, union_float32 b, union_float32 r)
+{
+    b.h = -b.h;
+    return f32_add_eft(a, b, r);
+}
+
+static int f64_add_eft(union_float64 a, union_float64 b, union_float64 r)
+{
+    double bv = r.h - a.h;
+    double err = (a.h - (r.h - bv)) + (b.h - bv);
+
+    if (likely(err == 0)) {
+        return 0;
+    }
+    return isfinite(err) ? 1 : -1;
+}
+
+static int f64_sub_eft(union_float64 a, union_float64 b, union_float64 r)
+{
+    b.h = -b.h;
+    return f64_add_eft(a, b, r);
+}
+
 static bool f32_addsubmul_post(union_float32 a, union_float32 b)
 {
     if (QEMU_HARDFLOAT_2F32_USE_FP) {
@@ -1969,41 +2081,43 @@ static bool f64_addsubmul_post(union_float64 a, union_float64 b)
 }
 
 static float32 float32_addsub(float32 a, float32 b, float_status *s,
-                              hard_f32_op2_fn hard, soft_f32_op2_fn soft)
+                              hard_f32_op2_fn hard, soft_f32_op2_fn soft,
+                              f32_eft_fn eft)
 {
     return float32_gen2(a, b, s, hard, soft,
-                        f32_is_zon2, f32_addsubmul_post);
+                        f32_is_zon2, f32_addsubmul_post, eft);
 }
 
 static float64 float64_addsub(float64 a, float64 b, float_status *s,
-                              hard_f64_op2_fn hard, soft_f64_op2_fn soft)
+                              hard_f64_op2_fn hard, soft_f64_op2_fn soft,
+                              f64_eft_fn eft)
 {
     return float64_gen2(a, b, s, hard, soft,
-                        f64_is_zon2, f64_addsubmul_post);
+                        f64_is_zon2, f64_addsubmul_post, eft);
 }
 
 float32 QEMU_FLATTEN
 float32_add(float32 a, float32 b, float_status *s)
 {
-    return float32_addsub(a, b, s, hard_f32_add, soft_f32_add);
+    return float32_addsub(a, b, s, hard_f32_add, soft_f32_add, f32_add_eft);
 }
 
 float32 QEMU_FLATTEN
 float32_sub(float32 a, float32 b, float_status *s)
 {
-    return float32_addsub(a, b, s, hard_f32_sub, soft_f32_sub);
+    return float32_addsub(a, b, s, hard_f32_sub, soft_f32_sub, f32_sub_eft);
 }
 
 float64 QEMU_FLATTEN
 float64_add(float64 a, float64 b, float_status *s)
 {
-    return float64_addsub(a, b, s, hard_f64_add, soft_f64_add);
+    return float64_addsub(a, b, s, hard_f64_add, soft_f64_add, f64_add_eft);
 }
 
 float64 QEMU_FLATTEN
 float64_sub(float64 a, float64 b, float_status *s)
 {
-    return float64_addsub(a, b, s, hard_f64_sub, soft_f64_sub);
+    return float64_addsub(a, b, s, hard_f64_sub, soft_f64_sub, f64_sub_eft);
 }
 
 static float64 float64r32_addsub(float64 a, float64 b, float_status *status,
@@ -2145,18 +2259,37 @@ static double hard_f64_mul(double a, double b)
     return a * b;
 }
 
+/* The product of two float32 values is exact in double precision. */
+static int f32_mul_eft(union_float32 a, union_float32 b, union_float32 r)
+{
+    return (double)a.h * (double)b.h != (double)r.h;
+}
+
+/*
+ * fma() computes a * b - r with a single rounding. A non-zero residual
+ * can only round to zero when it underflows, which cannot happen unless
+ * r is within 2**53 of the smallest normal.
+ */
+static int f64_mul_eft(union_float64 a, union_float64 b, union_float64 r)
+{
+    if (unlikely(force_soft_fma || fabs(r.h) < 0x1p-968)) {
+        return -1;
+    }
+    return fma(a.h, b.h, -r.h) != 0;
+}
+
 float32 QEMU_FLATTEN
 float32_mul(float32 a, float32 b, float_status *s)
 {
     return float32_gen2(a, b, s, hard_f32_mul, soft_f32_mul,
-                        f32_is_zon2, f32_addsubmul_post);
+                        f32_is_zon2, f32_addsubmul_post, f32_mul_eft);
 }
 
 float64 QEMU_FLATTEN
 float64_mul(float64 a, float64 b, float_status *s)
 {
     return float64_gen2(a, b, s, hard_f64_mul, soft_f64_mul,
-                        f64_is_zon2, f64_addsubmul_post);
+                        f64_is_zon2, f64_addsubmul_post, f64_mul_eft);
 }
 
 float64 float64r32_mul(float64 a, float64 b, float_status *status)
@@ -2253,19 +2386,37 @@ soft_f64_muladd(float64 a, float64 b, float64 c, int flags,
     return float64_round_pack_canonical(pr, status);
 }
 
-static bool force_soft_fma;
+/*
+ * The product of two float32 values is exact in double precision, and
+ * TwoSum then yields the exact a * b + c as the unevaluated sum p + err.
+ * Operands are float32 normals, so none of this can overflow or underflow.
+ */
+static bool f32_muladd_inexact(union_float32 a, union_float32 b,
+                               union_float32 c, union_float32 r)
+{
+    double p = (double)a.h * (double)b.h;
+    double sum = p + (double)c.h;
+    double bv = sum - p;
+    double err = (p - (sum - bv)) + ((double)c.h - bv);
+
+    return err != 0 || sum != (double)r.h;
+}
 
 float32 QEMU_FLATTEN
 float32_muladd(float32 xa, float32 xb, float32 xc, int flags, float_status *s)
 {
     union_float32 ua, ub, uc, ur;
+    bool need_eft = false;
 
     ua.s = xa;
     ub.s = xb;
     uc.s = xc;
 
     if (unlikely(!can_use_fpu(s))) {
-        goto soft;
+        if (!can_use_fpu_eft(s)) {
+            goto soft;
+        }
+        need_eft = true;
     }
     if (unlikely(flags & float_muladd_halve_result)) {
         goto soft;
@@ -2310,11 +2461,13 @@ float32_muladd(float32 xa, float32 xb, float32 xc, int flags, float_status *s)
         ur.h = fmaf(ua.h, ub.h, uc.h);
 
         if (unlikely(f32_is_inf(ur))) {
-            float_raise(float_flag_overflow, s);
+            float_raise(float_flag_overflow | float_flag_inexact, s);
         } else if (unlikely(fabsf(ur.h) <= FLT_MIN)) {
             ua = ua_orig;
             uc = uc_orig;
             goto soft;
+        } else if (need_eft && f32_muladd_inexact(ua, ub, uc, ur)) {
+            float_raise(float_flag_inexact, s);
         }
     }
     if (flags & float_muladd_negate_result) {
@@ -2519,18 +2672,33 @@ static bool f64_div_post(union_float64 a, union_float64 b)
     return !float64_is_zero(a.s);
 }
 
+/* r is exact iff r * b == a; that product is exact in double precision. */
+static int f32_div_eft(union_float32 a, union_float32 b, union_float32 r)
+{
+    return (double)r.h * (double)b.h != (double)a.h;
+}
+
+/* As for f64_mul_eft, the residual a - r * b cannot vanish by underflow. */
+static int f64_div_eft(union_float64 a, union_float64 b, union_float64 r)
+{
+    if (unlikely(force_soft_fma || fabs(a.h) < 0x1p-968)) {
+        return -1;
+    }
+    return fma(r.h, b.h, -a.h) != 0;
+}
+
 float32 QEMU_FLATTEN
 float32_div(float32 a, float32 b, float_status *s)
 {
     return float32_gen2(a, b, s, hard_f32_div, soft_f32_div,
-                        f32_div_pre, f32_div_post);
+                        f32_div_pre, f32_div_post, f32_div_eft);
 }
 
 float64 QEMU_FLATTEN
 float64_div(float64 a, float64 b, float_status *s)
 {
     return float64_gen2(a, b, s, hard_f64_div, soft_f64_div,
-                        f64_div_pre, f64_div_post);
+                        f64_div_pre, f64_div_post, f64_div_eft);
 }
 
 float64 float64r32_div(float64 a, float64 b, float_status *status)
@@ -3880,8 +4048,15 @@ float32 int64_to_float32_scalbn(int64_t a, int scale, float_status *status)
 {
     FloatParts64 p;
 
-    /* Without scaling, there are no overflow concerns. */
-    if (likely(scale == 0) && can_use_fpu(status)) {
+    /*
+     * Without scaling, there are no overflow concerns. Integers that fit
+     * in the fraction convert exactly, raising no flags in any rounding
+     * mode, so they do not need the inexact flag to be set.
+     */
+    if (likely(scale == 0) &&
+        (can_use_fpu(status) ||
+         (!QEMU_NO_HARDFLOAT_EFT &&
+          a >= -(INT64_C(1) << 24) && a <= (INT64_C(1) << 24)))) {
         union_float32 ur;
         ur.h = a;
         return ur.s;
@@ -3920,8 +4095,11 @@ float64 int64_to_float64_scalbn(int64_t a, int scale, float_status *status)
 {
     FloatParts64 p;
 
-    /* Without scaling, there are no overflow concerns. */
-    if (likely(scale == 0) && can_use_fpu(status)) {
+    /* Without scaling, there are no overflow concerns; see int64_to_float32. */
+    if (likely(scale == 0) &&
+        (can_use_fpu(status) ||
+         (!QEMU_NO_HARDFLOAT_EFT &&
+          a >= -(INT64_C(1) << 53) && a <= (INT64_C(1) << 53)))) {
         union_float64 ur;
         ur.h = a;
         return ur.s;
@@ -4100,8 +4278,10 @@ float32 uint64_to_float32_scalbn(uint64_t a, int scale, float_status *status)
 {
     FloatParts64 p;
 
-    /* Without scaling, there are no overflow concerns. */
-    if (likely(scale == 0) && can_use_fpu(status)) {
+    /* Without scaling, there are no overflow concerns; see int64_to_float32. */
+    if (likely(scale == 0) &&
+        (can_use_fpu(status) ||
+         (!QEMU_NO_HARDFLOAT_EFT && a <= (UINT64_C(1) << 24)))) {
         union_float32 ur;
         ur.h = a;
         return ur.s;
@@ -4140,8 +4320,10 @@ float64 uint64_to_float64_scalbn(uint64_t a, int scale, float_status *status)
 {
     FloatParts64 p;
 
-    /* Without scaling, there are no overflow concerns. */
-    if (likely(scale == 0) && can_use_fpu(status)) {
+    /* Without scaling, there are no overflow concerns; see int64_to_float32. */
+    if (likely(scale == 0) &&
+        (can_use_fpu(status) ||
+         (!QEMU_NO_HARDFLOAT_EFT && a <= (UINT64_C(1) << 53)))) {
         union_float64 ur;
         ur.h = a;
         return ur.s;
@@ -4618,10 +4800,14 @@ soft_f64_sqrt(float64 a, float_status *status)
 float32 QEMU_FLATTEN float32_sqrt(float32 xa, float_status *s)
 {
     union_float32 ua, ur;
+    bool need_eft = false;
 
     ua.s = xa;
     if (unlikely(!can_use_fpu(s))) {
-        goto soft;
+        if (!can_use_fpu_eft(s)) {
+            goto soft;
+        }
+        need_eft = true;
     }
 
     float32_input_flush1(&ua.s, s);
@@ -4636,6 +4822,10 @@ float32 QEMU_FLATTEN float32_sqrt(float32 xa, float_status *s)
         goto soft;
     }
     ur.h = sqrtf(ua.h);
+    /* The square of a float32 is exact in double precision. */
+    if (need_eft && (double)ur.h * (double)ur.h != (double)ua.h) {
+        float_raise(float_flag_inexact, s);
+    }
     return ur.s;
 
  soft:
@@ -4645,10 +4835,14 @@ float32 QEMU_FLATTEN float32_sqrt(float32 xa, float_status *s)
 float64 QEMU_FLATTEN float64_sqrt(float64 xa, float_status *s)
 {
     union_float64 ua, ur;
+    bool need_eft = false;
 
     ua.s = xa;
     if (unlikely(!can_use_fpu(s))) {
-        goto soft;
+        if (!can_use_fpu_eft(s)) {
+            goto soft;
+        }
+        need_eft = true;
     }
 
     float64_input_flush1(&ua.s, s);
@@ -4662,7 +4856,18 @@ float64 QEMU_FLATTEN float64_sqrt(float64 xa, float_status *s)
                         float64_is_neg(ua.s))) {
         goto soft;
     }
+    if (need_eft &&
+        unlikely(force_soft_fma || (ua.h != 0 && ua.h < 0x1p-968))) {
+        /*
+         * The residual below needs a trustworthy fma(), and could
+         * underflow to zero; see f64_mul_eft.
+         */
+        goto soft;
+    }
     ur.h = sqrt(ua.h);
+    if (need_eft && fma(ur.h, ur.h, -ua.h) != 0) {
+        float_raise(float_flag_inexact, s);
+    }
     return ur.s;
 
  soft:
@@ -5260,7 +5465,7 @@ static void __attribute__((constructor)) softfloat_init(void)
 {
     union_float64 ua, ub, uc, ur;
 
-    if (QEMU_NO_HARDFLOAT) {
+    if (QEMU_NO_HARDFLOAT && QEMU_NO_HARDFLOAT_EFT) {
         return;
     }
     /*
@@ -1759,11 +1759,12 @@ ERST
 
     {
         .name       = "calc_dirty_rate",
-        .args_type  = "dirty_ring:-r,dirty_bitmap:-b,second:l,sample_pages_per_GB:l?",
-        .params     = "[-r] [-b] second [sample_pages_per_GB]",
+        .args_type  = "dirty_ring:-r,dirty_bitmap:-b,continuous:-c,second:l,sample_pages_per_GB:l?",
+        .params     = "[-r] [-b] [-c] second [sample_pages_per_GB]",
         .help       = "start a round of guest dirty rate measurement (using -r to"
                       "\n\t\t\t specify dirty ring as the method of calculation and"
-                      "\n\t\t\t -b to specify dirty bitmap as method of calculation)",
+                      "\n\t\t\t -b to specify dirty bitmap as method of calculation,"
+                      "\n\t\t\t -c to keep sampling pages every period)",
         .cmd        = hmp_calc_dirty_rate,
     },
 
@@ -1771,7 +1772,8 @@ SRST
 ``calc_dirty_rate`` *second*
   Start a round of dirty rate measurement with the period specified in *second*.
   The result of the dirty rate measurement may be observed with ``info
-  dirty_rate`` command.
+  dirty_rate`` command.  With ``-c``, pages are sampled every period until the
+  next ``calc_dirty_rate`` and ``info dirty_rate`` shows a rolling estimate.
 ERST
 
     {
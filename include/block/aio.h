@@ -235,6 +235,7 @@ struct AioContext {
 
     /* AIO engine parameters */
     int64_t aio_max_batch;  /* maximum number of requests in a batch */
+    int64_t io_uring_sqpoll_idle; /* SQPOLL idle time in ms, 0 = no SQPOLL */
 
     /*
      * List of handlers participating in userspace polling.  Protected by
@@ -709,8 +710,13 @@ void aio_context_set_poll_params(AioContext *ctx, int64_t max_ns,
  * @ctx: the aio context
  * @max_batch: maximum number of requests in a batch, 0 means that the
  *             engine will use its default
+ * @io_uring_sqpoll_idle: idle time in milliseconds of the kernel thread
+ *                        polling the io_uring submission queue, 0 means
+ *                        that io_uring does not use such a thread.  Only
+ *                        applies when the io_uring ring is created.
  */
-void aio_context_set_aio_params(AioContext *ctx, int64_t max_batch);
+void aio_context_set_aio_params(AioContext *ctx, int64_t max_batch,
+                                int64_t io_uring_sqpoll_idle);
 
 /**
  * aio_context_set_thread_pool_params:
@@ -148,6 +148,11 @@ typedef struct BlockDriverInfo {
      * True if this block driver only supports compressed writes
      */
     bool needs_compressed_writes;
+    /*
+     * True if a compressed write may cover several clusters, instead of
+     * exactly one
+     */
+    bool multi_cluster_compressed_writes;
 } BlockDriverInfo;
 
 typedef struct BlockFragInfo {
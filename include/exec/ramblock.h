@@ -46,6 +46,16 @@ struct RAMBlock {
     /* dirty bitmap used during migration */
     unsigned long *bmap;
 
+    /*
+     * Below fields are only used by precopy with defer-hot-pages
+     */
+    /* pages written to since the second to last dirty bitmap sync */
+    unsigned long *last_dirty_bmap;
+    /* pages written to in each of the last two syncs, not sent in precopy */
+    unsigned long *hot_bmap;
+    /* scratch copy of bmap, holding the pages still pending at a sync */
+    unsigned long *pending_bmap;
+
     /*
      * Below fields are only used by mapped-ram migration
      */
@@ -197,8 +197,12 @@ struct CPUClass {
  */
 #define NB_MMU_MODES 16
 
-/* Use a fully associative victim tlb of 8 entries. */
-#define CPU_VTLB_SIZE 8
+/*
+ * Use a fully associative victim tlb, by default of 8 entries.
+ * The size can be changed with the tcg accelerator's victim-tlb-size.
+ */
+#define CPU_VTLB_DEFAULT_SIZE 8
+#define CPU_VTLB_MAX_SIZE 64
 
 /*
  * The full TLB entry, which is not accessed by generated TCG code,
@@ -281,11 +285,18 @@ typedef struct CPUTLBDesc {
     /* maximum number of entries observed in the window */
     size_t window_max_entries;
     size_t n_used_entries;
-    /* The next index to use in the tlb victim table.  */
+    /*
+     * The next index to use in the tlb victim table, or with the lru
+     * replacement policy, the clock used to age the entries.
+     */
     size_t vindex;
+    /* The number of entries in the tlb victim table.  */
+    size_t vsize;
     /* The tlb victim table, in two parts.  */
-    CPUTLBEntry vtable[CPU_VTLB_SIZE];
-    CPUTLBEntryFull vfulltlb[CPU_VTLB_SIZE];
+    CPUTLBEntry *vtable;
+    CPUTLBEntryFull *vfulltlb;
+    /* For the lru replacement policy, the last use of each entry.  */
+    size_t *vstamp;
     CPUTLBEntryFull *fulltlb;
 } CPUTLBDesc;
 
@@ -301,6 +312,11 @@ typedef struct CPUTLBCommon {
      * Protected by tlb_c.lock.
      */
     uint16_t dirty;
+    /*
+     * Replace the least recently used victim tlb entry, rather than
+     * cycling through the victim tlb in order.
+     */
+    bool vtlb_lru;
     /*
      * Statistics.  These are not lock protected, but are read and
      * written atomically.  This allows the monitor to print a snapshot
@@ -309,6 +325,14 @@ typedef struct CPUTLBCommon {
     size_t full_flush_count;
     size_t part_flush_count;
     size_t elide_flush_count;
+    /* Lookups which missed in the fast path tlb.  */
+    size_t miss_count;
+    /* Of those, lookups which were satisfied by the victim tlb.  */
+    size_t victim_hit_count;
+    /* Entries installed by tlb_fill.  */
+    size_t fill_count;
+    /* Changes to the size of the fast path tlb.  */
+    size_t resize_count;
 } CPUTLBCommon;
 
 /*
@@ -34,6 +34,9 @@ struct SCSIRequest {
     SCSICommand       cmd;
     NotifierList      cancel_notifiers;
 
+    /* AioContext that executes the request, see scsi_req_alloc() */
+    AioContext        *ctx;
+
     /* Note:
      * - fields before sense are initialized by scsi_req_alloc;
      * - sense[] is uninitialized;
@@ -77,9 +80,11 @@ struct SCSIDevice
     uint32_t sense_len;
 
     /*
-     * The requests list is only accessed from the AioContext that executes
-     * requests or from the main loop when IOThread processing is stopped.
+     * Requests can be executed by several AioContexts at once, so the
+     * requests list is protected by requests_lock.  Each request must only
+     * be processed in its own AioContext (SCSIRequest.ctx).
      */
+    QemuMutex requests_lock;
     QTAILQ_HEAD(, SCSIRequest) requests;
 
     uint32_t channel;
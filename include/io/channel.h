@@ -35,6 +35,7 @@ OBJECT_DECLARE_TYPE(QIOChannel, QIOChannelClass,
 #define QIO_CHANNEL_WRITE_FLAG_ZERO_COPY 0x1
 
 #define QIO_CHANNEL_READ_FLAG_MSG_PEEK 0x1
+#define QIO_CHANNEL_READ_FLAG_WAITALL 0x2
 
 typedef enum QIOChannelFeature QIOChannelFeature;
 
@@ -224,6 +225,12 @@ void qio_channel_set_name(QIOChannel *ioc,
  * guaranteed. If the channel is non-blocking and no
  * data is available, it will return QIO_CHANNEL_ERR_BLOCK
  *
+ * With QIO_CHANNEL_READ_FLAG_WAITALL, a channel in blocking
+ * mode may wait until all of @iov is filled, so that a large
+ * read takes a single call.  Channels are free to ignore it,
+ * and a short read can still happen on signal, shutdown or
+ * end-of-file.
+ *
  * If the channel has passed any file descriptors,
  * the @fds array pointer will be allocated and
  * the elements filled with the received file
@@ -885,6 +892,7 @@ void qio_channel_set_aio_fd_handler(QIOChannel *ioc,
  * @niov: the length of the @iov array
  * @fds: an array of file handles to read
  * @nfds: number of file handles in @fds
+ * @flags: read flags (QIO_CHANNEL_READ_FLAG_*)
  * @errp: pointer to a NULL-initialized error object
  *
  *
@@ -903,7 +911,7 @@ int coroutine_mixed_fn qio_channel_readv_full_all_eof(QIOChannel *ioc,
                                                       const struct iovec *iov,
                                                       size_t niov,
                                                       int **fds, size_t *nfds,
-                                                      Error **errp);
+                                                      int flags, Error **errp);
 
 /**
  * qio_channel_readv_full_all:
@@ -912,6 +920,7 @@ int coroutine_mixed_fn qio_channel_readv_full_all_eof(QIOChannel *ioc,
  * @niov: the length of the @iov array
  * @fds: an array of file handles to read
  * @nfds: number of file handles in @fds
+ * @flags: read flags (QIO_CHANNEL_READ_FLAG_*)
  * @errp: pointer to a NULL-initialized error object
  *
  *
@@ -929,7 +938,7 @@ int coroutine_mixed_fn qio_channel_readv_full_all(QIOChannel *ioc,
                                                   const struct iovec *iov,
                                                   size_t niov,
                                                   int **fds, size_t *nfds,
-                                                  Error **errp);
+                                                  int flags, Error **errp);
 
 /**
  * qio_channel_writev_full_all:
@@ -170,7 +170,8 @@ static void iothread_set_aio_context_params(EventLoopBase *base, Error **errp)
     }
 
     aio_context_set_aio_params(iothread->ctx,
-                               iothread->parent_obj.aio_max_batch);
+                               iothread->parent_obj.aio_max_batch,
+                               iothread->parent_obj.io_uring_sqpoll_idle);
 
     aio_context_set_thread_pool_params(iothread->ctx, base->thread_pool_min,
                                        base->thread_pool_max, errp);
@@ -0,0 +1,341 @@
+/*
+ * Migration convergence controller
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/units.h"
+#include "qemu/timer.h"
+#include "hw/boards.h"
+#include "hw/core/cpu.h"
+#include "exec/target_page.h"
+#include "qapi/qapi-commands-migration.h"
+#include "qapi/qapi-events-migration.h"
+#include "sysemu/dirtylimit.h"
+#include "convergence.h"
+#include "migration.h"
+#include "migration-stats.h"
+#include "options.h"
+#include "trace.h"
+
+/*
+ * With the convergence-control capability, the migration thread steers
+ * precopy towards downtime-limit.  Every CONVERGENCE_INTERVAL_MS, once a
+ * dirty bitmap sync has measured a new dirty rate, it compares the guest
+ * dirty rate with the bandwidth of the migration over the interval:
+ *
+ * - while the guest dirties memory faster than CONVERGENCE_DIRTY_PCT
+ *   percent of the bandwidth, each pass does not shrink the pending
+ *   memory enough.  If the rate limit is what holds the bandwidth back,
+ *   it is raised, up to convergence-max-bandwidth.  Otherwise the vCPUs
+ *   get dirty rate limits: the dirty rate budget is shared out so that
+ *   only the vCPUs dirtying more than an even share of what the others
+ *   leave are limited, and never below vcpu-dirty-limit;
+ * - once the dirty rate falls below half of the budget, the vCPU limits
+ *   are doubled, or dropped for vCPUs that no longer reach them, and
+ *   then the rate limit goes back down towards max-bandwidth.
+ *
+ * Each step is by a factor of CONVERGENCE_STEP, which matches the gap
+ * between the two thresholds, so that undoing a step does not cross the
+ * other threshold straight away.  Nothing changes when the pending
+ * memory already fits in downtime-limit, and every change is reported
+ * with a MIGRATION_CONVERGENCE event.
+ */
+#define CONVERGENCE_INTERVAL_MS    1000
+#define CONVERGENCE_DIRTY_PCT      50
+#define CONVERGENCE_SATURATED_PCT  90
+#define CONVERGENCE_STEP           2
+
+static struct {
+    /* time, transferred bytes and sync count at the last decision */
+    int64_t last_ms;
+    uint64_t last_bytes;
+    uint64_t last_sync;
+    /* max-bandwidth when the rate limit was last derived from it */
+    uint64_t base_bandwidth;
+    /* rate limit in effect, bytes/s */
+    uint64_t rate_limit;
+    /* dirty rate limit of each vCPU in MB/s, 0 if not limited */
+    uint64_t *limits;
+} convergence;
+
+void migration_convergence_start(void)
+{
+    MachineState *ms = MACHINE(qdev_get_machine());
+
+    g_free(convergence.limits);
+    convergence.limits = g_new0(uint64_t, ms->smp.max_cpus);
+    convergence.last_ms = qemu_clock_get_ms(QEMU_CLOCK_REALTIME);
+    convergence.last_bytes = migration_transferred_bytes();
+    convergence.last_sync = stat64_get(&mig_stats.dirty_sync_count);
+    convergence.base_bandwidth = migrate_max_bandwidth();
+    convergence.rate_limit = convergence.base_bandwidth;
+}
+
+static bool convergence_set_limit(int cpu_index, uint64_t limit)
+{
+    if (convergence.limits[cpu_index] == limit) {
+        return false;
+    }
+
+    convergence.limits[cpu_index] = limit;
+    if (limit) {
+        qmp_set_vcpu_dirty_limit(true, cpu_index, limit, NULL);
+    } else {
+        qmp_cancel_vcpu_dirty_limit(true, cpu_index, NULL);
+    }
+    trace_migration_convergence_vcpu_limit(cpu_index, limit);
+    return true;
+}
+
+static uint64_t convergence_vcpu_rate(int cpu_index)
+{
+    /* Per-vCPU rates are only measured while some limit is in place */
+    return dirtylimit_in_service() ? vcpu_dirty_rate_get(cpu_index) : 0;
+}
+
+/*
+ * Dirty rate that a vCPU would reach without a limit, in MB/s; it is
+ * unknown when the vCPU is held back by its limit or not measured.
+ */
+static uint64_t convergence_vcpu_demand(int cpu_index)
+{
+    uint64_t limit = convergence.limits[cpu_index];
+    uint64_t rate;
+
+    if (!dirtylimit_in_service()) {
+        return UINT64_MAX;
+    }
+
+    rate = vcpu_dirty_rate_get(cpu_index);
+    if (limit && rate * 100 >= limit * CONVERGENCE_SATURATED_PCT) {
+        return UINT64_MAX;
+    }
+    return rate;
+}
+
+static int convergence_cmp_demand(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+/* Keep the vCPUs within @budget bytes/s; returns whether a limit changed */
+static bool convergence_limit_dirty_rate(uint64_t budget)
+{
+    MachineState *ms = MACHINE(qdev_get_machine());
+    g_autofree uint64_t *demand = g_new0(uint64_t, ms->smp.max_cpus);
+    g_autofree uint64_t *sorted = g_new0(uint64_t, ms->smp.max_cpus);
+    uint64_t floor = MAX(migrate_vcpu_dirty_limit(), 1);
+    uint64_t remaining = MAX(budget / MiB, 1);
+    uint64_t cap = 0;
+    bool changed = false;
+    CPUState *cpu;
+    int n = 0;
+    int i;
+
+    CPU_FOREACH(cpu) {
+        demand[cpu->cpu_index] = convergence_vcpu_demand(cpu->cpu_index);
+        sorted[n++] = demand[cpu->cpu_index];
+    }
+
+    /*
+     * Water-filling: the vCPUs that need less than an even share of
+     * what is left keep what they use, the others get that share.
+     */
+    qsort(sorted, n, sizeof(*sorted), convergence_cmp_demand);
+    for (i = 0; i < n; i++) {
+        uint64_t share = remaining / (n - i);
+
+        if (sorted[i] > share) {
+            cap = share;
+            break;
+        }
+        remaining -= sorted[i];
+    }
+    if (i == n) {
+        /* Every vCPU is within its share, the rest is not theirs */
+        return false;
+    }
+    cap = MAX(cap, floor);
+
+    CPU_FOREACH(cpu) {
+        uint64_t limit = convergence.limits[cpu->cpu_index];
+
+        if (demand[cpu->cpu_index] > cap) {
+            changed |= convergence_set_limit(cpu->cpu_index,
+                                             limit ? MIN(limit, cap) : cap);
+        }
+    }
+
+    if (!changed) {
+        /* The budget is already shared out, the limits are too loose */
+        CPU_FOREACH(cpu) {
+            uint64_t limit = convergence.limits[cpu->cpu_index];
+
+            if (limit > floor) {
+                changed |= convergence_set_limit(cpu->cpu_index,
+                                                 MAX(limit / CONVERGENCE_STEP,
+                                                     floor));
+            }
+        }
+    }
+
+    return changed;
+}
+
+static bool convergence_relax_dirty_rate(void)
+{
+    bool changed = false;
+    CPUState *cpu;
+
+    CPU_FOREACH(cpu) {
+        uint64_t limit = convergence.limits[cpu->cpu_index];
+
+        if (!limit) {
+            continue;
+        }
+        if (convergence_vcpu_rate(cpu->cpu_index) * 2 < limit) {
+            convergence_set_limit(cpu->cpu_index, 0);
+        } else {
+            convergence_set_limit(cpu->cpu_index, limit * CONVERGENCE_STEP);
+        }
+        changed = true;
+    }
+
+    return changed;
+}
+
+static bool convergence_rate_limited(uint64_t bandwidth)
+{
+    uint64_t limit = convergence.rate_limit;
+
+    return limit && migrate_convergence_max_bandwidth() > limit &&
+           bandwidth * 100 >= limit * CONVERGENCE_SATURATED_PCT;
+}
+
+static void convergence_set_rate_limit(uint64_t limit)
+{
+    convergence.rate_limit = limit;
+    migration_rate_set(limit);
+}
+
+static void convergence_report(MigrationConvergenceAction action,
+                               uint64_t bandwidth, uint64_t dirty_rate)
+{
+    DirtyLimitInfoList *head = NULL, **tail = &head;
+    CPUState *cpu;
+
+    CPU_FOREACH(cpu) {
+        DirtyLimitInfo *info;
+
+        if (!convergence.limits[cpu->cpu_index]) {
+            continue;
+        }
+        info = g_new0(DirtyLimitInfo, 1);
+        info->cpu_index = cpu->cpu_index;
+        info->limit_rate = convergence.limits[cpu->cpu_index];
+        info->current_rate = convergence_vcpu_rate(cpu->cpu_index);
+        QAPI_LIST_APPEND(tail, info);
+    }
+
+    trace_migration_convergence(MigrationConvergenceAction_str(action),
+                                bandwidth, dirty_rate,
+                                convergence.rate_limit);
+    qapi_event_send_migration_convergence(action, bandwidth, dirty_rate,
+                                          convergence.rate_limit, head);
+    qapi_free_DirtyLimitInfoList(head);
+}
+
+/**
+ * migration_convergence_update: run the convergence controller
+ *
+ * Called from the migration thread during precopy.
+ *
+ * @now_ms: current time in milliseconds
+ */
+void migration_convergence_update(int64_t now_ms)
+{
+    uint64_t sync = stat64_get(&mig_stats.dirty_sync_count);
+    uint64_t bytes, bandwidth, dirty_rate, pending, budget;
+    MigrationConvergenceAction action;
+
+    if (now_ms < convergence.last_ms + CONVERGENCE_INTERVAL_MS ||
+        sync == convergence.last_sync || migration_in_postcopy()) {
+        return;
+    }
+
+    bytes = migration_transferred_bytes();
+    bandwidth = (bytes - convergence.last_bytes) * 1000 /
+                (now_ms - convergence.last_ms);
+    convergence.last_ms = now_ms;
+    convergence.last_bytes = bytes;
+    convergence.last_sync = sync;
+
+    if (migrate_max_bandwidth() != convergence.base_bandwidth) {
+        /* max-bandwidth was changed, and has been applied as it is */
+        convergence.base_bandwidth = migrate_max_bandwidth();
+        convergence.rate_limit = convergence.base_bandwidth;
+    }
+
+    dirty_rate = stat64_get(&mig_stats.dirty_pages_rate) *
+                 qemu_target_page_size();
+    pending = stat64_get(&mig_stats.dirty_bytes_last_sync);
+    budget = bandwidth * CONVERGENCE_DIRTY_PCT / 100;
+
+    trace_migration_convergence_update(bandwidth, dirty_rate, pending);
+
+    if (!bandwidth || pending <= bandwidth * migrate_downtime_limit() / 1000) {
+        return;
+    }
+
+    if (dirty_rate > budget) {
+        if (convergence_rate_limited(bandwidth)) {
+            convergence_set_rate_limit(
+                MIN(convergence.rate_limit * CONVERGENCE_STEP,
+                    migrate_convergence_max_bandwidth()));
+            action = MIGRATION_CONVERGENCE_ACTION_RAISE_BANDWIDTH;
+        } else if (convergence_limit_dirty_rate(budget)) {
+            action = MIGRATION_CONVERGENCE_ACTION_LIMIT_DIRTY_RATE;
+        } else {
+            return;
+        }
+    } else if (dirty_rate < budget / 2) {
+        if (convergence_relax_dirty_rate()) {
+            action = MIGRATION_CONVERGENCE_ACTION_RELAX_DIRTY_RATE;
+        } else if (convergence.rate_limit > convergence.base_bandwidth) {
+            convergence_set_rate_limit(
+                MAX(convergence.rate_limit / CONVERGENCE_STEP,
+                    convergence.base_bandwidth));
+            action = MIGRATION_CONVERGENCE_ACTION_LOWER_BANDWIDTH;
+        } else {
+            return;
+        }
+    } else {
+        return;
+    }
+
+    convergence_report(action, bandwidth, dirty_rate);
+}
+
+/**
+ * migration_convergence_cleanup: drop the limits set by the controller
+ *
+ * Called once the migration is over, whatever its outcome.
+ */
+void migration_convergence_cleanup(void)
+{
+    CPUState *cpu;
+
+    if (!convergence.limits) {
+        return;
+    }
+
+    CPU_FOREACH(cpu) {
+        convergence_set_limit(cpu->cpu_index, 0);
+    }
+    g_clear_pointer(&convergence.limits, g_free);
+}
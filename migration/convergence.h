@@ -0,0 +1,15 @@
+/*
+ * Migration convergence controller
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#ifndef QEMU_MIGRATION_CONVERGENCE_H
+#define QEMU_MIGRATION_CONVERGENCE_H
+
+void migration_convergence_start(void);
+void migration_convergence_update(int64_t now_ms);
+void migration_convergence_cleanup(void);
+
+#endif
@@ -18,6 +18,7 @@
 #include "exec/target_page.h"
 #include "qemu/rcu_queue.h"
 #include "qemu/main-loop.h"
+#include "qemu/module.h"
 #include "qapi/qapi-commands-migration.h"
 #include "ram.h"
 #include "trace.h"
@@ -46,6 +47,18 @@ static int CalculatingState = DIRTY_RATE_STATUS_UNSTARTED;
 static struct DirtyRateStat DirtyStat;
 static DirtyRateMeasureMode dirtyrate_mode =
                 DIRTY_RATE_MEASURE_MODE_PAGE_SAMPLING;
+static bool dirtyrate_continuous;
+
+/*
+ * Protects the results of page sampling, which a continuous measurement
+ * updates while query-dirty-rate may be reading them.
+ */
+static QemuMutex dirtyrate_lock;
+
+/* Continuous measurement thread, only touched with the BQL held */
+static QemuThread continuous_thread;
+static QemuSemaphore continuous_stop_sem;
+static bool continuous_running;
 
 static int64_t dirty_stat_wait(int64_t msec, int64_t initial_time)
 {
@@ -254,10 +267,14 @@ static struct DirtyRateInfo *
 query_dirty_rate_info(TimeUnit calc_time_unit)
 {
     int i;
-    int64_t dirty_rate = DirtyStat.dirty_rate;
+    int64_t dirty_rate;
     struct DirtyRateInfo *info = g_new0(DirtyRateInfo, 1);
     DirtyRateVcpuList *head = NULL, **tail = &head;
+    DirtyRateRAMBlockList *blocks = NULL, **blocks_tail = &blocks;
+
+    QEMU_LOCK_GUARD(&dirtyrate_lock);
 
+    dirty_rate = DirtyStat.dirty_rate;
     info->status = CalculatingState;
     info->start_time = DirtyStat.start_time;
     info->calc_time = convert_time_unit(DirtyStat.calc_time_ms,
@@ -266,6 +283,7 @@ query_dirty_rate_info(TimeUnit calc_time_unit)
     info->calc_time_unit = calc_time_unit;
     info->sample_pages = DirtyStat.sample_pages;
     info->mode = dirtyrate_mode;
+    info->continuous = dirtyrate_continuous;
 
     if (qatomic_read(&CalculatingState) == DIRTY_RATE_STATUS_MEASURED) {
         info->has_dirty_rate = true;
@@ -290,6 +308,17 @@ query_dirty_rate_info(TimeUnit calc_time_unit)
         if (dirtyrate_mode == DIRTY_RATE_MEASURE_MODE_DIRTY_BITMAP) {
             info->sample_pages = 0;
         }
+
+        if (dirtyrate_mode == DIRTY_RATE_MEASURE_MODE_PAGE_SAMPLING) {
+            info->has_ramblock_dirty_rate = true;
+            for (i = 0; i < DirtyStat.page_sampling.nramblock; i++) {
+                DirtyRateRAMBlock *rate = g_new0(DirtyRateRAMBlock, 1);
+                rate->id = g_strdup(DirtyStat.page_sampling.rates[i].id);
+                rate->dirty_rate = DirtyStat.page_sampling.rates[i].dirty_rate;
+                QAPI_LIST_APPEND(blocks_tail, rate);
+            }
+            info->ramblock_dirty_rate = blocks;
+        }
     }
 
     trace_query_dirty_rate_info(DirtyRateStatus_str(CalculatingState));
@@ -309,6 +338,8 @@ static void init_dirtyrate_stat(struct DirtyRateConfig config)
         DirtyStat.page_sampling.total_dirty_samples = 0;
         DirtyStat.page_sampling.total_sample_count = 0;
         DirtyStat.page_sampling.total_block_mem_MB = 0;
+        DirtyStat.page_sampling.nramblock = 0;
+        DirtyStat.page_sampling.rates = NULL;
         break;
     case DIRTY_RATE_MEASURE_MODE_DIRTY_RING:
         DirtyStat.dirty_ring.nvcpu = -1;
@@ -319,6 +350,18 @@ static void init_dirtyrate_stat(struct DirtyRateConfig config)
     }
 }
 
+static void free_ramblock_rates(SampleVMStat *stat)
+{
+    int i;
+
+    for (i = 0; i < stat->nramblock; i++) {
+        g_free(stat->rates[i].id);
+    }
+    g_free(stat->rates);
+    stat->rates = NULL;
+    stat->nramblock = 0;
+}
+
 static void cleanup_dirtyrate_stat(struct DirtyRateConfig config)
 {
     /* last calc-dirty-rate qmp use dirty ring mode */
@@ -326,6 +369,10 @@ static void cleanup_dirtyrate_stat(struct DirtyRateConfig config)
         free(DirtyStat.dirty_ring.rates);
         DirtyStat.dirty_ring.rates = NULL;
     }
+
+    if (dirtyrate_mode == DIRTY_RATE_MEASURE_MODE_PAGE_SAMPLING) {
+        free_ramblock_rates(&DirtyStat.page_sampling);
+    }
 }
 
 static void update_dirtyrate_stat(struct RamblockDirtyInfo *info)
@@ -350,6 +397,40 @@ static void update_dirtyrate(uint64_t msec)
     DirtyStat.dirty_rate = dirtyrate;
 }
 
+static int64_t ramblock_dirty_rate(struct RamblockDirtyInfo *info,
+                                   int64_t msec)
+{
+    if (!info->sample_pages_count) {
+        return 0;
+    }
+
+    return info->sample_dirty_count *
+           qemu_target_pages_to_MiB(info->ramblock_pages) *
+           1000 / (info->sample_pages_count * msec);
+}
+
+/*
+ * Publish the dirty rate of each sampled ramblock.  The caller must
+ * hold dirtyrate_lock.
+ */
+static void update_ramblock_rates(struct RamblockDirtyInfo *infos, int count)
+{
+    SampleVMStat *stat = &DirtyStat.page_sampling;
+    int i, n = 0;
+
+    free_ramblock_rates(stat);
+    stat->rates = g_new0(DirtyRateRAMBlock, count);
+    for (i = 0; i < count; i++) {
+        if (!infos[i].sampled) {
+            continue;
+        }
+        stat->rates[n].id = g_strdup(infos[i].idstr);
+        stat->rates[n].dirty_rate = infos[i].dirty_rate;
+        n++;
+    }
+    stat->nramblock = n;
+}
+
 /*
  * Compute hash of a single page of size TARGET_PAGE_SIZE.
  */
@@ -394,7 +475,114 @@ static uint32_t get_ramblock_vfn_hash(struct RamblockDirtyInfo *info,
     return hash;
 }
 
-static bool save_ramblock_hash(struct RamblockDirtyInfo *info)
+typedef struct DirtyRateHashChunk {
+    struct RamblockDirtyInfo *info;
+    uint64_t start; /* first sampled page of the chunk */
+    uint64_t end; /* one past the last sampled page of the chunk */
+    uint64_t dirty; /* sampled pages whose hash changed */
+} DirtyRateHashChunk;
+
+typedef struct DirtyRateHashJob {
+    DirtyRateHashChunk *chunks;
+    int nchunks;
+    int next; /* next chunk to hash, taken with qatomic_fetch_inc() */
+    bool compare;
+} DirtyRateHashJob;
+
+static void hash_sample_chunk(DirtyRateHashChunk *chunk, bool compare)
+{
+    struct RamblockDirtyInfo *info = chunk->info;
+    uint32_t hash;
+    uint64_t i;
+
+    for (i = chunk->start; i < chunk->end; i++) {
+        hash = get_ramblock_vfn_hash(info, info->sample_page_vfn[i]);
+        if (compare && hash != info->hash_result[i]) {
+            trace_calc_page_dirty_rate(info->idstr, hash, info->hash_result[i]);
+            chunk->dirty++;
+        }
+        info->hash_result[i] = hash;
+    }
+}
+
+static void *hash_sample_thread(void *opaque)
+{
+    DirtyRateHashJob *job = opaque;
+    int i;
+
+    while ((i = qatomic_fetch_inc(&job->next)) < job->nchunks) {
+        hash_sample_chunk(&job->chunks[i], job->compare);
+    }
+
+    return NULL;
+}
+
+/*
+ * Hash the sampled pages of every ramblock in @infos that has @sampled
+ * set.  With @compare, count the pages whose hash changed since the last
+ * pass in sample_dirty_count.  Either way the new hashes replace the old
+ * ones, so a continuous measurement hashes each page once per period.
+ *
+ * Large guests have their sampled pages spread over several threads; the
+ * caller must hold the RCU read lock, which covers them too as they are
+ * joined before returning.
+ */
+static void hash_sampled_pages(struct RamblockDirtyInfo *infos, int count,
+                               bool compare)
+{
+    DirtyRateHashJob job = { .compare = compare };
+    g_autofree QemuThread *threads = NULL;
+    uint64_t total_pages = 0;
+    uint64_t start;
+    int nthreads;
+    int i, j;
+
+    for (i = 0; i < count; i++) {
+        if (infos[i].sampled) {
+            job.nchunks += DIV_ROUND_UP(infos[i].sample_pages_count,
+                                        DIRTYRATE_HASH_CHUNK_PAGES);
+            total_pages += infos[i].sample_pages_count;
+        }
+    }
+
+    job.chunks = g_new0(DirtyRateHashChunk, job.nchunks);
+    for (i = 0, j = 0; i < count; i++) {
+        if (!infos[i].sampled) {
+            continue;
+        }
+        for (start = 0; start < infos[i].sample_pages_count;
+             start += DIRTYRATE_HASH_CHUNK_PAGES) {
+            job.chunks[j].info = &infos[i];
+            job.chunks[j].start = start;
+            job.chunks[j].end = MIN(start + DIRTYRATE_HASH_CHUNK_PAGES,
+                                    infos[i].sample_pages_count);
+            j++;
+        }
+    }
+
+    nthreads = DIV_ROUND_UP(total_pages, DIRTYRATE_PAGES_PER_HASH_THREAD);
+    nthreads = MIN(nthreads, MIN(DIRTYRATE_MAX_HASH_THREADS,
+                                 g_get_num_processors()));
+    trace_dirtyrate_hash_sampled_pages(total_pages, nthreads);
+
+    /* The calling thread hashes chunks too */
+    threads = g_new0(QemuThread, MAX(nthreads, 1));
+    for (i = 1; i < nthreads; i++) {
+        qemu_thread_create(&threads[i], "dirtyrate_hash", hash_sample_thread,
+                           &job, QEMU_THREAD_JOINABLE);
+    }
+    hash_sample_thread(&job);
+    for (i = 1; i < nthreads; i++) {
+        qemu_thread_join(&threads[i]);
+    }
+
+    for (j = 0; j < job.nchunks; j++) {
+        job.chunks[j].info->sample_dirty_count += job.chunks[j].dirty;
+    }
+    g_free(job.chunks);
+}
+
+static bool select_ramblock_samples(struct RamblockDirtyInfo *info)
 {
     unsigned int sample_pages_count;
     int i;
@@ -424,10 +612,9 @@ static bool save_ramblock_hash(struct RamblockDirtyInfo *info)
     for (i = 0; i < sample_pages_count; i++) {
         info->sample_page_vfn[i] = g_rand_int_range(rand, 0,
                                                     info->ramblock_pages - 1);
-        info->hash_result[i] = get_ramblock_vfn_hash(info,
-                                                     info->sample_page_vfn[i]);
     }
     g_rand_free(rand);
+    info->sampled = true;
 
     return true;
 }
@@ -509,11 +696,12 @@ static bool record_ramblock_hash_info(struct RamblockDirtyInfo **block_dinfo,
         }
         info = &dinfo[index];
         get_ramblock_dirty_info(block, info, &config);
-        if (!save_ramblock_hash(info)) {
+        if (!select_ramblock_samples(info)) {
             goto out;
         }
         index++;
     }
+    hash_sampled_pages(dinfo, index, false);
     ret = true;
 
 out:
@@ -522,20 +710,6 @@ out:
     return ret;
 }
 
-static void calc_page_dirty_rate(struct RamblockDirtyInfo *info)
-{
-    uint32_t hash;
-    int i;
-
-    for (i = 0; i < info->sample_pages_count; i++) {
-        hash = get_ramblock_vfn_hash(info, info->sample_page_vfn[i]);
-        if (hash != info->hash_result[i]) {
-            trace_calc_page_dirty_rate(info->idstr, hash, info->hash_result[i]);
-            info->sample_dirty_count++;
-        }
-    }
-}
-
 static struct RamblockDirtyInfo *
 find_block_matched(RAMBlock *block, int count,
                   struct RamblockDirtyInfo *infos)
@@ -567,6 +741,12 @@ static bool compare_page_hash_info(struct RamblockDirtyInfo *info,
 {
     struct RamblockDirtyInfo *block_dinfo = NULL;
     RAMBlock *block = NULL;
+    int i;
+
+    for (i = 0; i < block_count; i++) {
+        info[i].sampled = false;
+        info[i].sample_dirty_count = 0;
+    }
 
     RAMBLOCK_FOREACH_MIGRATABLE(block) {
         if (skip_sample_ramblock(block)) {
@@ -576,8 +756,15 @@ static bool compare_page_hash_info(struct RamblockDirtyInfo *info,
         if (block_dinfo == NULL) {
             continue;
         }
-        calc_page_dirty_rate(block_dinfo);
-        update_dirtyrate_stat(block_dinfo);
+        block_dinfo->sampled = true;
+    }
+
+    hash_sampled_pages(info, block_count, true);
+
+    for (i = 0; i < block_count; i++) {
+        if (info[i].sampled) {
+            update_dirtyrate_stat(&info[i]);
+        }
     }
 
     if (DirtyStat.page_sampling.total_sample_count == 0) {
@@ -688,6 +875,7 @@ static void calculate_dirtyrate_sample_vm(struct DirtyRateConfig config)
     struct RamblockDirtyInfo *block_dinfo = NULL;
     int block_count = 0;
     int64_t initial_time;
+    int i;
 
     rcu_read_lock();
     initial_time = qemu_clock_get_ms(QEMU_CLOCK_REALTIME);
@@ -705,19 +893,139 @@ static void calculate_dirtyrate_sample_vm(struct DirtyRateConfig config)
         goto out;
     }
 
-    update_dirtyrate(DirtyStat.calc_time_ms);
+    for (i = 0; i < block_count; i++) {
+        block_dinfo[i].dirty_rate =
+            ramblock_dirty_rate(&block_dinfo[i], DirtyStat.calc_time_ms);
+    }
+
+    WITH_QEMU_LOCK_GUARD(&dirtyrate_lock) {
+        update_dirtyrate(DirtyStat.calc_time_ms);
+        update_ramblock_rates(block_dinfo, block_count);
+    }
 
 out:
     rcu_read_unlock();
     free_ramblock_dirty_info(block_dinfo, block_count);
 }
 
+/*
+ * Wait for the rest of a continuous measurement period.  Returns the
+ * length of the period in milliseconds, or -1 if the measurement has
+ * been stopped.
+ */
+static int64_t dirty_stat_wait_continuous(int64_t msec, int64_t initial_time)
+{
+    int64_t remaining;
+
+    remaining = msec + initial_time - qemu_clock_get_ms(QEMU_CLOCK_REALTIME);
+    if (qemu_sem_timedwait(&continuous_stop_sem, MAX(remaining, 0)) == 0) {
+        return -1;
+    }
+
+    return qemu_clock_get_ms(QEMU_CLOCK_REALTIME) - initial_time;
+}
+
+/*
+ * Fold the dirty rate of the last period into the rolling estimate of
+ * each ramblock and publish the result.
+ */
+static void update_dirtyrate_continuous(struct RamblockDirtyInfo *infos,
+                                        int count, int64_t msec, bool first)
+{
+    int64_t rate, dirtyrate = 0;
+    int i;
+
+    for (i = 0; i < count; i++) {
+        if (!infos[i].sampled) {
+            continue;
+        }
+        rate = ramblock_dirty_rate(&infos[i], msec);
+        if (!first) {
+            rate = (infos[i].dirty_rate * (DIRTYRATE_ROLLING_WEIGHT - 1) +
+                    rate) / DIRTYRATE_ROLLING_WEIGHT;
+        }
+        infos[i].dirty_rate = rate;
+        dirtyrate += rate;
+        trace_dirtyrate_ramblock_rolling(infos[i].idstr, rate);
+    }
+
+    QEMU_LOCK_GUARD(&dirtyrate_lock);
+    DirtyStat.dirty_rate = dirtyrate;
+    DirtyStat.calc_time_ms = msec;
+    update_ramblock_rates(infos, count);
+}
+
+/*
+ * Sample the same pages period after period until stopped, hashing them
+ * once per period: the hashes taken at the end of a period are the
+ * starting point of the next one.  A new sample is taken whenever
+ * ramblocks are added or removed.
+ */
+static void calculate_dirtyrate_sample_vm_continuous(
+    struct DirtyRateConfig config)
+{
+    struct RamblockDirtyInfo *block_dinfo = NULL;
+    int block_count = 0;
+    int64_t initial_time;
+    int64_t msec;
+    uint32_t version;
+    bool measured = false;
+    bool first = true;
+    bool ok;
+
+    DirtyStat.start_time = qemu_clock_get_ms(QEMU_CLOCK_HOST) / 1000;
+
+    rcu_read_lock();
+    initial_time = qemu_clock_get_ms(QEMU_CLOCK_REALTIME);
+    version = ram_list.version;
+    ok = record_ramblock_hash_info(&block_dinfo, config, &block_count);
+    rcu_read_unlock();
+
+    while (ok) {
+        msec = dirty_stat_wait_continuous(config.calc_time_ms, initial_time);
+        if (msec < 0) {
+            break;
+        }
+
+        rcu_read_lock();
+        initial_time = qemu_clock_get_ms(QEMU_CLOCK_REALTIME);
+        if (version != ram_list.version) {
+            free_ramblock_dirty_info(block_dinfo, block_count);
+            block_dinfo = NULL;
+            version = ram_list.version;
+            ok = record_ramblock_hash_info(&block_dinfo, config, &block_count);
+            first = true;
+            rcu_read_unlock();
+            continue;
+        }
+
+        DirtyStat.page_sampling.total_dirty_samples = 0;
+        DirtyStat.page_sampling.total_sample_count = 0;
+        DirtyStat.page_sampling.total_block_mem_MB = 0;
+        if (compare_page_hash_info(block_dinfo, block_count)) {
+            update_dirtyrate_continuous(block_dinfo, block_count, msec, first);
+            first = false;
+            if (!measured) {
+                dirtyrate_set_state(&CalculatingState,
+                                    DIRTY_RATE_STATUS_MEASURING,
+                                    DIRTY_RATE_STATUS_MEASURED);
+                measured = true;
+            }
+        }
+        rcu_read_unlock();
+    }
+
+    free_ramblock_dirty_info(block_dinfo, block_count);
+}
+
 static void calculate_dirtyrate(struct DirtyRateConfig config)
 {
     if (config.mode == DIRTY_RATE_MEASURE_MODE_DIRTY_BITMAP) {
         calculate_dirtyrate_dirty_bitmap(config);
     } else if (config.mode == DIRTY_RATE_MEASURE_MODE_DIRTY_RING) {
         calculate_dirtyrate_dirty_ring(config);
+    } else if (config.continuous) {
+        calculate_dirtyrate_sample_vm_continuous(config);
     } else {
         calculate_dirtyrate_sample_vm(config);
     }
@@ -740,16 +1048,35 @@ void *get_dirtyrate_thread(void *arg)
 
     calculate_dirtyrate(config);
 
-    ret = dirtyrate_set_state(&CalculatingState, DIRTY_RATE_STATUS_MEASURING,
-                              DIRTY_RATE_STATUS_MEASURED);
-    if (ret == -1) {
-        error_report("change dirtyrate state failed.");
+    if (config.continuous) {
+        /* Nothing to report if stopped before the first period ended */
+        dirtyrate_set_state(&CalculatingState, DIRTY_RATE_STATUS_MEASURING,
+                            DIRTY_RATE_STATUS_UNSTARTED);
+    } else {
+        ret = dirtyrate_set_state(&CalculatingState,
+                                  DIRTY_RATE_STATUS_MEASURING,
+                                  DIRTY_RATE_STATUS_MEASURED);
+        if (ret == -1) {
+            error_report("change dirtyrate state failed.");
+        }
     }
 
     rcu_unregister_thread();
     return NULL;
 }
 
+static void dirtyrate_stop_continuous(void)
+{
+    if (!continuous_running) {
+        return;
+    }
+
+    qemu_sem_post(&continuous_stop_sem);
+    qemu_thread_join(&continuous_thread);
+    qemu_sem_destroy(&continuous_stop_sem);
+    continuous_running = false;
+}
+
 void qmp_calc_dirty_rate(int64_t calc_time,
                          bool has_calc_time_unit,
                          TimeUnit calc_time_unit,
@@ -757,6 +1084,8 @@ void qmp_calc_dirty_rate(int64_t calc_time,
                          int64_t sample_pages,
                          bool has_mode,
                          DirtyRateMeasureMode mode,
+                         bool has_continuous,
+                         bool continuous,
                          Error **errp)
 {
     static struct DirtyRateConfig config;
@@ -765,8 +1094,10 @@ void qmp_calc_dirty_rate(int64_t calc_time,
 
     /*
      * If the dirty rate is already being measured, don't attempt to start.
+     * A continuous measurement is stopped instead, see below.
      */
-    if (qatomic_read(&CalculatingState) == DIRTY_RATE_STATUS_MEASURING) {
+    if (!continuous_running &&
+        qatomic_read(&CalculatingState) == DIRTY_RATE_STATUS_MEASURING) {
         error_setg(errp, "the dirty rate is already being measured.");
         return;
     }
@@ -792,6 +1123,11 @@ void qmp_calc_dirty_rate(int64_t calc_time,
         return;
     }
 
+    if (continuous && mode != DIRTY_RATE_MEASURE_MODE_PAGE_SAMPLING) {
+        error_setg(errp, "continuous is used only in page-sampling mode");
+        return;
+    }
+
     if (has_sample_pages) {
         if (!is_sample_pages_valid(sample_pages)) {
             error_setg(errp, "sample-pages is out of range[%d, %d].",
@@ -816,6 +1152,8 @@ void qmp_calc_dirty_rate(int64_t calc_time,
          return;
     }
 
+    dirtyrate_stop_continuous();
+
     /*
      * Init calculation state as unstarted.
      */
@@ -829,6 +1167,7 @@ void qmp_calc_dirty_rate(int64_t calc_time,
     config.calc_time_ms = calc_time_ms;
     config.sample_pages_per_gigabytes = sample_pages;
     config.mode = mode;
+    config.continuous = continuous;
 
     cleanup_dirtyrate_stat(config);
 
@@ -837,9 +1176,19 @@ void qmp_calc_dirty_rate(int64_t calc_time,
      * been used in last calculation
      **/
     dirtyrate_mode = mode;
+    dirtyrate_continuous = continuous;
 
     init_dirtyrate_stat(config);
 
+    if (continuous) {
+        qemu_sem_init(&continuous_stop_sem, 0);
+        qemu_thread_create(&continuous_thread, "get_dirtyrate",
+                           get_dirtyrate_thread, (void *)&config,
+                           QEMU_THREAD_JOINABLE);
+        continuous_running = true;
+        return;
+    }
+
     qemu_thread_create(&thread, "get_dirtyrate", get_dirtyrate_thread,
                        (void *)&config, QEMU_THREAD_DETACHED);
 }
@@ -867,8 +1216,9 @@ void hmp_info_dirty_rate(Monitor *mon, const QDict *qdict)
     }
     monitor_printf(mon, "Period: %"PRIi64" (sec)\n",
                    info->calc_time);
-    monitor_printf(mon, "Mode: %s\n",
-                   DirtyRateMeasureMode_str(info->mode));
+    monitor_printf(mon, "Mode: %s%s\n",
+                   DirtyRateMeasureMode_str(info->mode),
+                   info->continuous ? " (continuous)" : "");
     monitor_printf(mon, "Dirty rate: ");
     if (info->has_dirty_rate) {
         monitor_printf(mon, "%"PRIi64" (MB/s)\n", info->dirty_rate);
@@ -880,12 +1230,19 @@ void hmp_info_dirty_rate(Monitor *mon, const QDict *qdict)
                                rate->value->dirty_rate);
             }
         }
+        if (info->has_ramblock_dirty_rate) {
+            DirtyRateRAMBlockList *rate, *head = info->ramblock_dirty_rate;
+            for (rate = head; rate != NULL; rate = rate->next) {
+                monitor_printf(mon, "ramblock %s, Dirty rate: %"PRIi64
+                               " (MB/s)\n", rate->value->id,
+                               rate->value->dirty_rate);
+            }
+        }
     } else {
         monitor_printf(mon, "(not ready)\n");
     }
 
-    qapi_free_DirtyRateVcpuList(info->vcpu_dirty_rate);
-    g_free(info);
+    qapi_free_DirtyRateInfo(info);
 }
 
 void hmp_calc_dirty_rate(Monitor *mon, const QDict *qdict)
@@ -895,6 +1252,7 @@ void hmp_calc_dirty_rate(Monitor *mon, const QDict *qdict)
     bool has_sample_pages = (sample_pages != -1);
     bool dirty_ring = qdict_get_try_bool(qdict, "dirty_ring", false);
     bool dirty_bitmap = qdict_get_try_bool(qdict, "dirty_bitmap", false);
+    bool continuous = qdict_get_try_bool(qdict, "continuous", false);
     DirtyRateMeasureMode mode = DIRTY_RATE_MEASURE_MODE_PAGE_SAMPLING;
     Error *err = NULL;
 
@@ -919,13 +1277,21 @@ void hmp_calc_dirty_rate(Monitor *mon, const QDict *qdict)
                         false, TIME_UNIT_SECOND, /* calc-time-unit */
                         has_sample_pages, sample_pages,
                         true, mode,
+                        true, continuous,
                         &err);
     if (err) {
         hmp_handle_error(mon, err);
         return;
     }
 
-    monitor_printf(mon, "Starting dirty rate measurement with period %"PRIi64
-                   " seconds\n", sec);
+    monitor_printf(mon, "Starting %sdirty rate measurement with period %"
+                   PRIi64 " seconds\n", continuous ? "continuous " : "", sec);
     monitor_printf(mon, "[Please use 'info dirty_rate' to check results]\n");
 }
+
+static void dirtyrate_init(void)
+{
+    qemu_mutex_init(&dirtyrate_lock);
+}
+
+migration_init(dirtyrate_init);
@@ -44,10 +44,26 @@
 #define MIN_SAMPLE_PAGE_COUNT                     128
 #define MAX_SAMPLE_PAGE_COUNT                     16384
 
+/*
+ * Sampled pages are hashed in chunks of DIRTYRATE_HASH_CHUNK_PAGES by one
+ * thread per DIRTYRATE_PAGES_PER_HASH_THREAD sampled pages, with at most
+ * DIRTYRATE_MAX_HASH_THREADS threads.
+ */
+#define DIRTYRATE_HASH_CHUNK_PAGES                1024
+#define DIRTYRATE_PAGES_PER_HASH_THREAD           16384
+#define DIRTYRATE_MAX_HASH_THREADS                8
+
+/*
+ * In continuous mode, each period accounts for 1/DIRTYRATE_ROLLING_WEIGHT
+ * of the rolling dirty rate of a ramblock.
+ */
+#define DIRTYRATE_ROLLING_WEIGHT                  4
+
 struct DirtyRateConfig {
     uint64_t sample_pages_per_gigabytes; /* sample pages per GB */
     int64_t calc_time_ms; /* desired calculation time (in milliseconds) */
     DirtyRateMeasureMode mode; /* mode of dirtyrate measurement */
+    bool continuous; /* keep sampling until the next calc-dirty-rate */
 };
 
 /*
@@ -61,12 +77,16 @@ struct RamblockDirtyInfo {
     uint64_t sample_pages_count; /* count of sampled pages */
     uint64_t sample_dirty_count; /* count of dirty pages we measure */
     uint32_t *hash_result; /* array of hash result for sampled pages */
+    bool sampled; /* whether the next hashing pass covers this ramblock */
+    int64_t dirty_rate; /* rolling dirty rate in MB/s (continuous mode) */
 };
 
 typedef struct SampleVMStat {
     uint64_t total_dirty_samples; /* total dirty sampled page */
     uint64_t total_sample_count; /* total sampled pages */
     uint64_t total_block_mem_MB; /* size of total sampled pages in MB */
+    int nramblock; /* number of sampled ramblocks */
+    DirtyRateRAMBlock *rates; /* array of dirty rate for each ramblock */
 } SampleVMStat;
 
 /*
@@ -9,6 +9,7 @@
 #include "exec/ramblock.h"
 #include "qemu/cutils.h"
 #include "qemu/error-report.h"
+#include "qemu/units.h"
 #include "qapi/error.h"
 #include "channel.h"
 #include "file.h"
@@ -17,9 +18,15 @@
 #include "io/channel-socket.h"
 #include "io/channel-util.h"
 #include "options.h"
+#include "ram.h"
 #include "trace.h"
+#ifdef CONFIG_LINUX
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#endif
 
 #define OFFSET_OPTION ",offset="
+#define COPY_BUF_SIZE (1 * MiB)
 
 static struct FileOutgoingArgs {
     char *fname;
@@ -93,17 +100,109 @@ out:
     return ret;
 }
 
+/*
+ * A mapped-ram delta is written into a new file, which must not be the
+ * file of the previous migration: that one stays valid if the delta
+ * fails.
+ */
+static bool file_check_delta(const char *filename, const char *base,
+                             uint64_t offset, Error **errp)
+{
+    struct stat st, base_st;
+
+    if (offset) {
+        error_setg(errp, "mapped-ram-delta does not support a file offset");
+        return false;
+    }
+
+    if (stat(base, &base_st) < 0) {
+        error_setg_errno(errp, errno, "cannot access the file of the "
+                         "previous migration %s", base);
+        return false;
+    }
+
+    if (stat(filename, &st) == 0 &&
+        st.st_dev == base_st.st_dev && st.st_ino == base_st.st_ino) {
+        error_setg(errp, "a mapped-ram delta must be written to a new file, "
+                   "not over the previous migration %s", base);
+        return false;
+    }
+
+    return true;
+}
+
+/* Start the delta file @fd as a copy of @base, sharing extents if possible */
+static bool file_copy_base(int fd, const char *base, Error **errp)
+{
+    g_autofree uint8_t *buf = NULL;
+    off_t pos = 0;
+    ssize_t len, done, n;
+    int base_fd;
+    bool ret = false;
+
+    base_fd = qemu_open(base, O_RDONLY, errp);
+    if (base_fd < 0) {
+        return false;
+    }
+
+#ifdef FICLONE
+    if (ioctl(fd, FICLONE, base_fd) == 0) {
+        trace_migration_file_copy_base(base, true);
+        ret = true;
+        goto out;
+    }
+#endif
+
+    trace_migration_file_copy_base(base, false);
+    buf = g_malloc(COPY_BUF_SIZE);
+    for (;;) {
+        len = RETRY_ON_EINTR(pread(base_fd, buf, COPY_BUF_SIZE, pos));
+        if (len < 0) {
+            error_setg_errno(errp, errno, "cannot read %s", base);
+            goto out;
+        }
+        if (len == 0) {
+            break;
+        }
+        for (done = 0; done < len; done += n) {
+            n = RETRY_ON_EINTR(pwrite(fd, buf + done, len - done, pos + done));
+            if (n < 0) {
+                error_setg_errno(errp, errno, "cannot copy %s", base);
+                goto out;
+            }
+        }
+        pos += len;
+    }
+    ret = true;
+
+out:
+    qemu_close(base_fd);
+    return ret;
+}
+
 void file_start_outgoing_migration(MigrationState *s,
                                    FileMigrationArgs *file_args, Error **errp)
 {
     g_autoptr(QIOChannelFile) fioc = NULL;
     g_autofree char *filename = g_strdup(file_args->filename);
     uint64_t offset = file_args->offset;
+    /*
+     * A mapped-ram delta starts from a copy of the previous migration,
+     * which it needs to read back.
+     */
+    const char *base = migrate_mapped_ram_delta() ?
+                       ram_delta_tracking_base() : NULL;
     QIOChannel *ioc;
 
     trace_migration_file_outgoing(filename);
 
-    fioc = qio_channel_file_new_path(filename, O_CREAT | O_WRONLY, 0600, errp);
+    if (base && !file_check_delta(filename, base, offset, errp)) {
+        return;
+    }
+
+    fioc = qio_channel_file_new_path(filename,
+                                     O_CREAT | (base ? O_RDWR : O_WRONLY),
+                                     0600, errp);
     if (!fioc) {
         return;
     }
@@ -115,6 +214,14 @@ void file_start_outgoing_migration(MigrationState *s,
         return;
     }
 
+    if (base && !file_copy_base(fioc->fd, base, errp)) {
+        return;
+    }
+
+    if (migrate_mapped_ram_delta()) {
+        ram_delta_tracking_set_file(filename, base != NULL);
+    }
+
     outgoing_args.fname = g_strdup(filename);
 
     ioc = QIO_CHANNEL(fioc);
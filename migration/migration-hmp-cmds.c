@@ -107,6 +107,10 @@ void hmp_info_migrate(Monitor *mon, const QDict *qdict)
                        info->ram->normal);
         monitor_printf(mon, "normal bytes: %" PRIu64 " kbytes\n",
                        info->ram->normal_bytes >> 10);
+        if (info->ram->dedup_pages) {
+            monitor_printf(mon, "dedup: %" PRIu64 " pages\n",
+                           info->ram->dedup_pages);
+        }
         monitor_printf(mon, "dirty sync count: %" PRIu64 "\n",
                        info->ram->dirty_sync_count);
         monitor_printf(mon, "page size: %" PRIu64 " kbytes\n",
@@ -158,6 +162,45 @@ void hmp_info_migrate(Monitor *mon, const QDict *qdict)
                        info->xbzrle_cache->encoding_rate);
         monitor_printf(mon, "xbzrle overflow: %" PRIu64 "\n",
                        info->xbzrle_cache->overflow);
+        monitor_printf(mon, "xbzrle cache hit: %" PRIu64 " pages\n",
+                       info->xbzrle_cache->cache_hit);
+        monitor_printf(mon, "xbzrle cache eviction: %" PRIu64 " pages\n",
+                       info->xbzrle_cache->cache_eviction);
+    }
+
+    if (info->multifd_channels) {
+        MultiFDChannelStatsList *ch;
+
+        for (ch = info->multifd_channels; ch; ch = ch->next) {
+            monitor_printf(mon, "multifd channel %" PRId64 ": %" PRIu64
+                           " pages, %" PRIu64 " kbytes -> %" PRIu64
+                           " kbytes (rate %0.2f), prepare time %" PRIu64
+                           " us\n",
+                           ch->value->id, ch->value->pages,
+                           ch->value->bytes >> 10,
+                           ch->value->compressed_bytes >> 10,
+                           ch->value->compression_rate,
+                           ch->value->prepare_time);
+            if (ch->value->has_cache_hit) {
+                monitor_printf(mon, "  xbzrle cache: %" PRIu64 " hits, %"
+                               PRIu64 " misses, %" PRIu64 " evictions\n",
+                               ch->value->cache_hit, ch->value->cache_miss,
+                               ch->value->cache_eviction);
+            }
+        }
+    }
+
+    if (info->multifd_recv_channels) {
+        MultiFDRecvChannelStatsList *ch;
+
+        for (ch = info->multifd_recv_channels; ch; ch = ch->next) {
+            monitor_printf(mon, "multifd recv channel %" PRId64 ": %" PRIu64
+                           " pages, %" PRIu64 " kbytes in %" PRIu64
+                           " us (%" PRIu64 " kbytes/s)\n",
+                           ch->value->id, ch->value->pages,
+                           ch->value->bytes >> 10, ch->value->time,
+                           ch->value->throughput >> 10);
+        }
     }
 
     if (info->has_cpu_throttle_percentage) {
@@ -358,6 +401,17 @@ void hmp_info_migrate_parameters(Monitor *mon, const QDict *qdict)
                                MIGRATION_PARAMETER_DIRECT_IO),
                            params->direct_io ? "on" : "off");
         }
+
+        assert(params->has_mapped_ram_read_size);
+        monitor_printf(mon, "%s: %" PRIu64 " bytes\n",
+            MigrationParameter_str(MIGRATION_PARAMETER_MAPPED_RAM_READ_SIZE),
+            params->mapped_ram_read_size);
+
+        assert(params->has_convergence_max_bandwidth);
+        monitor_printf(mon, "%s: %" PRIu64 " bytes/second\n",
+            MigrationParameter_str(
+                MIGRATION_PARAMETER_CONVERGENCE_MAX_BANDWIDTH),
+            params->convergence_max_bandwidth);
     }
 
     qapi_free_MigrationParameters(params);
@@ -635,6 +689,14 @@ void hmp_migrate_set_parameter(Monitor *mon, const QDict *qdict)
         p->has_direct_io = true;
         visit_type_bool(v, param, &p->direct_io, &err);
         break;
+    case MIGRATION_PARAMETER_MAPPED_RAM_READ_SIZE:
+        p->has_mapped_ram_read_size = true;
+        visit_type_size(v, param, &p->mapped_ram_read_size, &err);
+        break;
+    case MIGRATION_PARAMETER_CONVERGENCE_MAX_BANDWIDTH:
+        p->has_convergence_max_bandwidth = true;
+        visit_type_size(v, param, &p->convergence_max_bandwidth, &err);
+        break;
     default:
         assert(0);
     }
@@ -34,6 +34,11 @@
  * one thread).
  */
 typedef struct {
+    /*
+     * Number of pages sent as a reference to a page that the
+     * destination already has in its dedup cache.
+     */
+    Stat64 dedup_pages;
     /*
      * Number of bytes that were dirty last time that we synced with
      * the guest memory.  We use that to calculate the downtime.  As
@@ -57,6 +57,7 @@
 #include "net/announce.h"
 #include "qemu/queue.h"
 #include "multifd.h"
+#include "convergence.h"
 #include "threadinfo.h"
 #include "qemu/yank.h"
 #include "sysemu/cpus.h"
@@ -765,6 +766,13 @@ static void process_incoming_migration_bh(void *opaque)
         runstate_set(global_state_get_runstate());
     }
     trace_vmstate_downtime_checkpoint("dst-precopy-bh-vm-started");
+
+    if (mis->lazy_load) {
+        /* Completes once the rest of RAM has been read from the file */
+        postcopy_lazy_load_start(mis);
+        return;
+    }
+
     /*
      * This must happen after any state changes since as soon as an external
      * observer sees this event they might start to prod at the VM assuming
@@ -836,6 +844,7 @@ fail:
     migrate_set_error(s, local_err);
     error_free(local_err);
 
+    postcopy_lazy_load_cleanup(mis);
     migration_incoming_state_destroy();
 
     if (mis->exit_on_error) {
@@ -1194,6 +1203,7 @@ static void populate_ram_info(MigrationInfo *info, MigrationState *s)
     info->ram->duplicate = stat64_get(&mig_stats.zero_pages);
     info->ram->normal = stat64_get(&mig_stats.normal_pages);
     info->ram->normal_bytes = info->ram->normal * page_size;
+    info->ram->dedup_pages = stat64_get(&mig_stats.dedup_pages);
     info->ram->mbps = s->mbps;
     info->ram->dirty_sync_count =
         stat64_get(&mig_stats.dirty_sync_count);
@@ -1217,6 +1227,12 @@ static void populate_ram_info(MigrationInfo *info, MigrationState *s)
         info->xbzrle_cache->cache_miss_rate = xbzrle_counters.cache_miss_rate;
         info->xbzrle_cache->encoding_rate = xbzrle_counters.encoding_rate;
         info->xbzrle_cache->overflow = xbzrle_counters.overflow;
+        info->xbzrle_cache->cache_hit = xbzrle_counters.cache_hit;
+        info->xbzrle_cache->cache_eviction = xbzrle_counters.cache_eviction;
+    }
+
+    if (migrate_multifd()) {
+        info->multifd_channels = multifd_send_query_stats();
     }
 
     if (cpu_throttle_active()) {
@@ -1343,6 +1359,10 @@ static void fill_destination_migration_info(MigrationInfo *info)
     }
     info->status = mis->state;
 
+    if (migrate_multifd()) {
+        info->multifd_recv_channels = multifd_recv_query_stats();
+    }
+
     if (!info->error_desc) {
         MigrationState *s = migrate_get_current();
         QEMU_LOCK_GUARD(&s->error_mutex);
@@ -1441,6 +1461,8 @@ static void migrate_fd_cleanup(MigrationState *s)
                           MIGRATION_STATUS_CANCELLED);
     }
 
+    migration_convergence_cleanup();
+
     if (s->error) {
         /* It is used on info migrate.  We can't free it */
         error_report_err(error_copy(s->error));
@@ -3212,6 +3234,12 @@ static void migration_update_counters(MigrationState *s,
 
     update_iteration_initial_status(s);
 
+    multifd_send_tune_channels(current_time);
+
+    if (migrate_convergence_control()) {
+        migration_convergence_update(current_time);
+    }
+
     trace_migrate_transferred(transferred, time_spent,
                               /* Both in unit bytes/ms */
                               bandwidth, switchover_bw / 1000,
@@ -3764,6 +3792,9 @@ void migrate_fd_connect(MigrationState *s, Error *error_in)
     } else {
         /* This is a fresh new migration */
         rate_limit = migrate_max_bandwidth();
+        if (migrate_convergence_control()) {
+            migration_convergence_start();
+        }
 
         /* Notify before starting migration thread */
         if (migration_call_notifiers(s, MIG_EVENT_PRECOPY_SETUP, &local_err)) {
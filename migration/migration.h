@@ -104,6 +104,17 @@ struct MigrationIncomingState {
     bool           have_listen_thread;
     QemuThread     listen_thread;
 
+    /*
+     * Set while RAM is loaded lazily from a mapped-ram file, see
+     * postcopy_lazy_load_setup().  The fault thread then reads the
+     * faulting pages from the file instead of asking the source.
+     */
+    bool           lazy_load;
+    bool           have_lazy_load_thread;
+    QemuThread     lazy_load_thread;
+    /* Set this when we want the lazy load thread to quit */
+    bool           lazy_load_quit;
+
     /* For the kernel to send us notifications */
     int       userfault_fd;
     /* To notify the fault_thread to wake, e.g., when need to quit */
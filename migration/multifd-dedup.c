@@ -0,0 +1,331 @@
+/*
+ * Multifd content deduplication
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "crypto/hash.h"
+#include "exec/ramblock.h"
+#include "qapi/error.h"
+#include "migration.h"
+#include "multifd.h"
+#include "options.h"
+#include "ram.h"
+
+/*
+ * Each channel keeps a cache of the last MULTIFD_DEDUP_CACHE_PAGES
+ * normal pages it has sent.  The source only remembers their SHA-256
+ * digest, the destination keeps a copy of the page contents.  Both sides
+ * fill the cache in the same round-robin order, one slot per normal page,
+ * so the source can send a page that is already cached as the index of
+ * its slot and the destination copies it from there.
+ *
+ * Pages are looked up against the cache as it was when the packet
+ * started, and the normal pages of a packet are only added to it after
+ * the lookups: the destination resolves references before it reads the
+ * new pages.
+ *
+ * Each page is copied once before it is hashed, and the copy is what gets
+ * sent.  Otherwise the guest could change the page between the two, and
+ * the destination would cache contents that do not match the digest.
+ *
+ * Keeping the contents on the destination, instead of pointing at a guest
+ * page that was sent earlier, means that a page being rewritten by another
+ * channel can never change what a reference resolves to.
+ */
+#define MULTIFD_DEDUP_CACHE_PAGES 2048
+#define MULTIFD_DEDUP_DIGEST_LEN  32
+
+typedef struct {
+    /* digest of the page held in each slot */
+    uint8_t (*slot_digest)[MULTIFD_DEDUP_DIGEST_LEN];
+    /* whether each slot holds a page yet */
+    bool *slot_used;
+    /* digest -> slot; keys point into slot_digest */
+    GHashTable *table;
+    /* next slot to fill */
+    uint32_t next;
+    /* digests of the normal pages of the current packet */
+    uint8_t (*digests)[MULTIFD_DEDUP_DIGEST_LEN];
+    /* copy of the normal pages of the current packet, as hashed */
+    uint8_t *buf;
+    /* offsets of the duplicate pages of the current packet */
+    ram_addr_t *dup_offset;
+    /* be32 slot reference for each duplicate page */
+    uint32_t *refs;
+} MultiFDDedupSend;
+
+typedef struct {
+    /* page contents, one page per slot */
+    uint8_t *cache;
+    /* next slot to fill */
+    uint32_t next;
+    /* slot reference for each duplicate page */
+    uint32_t *refs;
+} MultiFDDedupRecv;
+
+static guint dedup_digest_hash(gconstpointer key)
+{
+    return ldl_he_p(key);
+}
+
+static gboolean dedup_digest_equal(gconstpointer a, gconstpointer b)
+{
+    return memcmp(a, b, MULTIFD_DEDUP_DIGEST_LEN) == 0;
+}
+
+int multifd_send_dedup_setup(MultiFDSendParams *p, Error **errp)
+{
+    MultiFDDedupSend *d;
+
+    if (!migrate_multifd_dedup()) {
+        return 0;
+    }
+
+    if (!qcrypto_hash_supports(QCRYPTO_HASH_ALG_SHA256)) {
+        error_setg(errp, "multifd %u: dedup requires SHA-256 support", p->id);
+        return -1;
+    }
+    assert(qcrypto_hash_digest_len(QCRYPTO_HASH_ALG_SHA256) ==
+           MULTIFD_DEDUP_DIGEST_LEN);
+
+    d = g_new0(MultiFDDedupSend, 1);
+    d->buf = g_try_malloc((size_t)p->page_count * p->page_size);
+    if (!d->buf) {
+        g_free(d);
+        error_setg(errp, "multifd %u: out of memory for dedup buffer", p->id);
+        return -1;
+    }
+    d->slot_digest = g_new0(uint8_t[MULTIFD_DEDUP_DIGEST_LEN],
+                            MULTIFD_DEDUP_CACHE_PAGES);
+    d->slot_used = g_new0(bool, MULTIFD_DEDUP_CACHE_PAGES);
+    d->table = g_hash_table_new(dedup_digest_hash, dedup_digest_equal);
+    d->digests = g_new0(uint8_t[MULTIFD_DEDUP_DIGEST_LEN], p->page_count);
+    d->dup_offset = g_new0(ram_addr_t, p->page_count);
+    d->refs = g_new0(uint32_t, p->page_count);
+    p->dedup_data = d;
+    return 0;
+}
+
+void multifd_send_dedup_cleanup(MultiFDSendParams *p)
+{
+    MultiFDDedupSend *d = p->dedup_data;
+
+    if (!d) {
+        return;
+    }
+
+    g_hash_table_destroy(d->table);
+    g_free(d->slot_digest);
+    g_free(d->slot_used);
+    g_free(d->digests);
+    g_free(d->buf);
+    g_free(d->dup_offset);
+    g_free(d->refs);
+    g_free(d);
+    p->dedup_data = NULL;
+}
+
+static void dedup_send_insert(MultiFDDedupSend *d, const uint8_t *digest)
+{
+    uint32_t slot = d->next;
+    uint8_t *key = d->slot_digest[slot];
+    gpointer owner;
+
+    d->next = (slot + 1) % MULTIFD_DEDUP_CACHE_PAGES;
+
+    /* Forget the evicted page, unless a newer slot holds the same data */
+    if (d->slot_used[slot] &&
+        g_hash_table_lookup_extended(d->table, key, NULL, &owner) &&
+        GPOINTER_TO_UINT(owner) == slot) {
+        g_hash_table_remove(d->table, key);
+    }
+
+    memcpy(key, digest, MULTIFD_DEDUP_DIGEST_LEN);
+    d->slot_used[slot] = true;
+    g_hash_table_replace(d->table, key, GUINT_TO_POINTER(slot));
+}
+
+/**
+ * multifd_send_dedup_detect: find pages that the destination has cached
+ *
+ * Must be called after zero page detection.  Reorders the non-zero pages
+ * of p->pages so that normal pages come first, followed by the
+ * pages->dup_num duplicate pages, and adds the new normal pages to the
+ * cache.
+ *
+ * @p: Params for the channel that we are using
+ */
+void multifd_send_dedup_detect(MultiFDSendParams *p)
+{
+    MultiFDPages_t *pages = p->pages;
+    MultiFDDedupSend *d = p->dedup_data;
+    uint32_t normal_num = 0, dup_num = 0;
+    uint32_t i;
+
+    pages->dup_num = 0;
+    if (!d) {
+        return;
+    }
+
+    for (i = 0; i < pages->normal_num; i++) {
+        ram_addr_t offset = pages->offset[i];
+        uint8_t *page = d->buf + (size_t)normal_num * p->page_size;
+        uint8_t *digest = d->digests[normal_num];
+        size_t digest_len = MULTIFD_DEDUP_DIGEST_LEN;
+        gpointer slot;
+
+        memcpy(page, pages->block->host + offset, p->page_size);
+        qcrypto_hash_bytes(QCRYPTO_HASH_ALG_SHA256, (const char *)page,
+                           p->page_size, &digest, &digest_len,
+                           &error_abort);
+
+        if (g_hash_table_lookup_extended(d->table, digest, NULL, &slot)) {
+            d->dup_offset[dup_num] = offset;
+            d->refs[dup_num] = cpu_to_be32(GPOINTER_TO_UINT(slot));
+            dup_num++;
+        } else {
+            pages->offset[normal_num++] = offset;
+        }
+    }
+
+    memcpy(&pages->offset[normal_num], d->dup_offset,
+           dup_num * sizeof(ram_addr_t));
+    pages->normal_num = normal_num;
+    pages->dup_num = dup_num;
+
+    for (i = 0; i < normal_num; i++) {
+        dedup_send_insert(d, d->digests[i]);
+    }
+}
+
+/**
+ * multifd_send_dedup_prepare_iov: queue the references and the normal pages
+ *
+ * The duplicate page references are sent first, followed by the copies
+ * of the normal pages that multifd_send_dedup_detect() hashed.
+ *
+ * @p: Params for the channel that we are using
+ */
+void multifd_send_dedup_prepare_iov(MultiFDSendParams *p)
+{
+    MultiFDPages_t *pages = p->pages;
+    MultiFDDedupSend *d = p->dedup_data;
+
+    if (pages->dup_num) {
+        p->iov[p->iovs_num].iov_base = d->refs;
+        p->iov[p->iovs_num].iov_len = pages->dup_num * sizeof(uint32_t);
+        p->iovs_num++;
+    }
+
+    for (int i = 0; i < pages->normal_num; i++) {
+        p->iov[p->iovs_num].iov_base = d->buf + (size_t)i * p->page_size;
+        p->iov[p->iovs_num].iov_len = p->page_size;
+        p->iovs_num++;
+    }
+
+    p->next_packet_size = pages->normal_num * p->page_size +
+                          pages->dup_num * sizeof(uint32_t);
+}
+
+int multifd_recv_dedup_setup(MultiFDRecvParams *p, Error **errp)
+{
+    MultiFDDedupRecv *d;
+
+    if (!migrate_multifd_dedup()) {
+        return 0;
+    }
+
+    d = g_new0(MultiFDDedupRecv, 1);
+    d->cache = g_try_malloc((size_t)MULTIFD_DEDUP_CACHE_PAGES * p->page_size);
+    if (!d->cache) {
+        g_free(d);
+        error_setg(errp, "multifd %u: out of memory for dedup cache", p->id);
+        return -1;
+    }
+    d->refs = g_new0(uint32_t, p->page_count);
+    p->dedup_data = d;
+    return 0;
+}
+
+void multifd_recv_dedup_cleanup(MultiFDRecvParams *p)
+{
+    MultiFDDedupRecv *d = p->dedup_data;
+
+    if (!d) {
+        return;
+    }
+
+    g_free(d->cache);
+    g_free(d->refs);
+    g_free(d);
+    p->dedup_data = NULL;
+}
+
+/**
+ * multifd_recv_dedup_process: read the references and fill duplicate pages
+ *
+ * Must be called before the normal pages of the packet are read.
+ *
+ * Returns 0 for success or -1 for error
+ *
+ * @p: Params for the channel that we are using
+ * @errp: pointer to an error
+ */
+int multifd_recv_dedup_process(MultiFDRecvParams *p, Error **errp)
+{
+    MultiFDDedupRecv *d = p->dedup_data;
+    int ret;
+
+    if (!p->dup_num) {
+        return 0;
+    }
+
+    if (!d) {
+        error_setg(errp, "multifd %u: received %u duplicate pages without "
+                   "dedup enabled", p->id, p->dup_num);
+        return -1;
+    }
+
+    ret = qio_channel_read_all(p->c, (void *)d->refs,
+                               p->dup_num * sizeof(uint32_t), errp);
+    if (ret != 0) {
+        return ret;
+    }
+
+    for (int i = 0; i < p->dup_num; i++) {
+        uint32_t slot = be32_to_cpu(d->refs[i]);
+
+        if (slot >= MULTIFD_DEDUP_CACHE_PAGES) {
+            error_setg(errp, "multifd %u: invalid dedup slot %u",
+                       p->id, slot);
+            return -1;
+        }
+        memcpy(p->host + p->dup[i], d->cache + (size_t)slot * p->page_size,
+               p->page_size);
+        ramblock_recv_bitmap_set_offset(p->block, p->dup[i]);
+    }
+    return 0;
+}
+
+/**
+ * multifd_recv_dedup_update: add the normal pages just read to the cache
+ *
+ * @p: Params for the channel that we are using
+ */
+void multifd_recv_dedup_update(MultiFDRecvParams *p)
+{
+    MultiFDDedupRecv *d = p->dedup_data;
+
+    if (!d) {
+        return;
+    }
+
+    for (int i = 0; i < p->normal_num; i++) {
+        memcpy(d->cache + (size_t)d->next * p->page_size,
+               p->host + p->normal[i], p->page_size);
+        d->next = (d->next + 1) % MULTIFD_DEDUP_CACHE_PAGES;
+    }
+}
@@ -0,0 +1,326 @@
+/*
+ * Multifd lz4 compression implementation
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include <lz4.h>
+#include "qemu/rcu.h"
+#include "exec/ramblock.h"
+#include "exec/target_page.h"
+#include "qapi/error.h"
+#include "migration.h"
+#include "trace.h"
+#include "options.h"
+#include "multifd.h"
+
+/*
+ * Packet payload layout:
+ *
+ *   be32 size[normal_num]
+ *   page data, one entry per normal page
+ *
+ * A size equal to the page size means that the page is stored
+ * uncompressed; anything smaller is an lz4 block.  Pages are sent
+ * uncompressed whenever lz4 does not make them smaller, so incompressible
+ * memory costs at most the size table.
+ */
+
+/*
+ * If a batch saves less than 1/LZ4_MIN_SAVING_RATIO of its size, skip
+ * compression for the next LZ4_RAW_BATCHES batches and send the pages
+ * as they are, then try again.  This keeps channels that carry mostly
+ * incompressible memory from burning CPU for nothing.
+ */
+#define LZ4_MIN_SAVING_RATIO 8
+#define LZ4_RAW_BATCHES      16
+
+struct lz4_data {
+    /* compressed pages (send) or received payload (recv) */
+    uint8_t *zbuff;
+    /* size of zbuff */
+    uint32_t zbuff_len;
+    /* per page size table */
+    uint32_t *sizes;
+    /* number of upcoming batches to send uncompressed */
+    uint32_t raw_batches;
+};
+
+/* Multifd lz4 compression */
+
+/**
+ * lz4_send_setup: setup send side
+ *
+ * Returns 0 for success or -1 for error
+ *
+ * @p: Params for the channel that we are using
+ * @errp: pointer to an error
+ */
+static int lz4_send_setup(MultiFDSendParams *p, Error **errp)
+{
+    struct lz4_data *z = g_new0(struct lz4_data, 1);
+
+    z->zbuff_len = p->page_count * LZ4_compressBound(p->page_size);
+    z->zbuff = g_try_malloc(z->zbuff_len);
+    if (!z->zbuff) {
+        g_free(z);
+        error_setg(errp, "multifd %u: out of memory for zbuff", p->id);
+        return -1;
+    }
+    z->sizes = g_new0(uint32_t, p->page_count);
+    p->compress_data = z;
+
+    /* Packet header, size table and one IOV per page */
+    p->iov = g_new0(struct iovec, p->page_count + 2);
+    return 0;
+}
+
+/**
+ * lz4_send_cleanup: cleanup send side
+ *
+ * @p: Params for the channel that we are using
+ * @errp: pointer to an error
+ */
+static void lz4_send_cleanup(MultiFDSendParams *p, Error **errp)
+{
+    struct lz4_data *z = p->compress_data;
+
+    g_free(z->zbuff);
+    g_free(z->sizes);
+    g_free(p->compress_data);
+    p->compress_data = NULL;
+
+    g_free(p->iov);
+    p->iov = NULL;
+}
+
+/**
+ * lz4_send_prepare: prepare data to be able to send
+ *
+ * Compress each normal page on its own, falling back to the raw page
+ * when that does not save space.
+ *
+ * Returns 0 for success or -1 for error
+ *
+ * @p: Params for the channel that we are using
+ * @errp: pointer to an error
+ */
+static int lz4_send_prepare(MultiFDSendParams *p, Error **errp)
+{
+    MultiFDPages_t *pages = p->pages;
+    struct lz4_data *z = p->compress_data;
+    uint32_t raw_size, out_size, pos = 0;
+    bool compress;
+    uint32_t i;
+
+    if (!multifd_send_prepare_common(p)) {
+        goto out;
+    }
+
+    compress = z->raw_batches == 0;
+    if (!compress) {
+        z->raw_batches--;
+    }
+
+    p->iov[p->iovs_num].iov_base = z->sizes;
+    p->iov[p->iovs_num].iov_len = pages->normal_num * sizeof(uint32_t);
+    p->iovs_num++;
+
+    raw_size = pages->normal_num * p->page_size;
+    out_size = 0;
+
+    for (i = 0; i < pages->normal_num; i++) {
+        void *page = pages->block->host + pages->offset[i];
+        struct iovec *iov = &p->iov[p->iovs_num++];
+        int ret = 0;
+
+        if (compress) {
+            ret = LZ4_compress_default(page, (char *)z->zbuff + pos,
+                                       p->page_size, z->zbuff_len - pos);
+        }
+        if (ret > 0 && ret < p->page_size) {
+            iov->iov_base = z->zbuff + pos;
+            iov->iov_len = ret;
+            pos += ret;
+        } else {
+            iov->iov_base = page;
+            iov->iov_len = p->page_size;
+        }
+        z->sizes[i] = cpu_to_be32(iov->iov_len);
+        out_size += iov->iov_len;
+    }
+
+    if (compress &&
+        raw_size - out_size < raw_size / LZ4_MIN_SAVING_RATIO) {
+        z->raw_batches = LZ4_RAW_BATCHES;
+    }
+
+    p->next_packet_size = pages->normal_num * sizeof(uint32_t) + out_size;
+
+out:
+    p->flags |= MULTIFD_FLAG_LZ4;
+    multifd_send_fill_packet(p);
+    return 0;
+}
+
+/**
+ * lz4_recv_setup: setup receive side
+ *
+ * Returns 0 for success or -1 for error
+ *
+ * @p: Params for the channel that we are using
+ * @errp: pointer to an error
+ */
+static int lz4_recv_setup(MultiFDRecvParams *p, Error **errp)
+{
+    struct lz4_data *z = g_new0(struct lz4_data, 1);
+
+    /* No page is ever sent larger than the page itself */
+    z->zbuff_len = p->page_count * p->page_size;
+    z->zbuff = g_try_malloc(z->zbuff_len);
+    if (!z->zbuff) {
+        g_free(z);
+        error_setg(errp, "multifd %u: out of memory for zbuff", p->id);
+        return -1;
+    }
+    z->sizes = g_new0(uint32_t, p->page_count);
+    p->compress_data = z;
+    p->iov = g_new0(struct iovec, p->page_count);
+    return 0;
+}
+
+/**
+ * lz4_recv_cleanup: cleanup receive side
+ *
+ * @p: Params for the channel that we are using
+ */
+static void lz4_recv_cleanup(MultiFDRecvParams *p)
+{
+    struct lz4_data *z = p->compress_data;
+
+    g_free(z->zbuff);
+    g_free(z->sizes);
+    g_free(p->compress_data);
+    p->compress_data = NULL;
+
+    g_free(p->iov);
+    p->iov = NULL;
+}
+
+/**
+ * lz4_recv: read the data from the channel into actual pages
+ *
+ * Pages sent uncompressed are read straight into guest memory when the
+ * whole batch is uncompressed; otherwise the payload is read in one go
+ * and then each page is decompressed or copied into place.
+ *
+ * Returns 0 for success or -1 for error
+ *
+ * @p: Params for the channel that we are using
+ * @errp: pointer to an error
+ */
+static int lz4_recv(MultiFDRecvParams *p, Error **errp)
+{
+    struct lz4_data *z = p->compress_data;
+    uint32_t in_size = p->next_packet_size;
+    uint32_t flags = p->flags & MULTIFD_FLAG_COMPRESSION_MASK;
+    uint32_t table_size = p->normal_num * sizeof(uint32_t);
+    uint32_t data_size = 0, pos = 0;
+    bool all_raw = true;
+    int ret;
+    int i;
+
+    if (flags != MULTIFD_FLAG_LZ4) {
+        error_setg(errp, "multifd %u: flags received %x flags expected %x",
+                   p->id, flags, MULTIFD_FLAG_LZ4);
+        return -1;
+    }
+
+    multifd_recv_zero_page_process(p);
+
+    if (!p->normal_num) {
+        assert(in_size == 0);
+        return 0;
+    }
+
+    if (in_size < table_size) {
+        error_setg(errp, "multifd %u: packet size %u too small for %u pages",
+                   p->id, in_size, p->normal_num);
+        return -1;
+    }
+
+    ret = qio_channel_read_all(p->c, (void *)z->sizes, table_size, errp);
+    if (ret != 0) {
+        return ret;
+    }
+
+    for (i = 0; i < p->normal_num; i++) {
+        z->sizes[i] = be32_to_cpu(z->sizes[i]);
+        if (z->sizes[i] == 0 || z->sizes[i] > p->page_size) {
+            error_setg(errp, "multifd %u: invalid page size %u",
+                       p->id, z->sizes[i]);
+            return -1;
+        }
+        all_raw &= z->sizes[i] == p->page_size;
+        data_size += z->sizes[i];
+    }
+
+    if (data_size != in_size - table_size) {
+        error_setg(errp, "multifd %u: packet size received %u size expected %u",
+                   p->id, in_size - table_size, data_size);
+        return -1;
+    }
+
+    if (all_raw) {
+        for (i = 0; i < p->normal_num; i++) {
+            ramblock_recv_bitmap_set_offset(p->block, p->normal[i]);
+            p->iov[i].iov_base = p->host + p->normal[i];
+            p->iov[i].iov_len = p->page_size;
+        }
+        return qio_channel_readv_full_all(p->c, p->iov, p->normal_num,
+                                          NULL, NULL,
+                                          QIO_CHANNEL_READ_FLAG_WAITALL, errp);
+    }
+
+    ret = qio_channel_read_all(p->c, (void *)z->zbuff, data_size, errp);
+    if (ret != 0) {
+        return ret;
+    }
+
+    for (i = 0; i < p->normal_num; i++) {
+        void *page = p->host + p->normal[i];
+
+        ramblock_recv_bitmap_set_offset(p->block, p->normal[i]);
+        if (z->sizes[i] == p->page_size) {
+            memcpy(page, z->zbuff + pos, p->page_size);
+        } else {
+            ret = LZ4_decompress_safe((const char *)z->zbuff + pos, page,
+                                      z->sizes[i], p->page_size);
+            if (ret != p->page_size) {
+                error_setg(errp, "multifd %u: lz4 decompression failed (%d)",
+                           p->id, ret);
+                return -1;
+            }
+        }
+        pos += z->sizes[i];
+    }
+    return 0;
+}
+
+static MultiFDMethods multifd_lz4_ops = {
+    .send_setup = lz4_send_setup,
+    .send_cleanup = lz4_send_cleanup,
+    .send_prepare = lz4_send_prepare,
+    .recv_setup = lz4_recv_setup,
+    .recv_cleanup = lz4_recv_cleanup,
+    .recv = lz4_recv
+};
+
+static void multifd_lz4_register(void)
+{
+    multifd_register_ops(MULTIFD_COMPRESSION_LZ4, &multifd_lz4_ops);
+}
+
+migration_init(multifd_lz4_register);
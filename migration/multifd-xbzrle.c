@@ -0,0 +1,453 @@
+/*
+ * Multifd XBZRLE delta encoding implementation
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/host-utils.h"
+#include "qemu/rcu.h"
+#include "exec/ramblock.h"
+#include "exec/target_page.h"
+#include "qapi/error.h"
+#include "migration.h"
+#include "trace.h"
+#include "options.h"
+#include "multifd.h"
+#include "page_cache.h"
+#include "xbzrle.h"
+
+/*
+ * Packet payload layout:
+ *
+ *   be64 cache_size
+ *   be32 desc[normal_num]
+ *   page data, one entry per normal page
+ *
+ * cache_size is the size of the page cache of the sending channel.  The
+ * destination checks it against its own, because mirrored caches of
+ * different sizes would evict different pages and deltas would be
+ * applied to the wrong data.
+ *
+ * Every channel keeps its own page cache of xbzrle-cache-size divided by
+ * the number of channels, so channels never contend on it.  The
+ * destination mirrors the cache of each channel: both sides perform the
+ * same cache operations in the same order, with the age of an entry
+ * counted in packets of the channel.  Because a delta is applied to the
+ * mirrored copy rather than to guest memory, it does not matter which
+ * channel carried the previous version of a page.
+ *
+ * A descriptor holds the size of the entry in its low bits, plus:
+ *
+ *   XBZRLE_DESC_DELTA: the entry is an XBZRLE delta against the cached
+ *       copy of the page, possibly empty
+ *   XBZRLE_DESC_CACHE: the entry is the whole page, and must be stored
+ *       in the cache
+ *
+ * An entry with neither flag is the whole page, not cached.
+ */
+#define XBZRLE_DESC_DELTA     (1u << 31)
+#define XBZRLE_DESC_CACHE     (1u << 30)
+#define XBZRLE_DESC_SIZE_MASK (XBZRLE_DESC_CACHE - 1)
+
+struct xbzrle_data {
+    /* per-channel page cache */
+    PageCache *cache;
+    /* its size, and the same big-endian as sent in each packet */
+    uint64_t cache_size;
+    uint64_t cache_size_be;
+    /* packets handled so far, used as the age of cache entries */
+    uint64_t age;
+    /* stable copies of the pages of a packet (send) or payload (recv) */
+    uint8_t *buf;
+    /* encoded deltas */
+    uint8_t *zbuff;
+    /* per page descriptor table */
+    uint32_t *desc;
+};
+
+static uint64_t xbzrle_cache_size(uint32_t page_size)
+{
+    uint64_t size = migrate_xbzrle_cache_size() / migrate_multifd_channels();
+
+    return MAX(pow2floor(size), page_size);
+}
+
+/*
+ * The cache is keyed by the page offset mixed with a hash of the
+ * RAMBlock name, which both sides agree on.  Two pages sharing a key
+ * only cost a cache miss, since the mirrored caches stay identical.
+ */
+static uint64_t xbzrle_block_key(RAMBlock *block)
+{
+    return (uint64_t)g_str_hash(block->idstr) << 32;
+}
+
+static struct xbzrle_data *xbzrle_data_new(uint8_t id, uint32_t page_size,
+                                           uint32_t page_count, bool send,
+                                           Error **errp)
+{
+    struct xbzrle_data *z;
+
+    /* Run lengths are encoded in at most two uleb128 bytes */
+    if (page_size > 0x3fff) {
+        error_setg(errp, "multifd %u: xbzrle does not support %u byte pages",
+                   id, page_size);
+        return NULL;
+    }
+
+    z = g_new0(struct xbzrle_data, 1);
+    z->cache_size = xbzrle_cache_size(page_size);
+    z->cache_size_be = cpu_to_be64(z->cache_size);
+    z->cache = cache_init(z->cache_size, page_size, errp);
+    if (!z->cache) {
+        g_free(z);
+        return NULL;
+    }
+
+    z->buf = g_try_malloc((size_t)page_count * page_size);
+    if (send) {
+        z->zbuff = g_try_malloc((size_t)page_count * page_size);
+    }
+    if (!z->buf || (send && !z->zbuff)) {
+        error_setg(errp, "multifd %u: out of memory for xbzrle buffers", id);
+        cache_fini(z->cache);
+        g_free(z->buf);
+        g_free(z->zbuff);
+        g_free(z);
+        return NULL;
+    }
+    z->desc = g_new0(uint32_t, page_count);
+    return z;
+}
+
+static void xbzrle_data_free(struct xbzrle_data *z)
+{
+    cache_fini(z->cache);
+    g_free(z->buf);
+    g_free(z->zbuff);
+    g_free(z->desc);
+    g_free(z);
+}
+
+/**
+ * xbzrle_send_setup: setup send side
+ *
+ * Returns 0 for success or -1 for error
+ *
+ * @p: Params for the channel that we are using
+ * @errp: pointer to an error
+ */
+static int xbzrle_send_setup(MultiFDSendParams *p, Error **errp)
+{
+    struct xbzrle_data *z = xbzrle_data_new(p->id, p->page_size,
+                                            p->page_count, true, errp);
+
+    if (!z) {
+        return -1;
+    }
+    p->compress_data = z;
+
+    /* Packet header, cache size, descriptor table and one IOV per page */
+    p->iov = g_new0(struct iovec, p->page_count + 3);
+    return 0;
+}
+
+/**
+ * xbzrle_send_cleanup: cleanup send side
+ *
+ * @p: Params for the channel that we are using
+ * @errp: pointer to an error
+ */
+static void xbzrle_send_cleanup(MultiFDSendParams *p, Error **errp)
+{
+    xbzrle_data_free(p->compress_data);
+    p->compress_data = NULL;
+
+    g_free(p->iov);
+    p->iov = NULL;
+}
+
+/**
+ * xbzrle_send_prepare: prepare data to be able to send
+ *
+ * Each normal page is copied first, so that the delta, the cache and
+ * the data sent all agree even while the guest keeps writing to it.
+ * Pages found in the cache are sent as a delta when it is smaller than
+ * the page.
+ *
+ * Returns 0 for success or -1 for error
+ *
+ * @p: Params for the channel that we are using
+ * @errp: pointer to an error
+ */
+static int xbzrle_send_prepare(MultiFDSendParams *p, Error **errp)
+{
+    MultiFDPages_t *pages = p->pages;
+    struct xbzrle_data *z = p->compress_data;
+    uint64_t key_base = xbzrle_block_key(pages->block);
+    uint32_t pos = 0, out_size = 0;
+    uint32_t i;
+
+    if (!multifd_send_prepare_common(p)) {
+        goto out;
+    }
+
+    z->age++;
+
+    p->iov[p->iovs_num].iov_base = &z->cache_size_be;
+    p->iov[p->iovs_num].iov_len = sizeof(z->cache_size_be);
+    p->iovs_num++;
+
+    p->iov[p->iovs_num].iov_base = z->desc;
+    p->iov[p->iovs_num].iov_len = pages->normal_num * sizeof(uint32_t);
+    p->iovs_num++;
+
+    for (i = 0; i < pages->normal_num; i++) {
+        uint64_t key = key_base ^ pages->offset[i];
+        uint8_t *page = z->buf + (size_t)i * p->page_size;
+        struct iovec *iov = &p->iov[p->iovs_num++];
+        uint32_t desc = 0;
+
+        memcpy(page, pages->block->host + pages->offset[i], p->page_size);
+
+        if (cache_is_cached(z->cache, key, z->age)) {
+            uint8_t *old = get_cached_data(z->cache, key);
+            int len = xbzrle_encode_buffer(old, page, p->page_size,
+                                           z->zbuff + pos, p->page_size);
+
+            if (len >= 0 && len < p->page_size) {
+                iov->iov_base = z->zbuff + pos;
+                iov->iov_len = len;
+                desc = XBZRLE_DESC_DELTA;
+                pos += len;
+            } else {
+                iov->iov_base = page;
+                iov->iov_len = p->page_size;
+                desc = XBZRLE_DESC_CACHE;
+            }
+            memcpy(old, page, p->page_size);
+        } else {
+            iov->iov_base = page;
+            iov->iov_len = p->page_size;
+            if (cache_insert(z->cache, key, page, z->age) == 0) {
+                desc = XBZRLE_DESC_CACHE;
+            }
+        }
+
+        z->desc[i] = cpu_to_be32(desc | iov->iov_len);
+        out_size += iov->iov_len;
+    }
+
+    p->next_packet_size = sizeof(z->cache_size_be) +
+                          pages->normal_num * sizeof(uint32_t) + out_size;
+
+out:
+    p->flags |= MULTIFD_FLAG_XBZRLE;
+    multifd_send_fill_packet(p);
+    return 0;
+}
+
+/**
+ * xbzrle_recv_setup: setup receive side
+ *
+ * Returns 0 for success or -1 for error
+ *
+ * @p: Params for the channel that we are using
+ * @errp: pointer to an error
+ */
+static int xbzrle_recv_setup(MultiFDRecvParams *p, Error **errp)
+{
+    struct xbzrle_data *z = xbzrle_data_new(p->id, p->page_size,
+                                            p->page_count, false, errp);
+
+    if (!z) {
+        return -1;
+    }
+    p->compress_data = z;
+    return 0;
+}
+
+/**
+ * xbzrle_recv_cleanup: cleanup receive side
+ *
+ * @p: Params for the channel that we are using
+ */
+static void xbzrle_recv_cleanup(MultiFDRecvParams *p)
+{
+    xbzrle_data_free(p->compress_data);
+    p->compress_data = NULL;
+}
+
+/**
+ * xbzrle_recv: read the data from the channel into actual pages
+ *
+ * Replays the cache operations of the source: whole pages are copied
+ * to guest memory and, when asked to, into the cache; deltas are
+ * applied to the cached copy, which is then copied to guest memory.
+ *
+ * Returns 0 for success or -1 for error
+ *
+ * @p: Params for the channel that we are using
+ * @errp: pointer to an error
+ */
+static int xbzrle_recv(MultiFDRecvParams *p, Error **errp)
+{
+    struct xbzrle_data *z = p->compress_data;
+    uint32_t in_size = p->next_packet_size;
+    uint32_t flags = p->flags & MULTIFD_FLAG_COMPRESSION_MASK;
+    uint32_t table_size = p->normal_num * sizeof(uint32_t);
+    uint64_t key_base, cache_size;
+    uint32_t data_size = 0, pos = 0;
+    int ret;
+    int i;
+
+    if (flags != MULTIFD_FLAG_XBZRLE) {
+        error_setg(errp, "multifd %u: flags received %x flags expected %x",
+                   p->id, flags, MULTIFD_FLAG_XBZRLE);
+        return -1;
+    }
+
+    multifd_recv_zero_page_process(p);
+
+    if (!p->normal_num) {
+        assert(in_size == 0);
+        return 0;
+    }
+
+    z->age++;
+    key_base = xbzrle_block_key(p->block);
+
+    if (in_size < sizeof(cache_size) + table_size) {
+        error_setg(errp, "multifd %u: packet size %u too small for %u pages",
+                   p->id, in_size, p->normal_num);
+        return -1;
+    }
+    in_size -= sizeof(cache_size);
+
+    ret = qio_channel_read_all(p->c, (void *)&cache_size, sizeof(cache_size),
+                               errp);
+    if (ret != 0) {
+        return ret;
+    }
+    cache_size = be64_to_cpu(cache_size);
+    if (cache_size != z->cache_size) {
+        error_setg(errp, "multifd %u: xbzrle cache size %" PRIu64 " differs "
+                   "from the source's %" PRIu64 ", xbzrle-cache-size and "
+                   "multifd-channels must match", p->id, z->cache_size,
+                   cache_size);
+        return -1;
+    }
+
+    ret = qio_channel_read_all(p->c, (void *)z->desc, table_size, errp);
+    if (ret != 0) {
+        return ret;
+    }
+
+    for (i = 0; i < p->normal_num; i++) {
+        uint32_t desc = be32_to_cpu(z->desc[i]);
+        uint32_t size = desc & XBZRLE_DESC_SIZE_MASK;
+
+        if ((desc & XBZRLE_DESC_DELTA) ? size >= p->page_size
+                                       : size != p->page_size) {
+            error_setg(errp, "multifd %u: invalid xbzrle descriptor %x",
+                       p->id, desc);
+            return -1;
+        }
+        z->desc[i] = desc;
+        data_size += size;
+    }
+
+    if (data_size != in_size - table_size) {
+        error_setg(errp, "multifd %u: packet size received %u size expected %u",
+                   p->id, in_size - table_size, data_size);
+        return -1;
+    }
+
+    ret = qio_channel_read_all(p->c, (void *)z->buf, data_size, errp);
+    if (ret != 0) {
+        return ret;
+    }
+
+    for (i = 0; i < p->normal_num; i++) {
+        uint64_t key = key_base ^ p->normal[i];
+        uint32_t size = z->desc[i] & XBZRLE_DESC_SIZE_MASK;
+        uint8_t *page = p->host + p->normal[i];
+        uint8_t *data = z->buf + pos;
+
+        ramblock_recv_bitmap_set_offset(p->block, p->normal[i]);
+        pos += size;
+
+        if (z->desc[i] & XBZRLE_DESC_DELTA) {
+            uint8_t *cached;
+
+            if (!cache_is_cached(z->cache, key, z->age)) {
+                error_setg(errp, "multifd %u: xbzrle delta for uncached page "
+                           "%s:0x" RAM_ADDR_FMT, p->id, p->block->idstr,
+                           p->normal[i]);
+                return -1;
+            }
+            cached = get_cached_data(z->cache, key);
+            if (size && xbzrle_decode_buffer(data, size, cached,
+                                             p->page_size) < 0) {
+                error_setg(errp, "multifd %u: xbzrle decode failed for "
+                           "%s:0x" RAM_ADDR_FMT, p->id, p->block->idstr,
+                           p->normal[i]);
+                return -1;
+            }
+            memcpy(page, cached, p->page_size);
+            continue;
+        }
+
+        memcpy(page, data, p->page_size);
+        if (z->desc[i] & XBZRLE_DESC_CACHE) {
+            if (cache_is_cached(z->cache, key, z->age)) {
+                memcpy(get_cached_data(z->cache, key), data, p->page_size);
+            } else {
+                /* A failure shows up as a delta for an uncached page */
+                cache_insert(z->cache, key, data, z->age);
+            }
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * xbzrle_send_query_stats: report the page cache statistics
+ *
+ * @p: Params for the channel that we are using
+ * @stats: statistics of the channel
+ */
+static void xbzrle_send_query_stats(MultiFDSendParams *p,
+                                    MultiFDChannelStats *stats)
+{
+    struct xbzrle_data *z = p->compress_data;
+    PageCacheStats cache_stats;
+
+    cache_get_stats(z->cache, &cache_stats);
+    stats->has_cache_hit = true;
+    stats->cache_hit = cache_stats.hits;
+    stats->has_cache_miss = true;
+    stats->cache_miss = cache_stats.misses;
+    stats->has_cache_eviction = true;
+    stats->cache_eviction = cache_stats.evictions;
+}
+
+static MultiFDMethods multifd_xbzrle_ops = {
+    .send_setup = xbzrle_send_setup,
+    .send_cleanup = xbzrle_send_cleanup,
+    .send_prepare = xbzrle_send_prepare,
+    .send_query_stats = xbzrle_send_query_stats,
+    .recv_setup = xbzrle_recv_setup,
+    .recv_cleanup = xbzrle_recv_cleanup,
+    .recv = xbzrle_recv
+};
+
+static void multifd_xbzrle_register(void)
+{
+    multifd_register_ops(MULTIFD_COMPRESSION_XBZRLE, &multifd_xbzrle_ops);
+}
+
+migration_init(multifd_xbzrle_register);
@@ -13,6 +13,7 @@
 #include "qemu/osdep.h"
 #include "qemu/cutils.h"
 #include "qemu/rcu.h"
+#include "qemu/timer.h"
 #include "exec/target_page.h"
 #include "sysemu/sysemu.h"
 #include "exec/ramblock.h"
@@ -79,6 +80,33 @@ struct {
     int exiting;
     /* multifd ops */
     MultiFDMethods *ops;
+    /*
+     * Adaptive channel count, only used by the migration thread.
+     *
+     * Rather than tying channels to being active or not, the migration
+     * thread keeps @held tokens of channels_ready to itself, so that at
+     * most migrate_multifd_channels() - @held channels can be busy.
+     * Tokens are not associated with a particular channel, so this
+     * needs no cooperation from the channel threads.
+     */
+    struct {
+        /* number of channels_ready tokens we want to hold */
+        int target_held;
+        /* number of channels_ready tokens actually held */
+        int held;
+        /* time spent waiting for a free channel in this interval */
+        int64_t wait_ns;
+        /* start of the current interval */
+        int64_t start_ms;
+        /* multifd bytes at the start of the current interval */
+        uint64_t start_bytes;
+        /* throughput of the previous interval, in bytes/ms */
+        uint64_t last_rate;
+        /* channel count change made at the start of this interval */
+        int last_step;
+        /* intervals left before probing again */
+        int hold_intervals;
+    } tune;
 } *multifd_send_state;
 
 struct {
@@ -91,6 +119,11 @@ struct {
      * uses it to wait for recv threads to finish assigned tasks.
      */
     QemuSemaphore sem_sync;
+    /*
+     * Without packets, this counts the channels that have no job
+     * assigned, so that multifd_recv() can sleep until one is free.
+     */
+    QemuSemaphore channels_ready;
     /* global number of generated multifd packets */
     uint64_t packet_num;
     int exiting;
@@ -138,13 +171,16 @@ static int nocomp_send_setup(MultiFDSendParams *p, Error **errp)
     }
 
     if (multifd_use_packets()) {
-        /* We need one extra place for the packet header */
-        p->iov = g_new0(struct iovec, p->page_count + 1);
+        /*
+         * We need one extra place for the packet header, and another
+         * one for the dedup references
+         */
+        p->iov = g_new0(struct iovec, p->page_count + 2);
     } else {
         p->iov = g_new0(struct iovec, p->page_count);
     }
 
-    return 0;
+    return multifd_send_dedup_setup(p, errp);
 }
 
 /**
@@ -157,6 +193,7 @@ static int nocomp_send_setup(MultiFDSendParams *p, Error **errp)
  */
 static void nocomp_send_cleanup(MultiFDSendParams *p, Error **errp)
 {
+    multifd_send_dedup_cleanup(p);
     g_free(p->iov);
     p->iov = NULL;
     return;
@@ -208,7 +245,12 @@ static int nocomp_send_prepare(MultiFDSendParams *p, Error **errp)
         multifd_send_prepare_header(p);
     }
 
-    multifd_send_prepare_iovs(p);
+    multifd_send_dedup_detect(p);
+    if (p->dedup_data) {
+        multifd_send_dedup_prepare_iov(p);
+    } else {
+        multifd_send_prepare_iovs(p);
+    }
     p->flags |= MULTIFD_FLAG_NOCOMP;
 
     multifd_send_fill_packet(p);
@@ -238,7 +280,7 @@ static int nocomp_send_prepare(MultiFDSendParams *p, Error **errp)
 static int nocomp_recv_setup(MultiFDRecvParams *p, Error **errp)
 {
     p->iov = g_new0(struct iovec, p->page_count);
-    return 0;
+    return multifd_recv_dedup_setup(p, errp);
 }
 
 /**
@@ -250,6 +292,7 @@ static int nocomp_recv_setup(MultiFDRecvParams *p, Error **errp)
  */
 static void nocomp_recv_cleanup(MultiFDRecvParams *p)
 {
+    multifd_recv_dedup_cleanup(p);
     g_free(p->iov);
     p->iov = NULL;
 }
@@ -282,6 +325,11 @@ static int nocomp_recv(MultiFDRecvParams *p, Error **errp)
 
     multifd_recv_zero_page_process(p);
 
+    /* Duplicates refer to the cache as it was before this packet */
+    if (multifd_recv_dedup_process(p, errp)) {
+        return -1;
+    }
+
     if (!p->normal_num) {
         return 0;
     }
@@ -291,7 +339,17 @@ static int nocomp_recv(MultiFDRecvParams *p, Error **errp)
         p->iov[i].iov_len = p->page_size;
         ramblock_recv_bitmap_set_offset(p->block, p->normal[i]);
     }
-    return qio_channel_readv_all(p->c, p->iov, p->normal_num, errp);
+    /*
+     * The pages go straight from the socket into guest memory; wait for
+     * all of them in the kernel rather than waking up for every segment.
+     */
+    if (qio_channel_readv_full_all(p->c, p->iov, p->normal_num, NULL, NULL,
+                                   QIO_CHANNEL_READ_FLAG_WAITALL, errp)) {
+        return -1;
+    }
+
+    multifd_recv_dedup_update(p);
+    return 0;
 }
 
 static MultiFDMethods multifd_nocomp_ops = {
@@ -322,6 +380,7 @@ static void multifd_pages_reset(MultiFDPages_t *pages)
      */
     pages->num = 0;
     pages->normal_num = 0;
+    pages->dup_num = 0;
     pages->block = NULL;
 }
 
@@ -413,12 +472,13 @@ void multifd_send_fill_packet(MultiFDSendParams *p)
     MultiFDPacket_t *packet = p->packet;
     MultiFDPages_t *pages = p->pages;
     uint64_t packet_num;
-    uint32_t zero_num = pages->num - pages->normal_num;
+    uint32_t zero_num = pages->num - pages->normal_num - pages->dup_num;
     int i;
 
     packet->flags = cpu_to_be32(p->flags);
     packet->pages_alloc = cpu_to_be32(p->pages->allocated);
     packet->normal_pages = cpu_to_be32(pages->normal_num);
+    packet->dup_pages = cpu_to_be32(pages->dup_num);
     packet->zero_pages = cpu_to_be32(zero_num);
     packet->next_packet_size = cpu_to_be32(p->next_packet_size);
 
@@ -487,11 +547,21 @@ static int multifd_recv_unfill_packet(MultiFDRecvParams *p, Error **errp)
         return -1;
     }
 
+    p->dup_num = be32_to_cpu(packet->dup_pages);
+    if (p->dup_num > packet->pages_alloc - p->normal_num) {
+        error_setg(errp, "multifd: received packet "
+                   "with %u duplicate pages and expected maximum duplicate "
+                   "pages are %u",
+                   p->dup_num, packet->pages_alloc - p->normal_num);
+        return -1;
+    }
+
     p->zero_num = be32_to_cpu(packet->zero_pages);
-    if (p->zero_num > packet->pages_alloc - p->normal_num) {
+    if (p->zero_num > packet->pages_alloc - p->normal_num - p->dup_num) {
         error_setg(errp, "multifd: received packet "
                    "with %u zero pages and expected maximum zero pages are %u",
-                   p->zero_num, packet->pages_alloc - p->normal_num) ;
+                   p->zero_num,
+                   packet->pages_alloc - p->normal_num - p->dup_num) ;
         return -1;
     }
 
@@ -504,7 +574,7 @@ static int multifd_recv_unfill_packet(MultiFDRecvParams *p, Error **errp)
     trace_multifd_recv(p->id, p->packet_num, p->normal_num, p->zero_num,
                        p->flags, p->next_packet_size);
 
-    if (p->normal_num == 0 && p->zero_num == 0) {
+    if (p->normal_num == 0 && p->dup_num == 0 && p->zero_num == 0) {
         return 0;
     }
 
@@ -530,9 +600,22 @@ static int multifd_recv_unfill_packet(MultiFDRecvParams *p, Error **errp)
         p->normal[i] = offset;
     }
 
-    for (i = 0; i < p->zero_num; i++) {
+    for (i = 0; i < p->dup_num; i++) {
         uint64_t offset = be64_to_cpu(packet->offset[p->normal_num + i]);
 
+        if (offset > (p->block->used_length - p->page_size)) {
+            error_setg(errp, "multifd: offset too long %" PRIu64
+                       " (max " RAM_ADDR_FMT ")",
+                       offset, p->block->used_length);
+            return -1;
+        }
+        p->dup[i] = offset;
+    }
+
+    for (i = 0; i < p->zero_num; i++) {
+        uint64_t offset = be64_to_cpu(packet->offset[p->normal_num +
+                                                     p->dup_num + i]);
+
         if (offset > (p->block->used_length - p->page_size)) {
             error_setg(errp, "multifd: offset too long %" PRIu64
                        " (max " RAM_ADDR_FMT ")",
@@ -597,8 +680,25 @@ static bool multifd_send_pages(void)
         return false;
     }
 
-    /* We wait here, until at least one channel is ready */
-    qemu_sem_wait(&multifd_send_state->channels_ready);
+    if (migrate_multifd_adaptive_channels()) {
+        int64_t wait_start;
+
+        /* Take back tokens from channels that went idle, without blocking */
+        while (multifd_send_state->tune.held <
+               multifd_send_state->tune.target_held &&
+               qemu_sem_timedwait(&multifd_send_state->channels_ready,
+                                  0) == 0) {
+            multifd_send_state->tune.held++;
+        }
+
+        wait_start = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+        qemu_sem_wait(&multifd_send_state->channels_ready);
+        multifd_send_state->tune.wait_ns +=
+            qemu_clock_get_ns(QEMU_CLOCK_REALTIME) - wait_start;
+    } else {
+        /* We wait here, until at least one channel is ready */
+        qemu_sem_wait(&multifd_send_state->channels_ready);
+    }
 
     /*
      * next_channel can remain from a previous migration that was
@@ -942,14 +1042,22 @@ static void *multifd_send_thread(void *opaque)
          */
         if (qatomic_load_acquire(&p->pending_job)) {
             MultiFDPages_t *pages = p->pages;
+            int64_t prepare_start;
 
             p->iovs_num = 0;
             assert(pages->num);
 
+            prepare_start = qemu_clock_get_us(QEMU_CLOCK_REALTIME);
             ret = multifd_send_state->ops->send_prepare(p, &local_err);
             if (ret != 0) {
                 break;
             }
+            stat64_add(&p->prepare_time_us,
+                       qemu_clock_get_us(QEMU_CLOCK_REALTIME) - prepare_start);
+            stat64_add(&p->prepare_bytes_in,
+                       (uint64_t)(pages->normal_num + pages->dup_num) *
+                       p->page_size);
+            stat64_add(&p->prepare_bytes_out, p->next_packet_size);
 
             if (migrate_mapped_ram()) {
                 ret = file_write_ramblock_iov(p->c, p->iov, p->iovs_num,
@@ -967,7 +1075,9 @@ static void *multifd_send_thread(void *opaque)
             stat64_add(&mig_stats.multifd_bytes,
                        p->next_packet_size + p->packet_len);
             stat64_add(&mig_stats.normal_pages, pages->normal_num);
-            stat64_add(&mig_stats.zero_pages, pages->num - pages->normal_num);
+            stat64_add(&mig_stats.dedup_pages, pages->dup_num);
+            stat64_add(&mig_stats.zero_pages,
+                       pages->num - pages->normal_num - pages->dup_num);
 
             multifd_pages_reset(p->pages);
             p->next_packet_size = 0;
@@ -1233,6 +1343,131 @@ err:
     return false;
 }
 
+/*
+ * Adaptive channel count.  Every MULTIFD_TUNE_INTERVAL_MS the migration
+ * thread compares the multifd throughput with that of the previous
+ * interval and moves the number of usable channels by one:
+ *
+ * - if the migration thread hardly ever waited for a free channel, the
+ *   channels are not the bottleneck, so use one less;
+ * - after adding a channel, keep adding while throughput improves by
+ *   at least MULTIFD_TUNE_GAIN_PCT, otherwise undo it;
+ * - after removing a channel, keep removing while throughput does not
+ *   drop by MULTIFD_TUNE_GAIN_PCT, otherwise undo it.
+ *
+ * After undoing a step the count is left alone for a few intervals, so
+ * that it settles instead of oscillating around the optimum.
+ */
+#define MULTIFD_TUNE_INTERVAL_MS   1000
+#define MULTIFD_TUNE_GAIN_PCT      5
+#define MULTIFD_TUNE_BUSY_PCT      10
+#define MULTIFD_TUNE_HOLD          5
+
+void multifd_send_tune_channels(int64_t now_ms)
+{
+    int channels = migrate_multifd_channels();
+    uint64_t bytes, rate;
+    int64_t elapsed;
+    bool saturated;
+    int active, step;
+
+    if (!migrate_multifd_adaptive_channels() || !multifd_send_state) {
+        return;
+    }
+
+    bytes = stat64_get(&mig_stats.multifd_bytes);
+    if (!multifd_send_state->tune.start_ms) {
+        multifd_send_state->tune.start_ms = now_ms;
+        multifd_send_state->tune.start_bytes = bytes;
+        return;
+    }
+
+    elapsed = now_ms - multifd_send_state->tune.start_ms;
+    if (elapsed < MULTIFD_TUNE_INTERVAL_MS) {
+        return;
+    }
+
+    rate = (bytes - multifd_send_state->tune.start_bytes) / elapsed;
+    saturated = multifd_send_state->tune.wait_ns / 1000000 * 100 >=
+                elapsed * MULTIFD_TUNE_BUSY_PCT;
+    active = channels - multifd_send_state->tune.target_held;
+
+    if (multifd_send_state->tune.hold_intervals) {
+        multifd_send_state->tune.hold_intervals--;
+        step = 0;
+    } else if (!saturated) {
+        step = -1;
+    } else if (multifd_send_state->tune.last_step > 0) {
+        step = rate * 100 >= multifd_send_state->tune.last_rate *
+                             (100 + MULTIFD_TUNE_GAIN_PCT) ? 1 : -1;
+    } else if (multifd_send_state->tune.last_step < 0) {
+        step = rate * 100 <= multifd_send_state->tune.last_rate *
+                             (100 - MULTIFD_TUNE_GAIN_PCT) ? 1 : -1;
+    } else {
+        step = 1;
+    }
+
+    if (active + step < 1 || active + step > channels) {
+        step = 0;
+    }
+
+    if (step && step == -multifd_send_state->tune.last_step) {
+        /* This undoes the previous step: settle for a while. */
+        multifd_send_state->tune.hold_intervals = MULTIFD_TUNE_HOLD;
+        multifd_send_state->tune.last_step = 0;
+    } else {
+        multifd_send_state->tune.last_step = step;
+    }
+    active += step;
+
+    multifd_send_state->tune.target_held = channels - active;
+    while (multifd_send_state->tune.held >
+           multifd_send_state->tune.target_held) {
+        qemu_sem_post(&multifd_send_state->channels_ready);
+        multifd_send_state->tune.held--;
+    }
+
+    trace_multifd_send_tune_channels(active, rate, saturated);
+
+    multifd_send_state->tune.last_rate = rate;
+    multifd_send_state->tune.start_ms = now_ms;
+    multifd_send_state->tune.start_bytes = bytes;
+    multifd_send_state->tune.wait_ns = 0;
+}
+
+/*
+ * Called with the BQL held, which also serializes against
+ * multifd_send_shutdown().
+ */
+MultiFDChannelStatsList *multifd_send_query_stats(void)
+{
+    MultiFDChannelStatsList *head = NULL, **tail = &head;
+    int i;
+
+    if (!multifd_send_state) {
+        return NULL;
+    }
+
+    for (i = 0; i < migrate_multifd_channels(); i++) {
+        MultiFDSendParams *p = &multifd_send_state->params[i];
+        MultiFDChannelStats *stats = g_new0(MultiFDChannelStats, 1);
+
+        stats->id = p->id;
+        stats->bytes = stat64_get(&p->prepare_bytes_in);
+        stats->compressed_bytes = stat64_get(&p->prepare_bytes_out);
+        stats->pages = stats->bytes / p->page_size;
+        stats->compression_rate = stats->compressed_bytes ?
+            (double)stats->bytes / stats->compressed_bytes : 0;
+        stats->prepare_time = stat64_get(&p->prepare_time_us);
+        if (multifd_send_state->ops->send_query_stats && p->compress_data) {
+            multifd_send_state->ops->send_query_stats(p, stats);
+        }
+        QAPI_LIST_APPEND(tail, stats);
+    }
+
+    return head;
+}
+
 bool multifd_recv(void)
 {
     int i;
@@ -1246,6 +1481,13 @@ bool multifd_recv(void)
      * limit is lower now.
      */
     next_recv_channel %= migrate_multifd_channels();
+
+    /*
+     * Once this returns, at least one channel is done with its job, so
+     * the loop below terminates without spinning.
+     */
+    qemu_sem_wait(&multifd_recv_state->channels_ready);
+
     for (i = next_recv_channel;; i = (i + 1) % migrate_multifd_channels()) {
         if (multifd_recv_should_exit()) {
             return false;
@@ -1279,6 +1521,31 @@ bool multifd_recv(void)
     return true;
 }
 
+MultiFDRecvChannelStatsList *multifd_recv_query_stats(void)
+{
+    MultiFDRecvChannelStatsList *head = NULL, **tail = &head;
+    int i;
+
+    if (!multifd_recv_state) {
+        return NULL;
+    }
+
+    for (i = 0; i < migrate_multifd_channels(); i++) {
+        MultiFDRecvParams *p = &multifd_recv_state->params[i];
+        MultiFDRecvChannelStats *stats = g_new0(MultiFDRecvChannelStats, 1);
+
+        stats->id = p->id;
+        stats->pages = stat64_get(&p->recv_pages);
+        stats->bytes = stat64_get(&p->recv_bytes);
+        stats->time = stat64_get(&p->recv_time_us);
+        stats->throughput = stats->time ?
+            stats->bytes * 1000000 / stats->time : 0;
+        QAPI_LIST_APPEND(tail, stats);
+    }
+
+    return head;
+}
+
 MultiFDRecvData *multifd_get_recv_data(void)
 {
     return multifd_recv_state->data;
@@ -1340,6 +1607,9 @@ static void multifd_recv_terminate_threads(Error *err)
             qio_channel_shutdown(p->c, QIO_CHANNEL_SHUTDOWN_BOTH, NULL);
         }
     }
+
+    /* Wake up multifd_recv() if it is waiting for a free channel */
+    qemu_sem_post(&multifd_recv_state->channels_ready);
 }
 
 void multifd_recv_shutdown(void)
@@ -1368,12 +1638,15 @@ static void multifd_recv_cleanup_channel(MultiFDRecvParams *p)
     p->normal = NULL;
     g_free(p->zero);
     p->zero = NULL;
+    g_free(p->dup);
+    p->dup = NULL;
     multifd_recv_state->ops->recv_cleanup(p);
 }
 
 static void multifd_recv_cleanup_state(void)
 {
     qemu_sem_destroy(&multifd_recv_state->sem_sync);
+    qemu_sem_destroy(&multifd_recv_state->channels_ready);
     g_free(multifd_recv_state->params);
     multifd_recv_state->params = NULL;
     g_free(multifd_recv_state->data);
@@ -1501,7 +1774,7 @@ static void *multifd_recv_thread(void *opaque)
             flags = p->flags;
             /* recv methods don't know how to handle the SYNC flag */
             p->flags &= ~MULTIFD_FLAG_SYNC;
-            has_data = p->normal_num || p->zero_num;
+            has_data = p->normal_num || p->dup_num || p->zero_num;
             qemu_mutex_unlock(&p->mutex);
         } else {
             /*
@@ -1530,10 +1803,26 @@ static void *multifd_recv_thread(void *opaque)
         }
 
         if (has_data) {
+            int64_t recv_start = qemu_clock_get_us(QEMU_CLOCK_REALTIME);
+            uint64_t recv_bytes;
+
+            /* The recv method may reset these, sample them first */
+            if (use_packets) {
+                recv_bytes = p->next_packet_size;
+                stat64_add(&p->recv_pages, p->normal_num + p->dup_num);
+            } else {
+                recv_bytes = p->data->size;
+                stat64_add(&p->recv_pages, p->data->size / p->page_size);
+            }
+
             ret = multifd_recv_state->ops->recv(p, &local_err);
             if (ret != 0) {
                 break;
             }
+
+            stat64_add(&p->recv_time_us,
+                       qemu_clock_get_us(QEMU_CLOCK_REALTIME) - recv_start);
+            stat64_add(&p->recv_bytes, recv_bytes);
         }
 
         if (use_packets) {
@@ -1550,6 +1839,7 @@ static void *multifd_recv_thread(void *opaque)
              * multifd_recv().
              */
             qatomic_store_release(&p->pending_job, false);
+            qemu_sem_post(&multifd_recv_state->channels_ready);
         }
     }
 
@@ -1591,6 +1881,7 @@ int multifd_recv_setup(Error **errp)
     qatomic_set(&multifd_recv_state->count, 0);
     qatomic_set(&multifd_recv_state->exiting, 0);
     qemu_sem_init(&multifd_recv_state->sem_sync, 0);
+    qemu_sem_init(&multifd_recv_state->channels_ready, thread_count);
     multifd_recv_state->ops = multifd_ops[migrate_multifd_compression()];
 
     for (i = 0; i < thread_count; i++) {
@@ -1613,6 +1904,7 @@ int multifd_recv_setup(Error **errp)
         p->name = g_strdup_printf("mig/dst/recv_%d", i);
         p->normal = g_new0(ram_addr_t, page_count);
         p->zero = g_new0(ram_addr_t, page_count);
+        p->dup = g_new0(ram_addr_t, page_count);
         p->page_count = page_count;
         p->page_size = qemu_target_page_size();
     }
@@ -13,6 +13,7 @@
 #ifndef QEMU_MIGRATION_MULTIFD_H
 #define QEMU_MIGRATION_MULTIFD_H
 
+#include "qemu/stats64.h"
 #include "ram.h"
 
 typedef struct MultiFDRecvData MultiFDRecvData;
@@ -30,6 +31,9 @@ int multifd_send_sync_main(void);
 bool multifd_queue_page(RAMBlock *block, ram_addr_t offset);
 bool multifd_recv(void);
 MultiFDRecvData *multifd_get_recv_data(void);
+MultiFDChannelStatsList *multifd_send_query_stats(void);
+MultiFDRecvChannelStatsList *multifd_recv_query_stats(void);
+void multifd_send_tune_channels(int64_t now_ms);
 
 /* Multifd Compression flags */
 #define MULTIFD_FLAG_SYNC (1 << 0)
@@ -40,7 +44,9 @@ MultiFDRecvData *multifd_get_recv_data(void);
 #define MULTIFD_FLAG_NOCOMP (0 << 1)
 #define MULTIFD_FLAG_ZLIB (1 << 1)
 #define MULTIFD_FLAG_ZSTD (2 << 1)
+#define MULTIFD_FLAG_LZ4 (3 << 1)
 #define MULTIFD_FLAG_QPL (4 << 1)
+#define MULTIFD_FLAG_XBZRLE (5 << 1)
 #define MULTIFD_FLAG_UADK (8 << 1)
 
 /* This value needs to be a multiple of qemu_target_page_size() */
@@ -59,12 +65,14 @@ typedef struct {
     uint64_t packet_num;
     /* zero pages */
     uint32_t zero_pages;
-    uint32_t unused32[1];    /* Reserved for future use */
+    /* pages sent as a reference to a page in the dedup cache */
+    uint32_t dup_pages;
     uint64_t unused64[3];    /* Reserved for future use */
     char ramblock[256];
     /*
      * This array contains the pointers to:
      *  - normal pages (initial normal_pages entries)
+     *  - duplicate pages (following dup_pages entries)
      *  - zero pages (following zero_pages entries)
      */
     uint64_t offset[];
@@ -75,6 +83,8 @@ typedef struct {
     uint32_t num;
     /* number of normal pages */
     uint32_t normal_num;
+    /* number of duplicate pages, following the normal ones */
+    uint32_t dup_num;
     /* number of allocated pages */
     uint32_t allocated;
     /* offset of each page */
@@ -156,6 +166,17 @@ typedef struct {
     uint32_t iovs_num;
     /* used for compression methods */
     void *compress_data;
+    /* used for content deduplication */
+    void *dedup_data;
+
+    /* Statistics, also read by query-migrate */
+
+    /* size of the normal pages handed to send_prepare */
+    Stat64 prepare_bytes_in;
+    /* size of the payload produced by send_prepare */
+    Stat64 prepare_bytes_out;
+    /* time spent in send_prepare, in microseconds */
+    Stat64 prepare_time_us;
 }  MultiFDSendParams;
 
 typedef struct {
@@ -220,8 +241,23 @@ typedef struct {
     ram_addr_t *zero;
     /* num of zero pages */
     uint32_t zero_num;
+    /* Pages that are copies of a page in the dedup cache */
+    ram_addr_t *dup;
+    /* num of duplicate pages */
+    uint32_t dup_num;
     /* used for de-compression methods */
     void *compress_data;
+    /* used for content deduplication */
+    void *dedup_data;
+
+    /* Statistics, also read by query-migrate */
+
+    /* non zero pages read by the recv method */
+    Stat64 recv_pages;
+    /* bytes read by the recv method, not counting packet headers */
+    Stat64 recv_bytes;
+    /* time spent in the recv method, in microseconds */
+    Stat64 recv_time_us;
 } MultiFDRecvParams;
 
 typedef struct {
@@ -231,6 +267,9 @@ typedef struct {
     void (*send_cleanup)(MultiFDSendParams *p, Error **errp);
     /* Prepare the send packet */
     int (*send_prepare)(MultiFDSendParams *p, Error **errp);
+    /* Add method specific statistics, optional */
+    void (*send_query_stats)(MultiFDSendParams *p,
+                             MultiFDChannelStats *stats);
     /* Setup for receiving side */
     int (*recv_setup)(MultiFDRecvParams *p, Error **errp);
     /* Cleanup for receiving side */
@@ -244,6 +283,14 @@ void multifd_send_fill_packet(MultiFDSendParams *p);
 bool multifd_send_prepare_common(MultiFDSendParams *p);
 void multifd_send_zero_page_detect(MultiFDSendParams *p);
 void multifd_recv_zero_page_process(MultiFDRecvParams *p);
+int multifd_send_dedup_setup(MultiFDSendParams *p, Error **errp);
+void multifd_send_dedup_cleanup(MultiFDSendParams *p);
+void multifd_send_dedup_detect(MultiFDSendParams *p);
+void multifd_send_dedup_prepare_iov(MultiFDSendParams *p);
+int multifd_recv_dedup_setup(MultiFDRecvParams *p, Error **errp);
+void multifd_recv_dedup_cleanup(MultiFDRecvParams *p);
+int multifd_recv_dedup_process(MultiFDRecvParams *p, Error **errp);
+void multifd_recv_dedup_update(MultiFDRecvParams *p);
 
 static inline void multifd_send_prepare_header(MultiFDSendParams *p)
 {
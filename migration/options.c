@@ -13,6 +13,7 @@
 
 #include "qemu/osdep.h"
 #include "qemu/error-report.h"
+#include "qemu/units.h"
 #include "exec/target_page.h"
 #include "qapi/clone-visitor.h"
 #include "qapi/error.h"
@@ -49,6 +50,9 @@
 /* Migration XBZRLE default cache size */
 #define DEFAULT_MIGRATE_XBZRLE_CACHE_SIZE (64 * 1024 * 1024)
 
+/* Amount read at a time from the pages region of a mapped-ram file */
+#define DEFAULT_MIGRATE_MAPPED_RAM_READ_SIZE (1 * MiB)
+
 /* The delay time (in ms) between two COLO checkpoints */
 #define DEFAULT_MIGRATE_X_CHECKPOINT_DELAY (200 * 100)
 #define DEFAULT_MIGRATE_MULTIFD_CHANNELS 2
@@ -129,6 +133,11 @@ Property migration_properties[] = {
     DEFINE_PROP_SIZE("xbzrle-cache-size", MigrationState,
                       parameters.xbzrle_cache_size,
                       DEFAULT_MIGRATE_XBZRLE_CACHE_SIZE),
+    DEFINE_PROP_SIZE("mapped-ram-read-size", MigrationState,
+                      parameters.mapped_ram_read_size,
+                      DEFAULT_MIGRATE_MAPPED_RAM_READ_SIZE),
+    DEFINE_PROP_SIZE("convergence-max-bandwidth", MigrationState,
+                      parameters.convergence_max_bandwidth, 0),
     DEFINE_PROP_SIZE("max-postcopy-bandwidth", MigrationState,
                       parameters.max_postcopy_bandwidth,
                       DEFAULT_MIGRATE_MAX_POSTCOPY_BANDWIDTH),
@@ -186,6 +195,17 @@ Property migration_properties[] = {
                         MIGRATION_CAPABILITY_SWITCHOVER_ACK),
     DEFINE_PROP_MIG_CAP("x-dirty-limit", MIGRATION_CAPABILITY_DIRTY_LIMIT),
     DEFINE_PROP_MIG_CAP("mapped-ram", MIGRATION_CAPABILITY_MAPPED_RAM),
+    DEFINE_PROP_MIG_CAP("x-multifd-adaptive-channels",
+                        MIGRATION_CAPABILITY_MULTIFD_ADAPTIVE_CHANNELS),
+    DEFINE_PROP_MIG_CAP("x-multifd-dedup", MIGRATION_CAPABILITY_MULTIFD_DEDUP),
+    DEFINE_PROP_MIG_CAP("x-defer-hot-pages",
+                        MIGRATION_CAPABILITY_DEFER_HOT_PAGES),
+    DEFINE_PROP_MIG_CAP("x-mapped-ram-lazy-load",
+                        MIGRATION_CAPABILITY_MAPPED_RAM_LAZY_LOAD),
+    DEFINE_PROP_MIG_CAP("x-mapped-ram-delta",
+                        MIGRATION_CAPABILITY_MAPPED_RAM_DELTA),
+    DEFINE_PROP_MIG_CAP("x-convergence-control",
+                        MIGRATION_CAPABILITY_CONVERGENCE_CONTROL),
     DEFINE_PROP_END_OF_LIST(),
 };
 
@@ -210,6 +230,20 @@ bool migrate_colo(void)
     return s->capabilities[MIGRATION_CAPABILITY_X_COLO];
 }
 
+bool migrate_defer_hot_pages(void)
+{
+    MigrationState *s = migrate_get_current();
+
+    return s->capabilities[MIGRATION_CAPABILITY_DEFER_HOT_PAGES];
+}
+
+bool migrate_convergence_control(void)
+{
+    MigrationState *s = migrate_get_current();
+
+    return s->capabilities[MIGRATION_CAPABILITY_CONVERGENCE_CONTROL];
+}
+
 bool migrate_dirty_bitmaps(void)
 {
     MigrationState *s = migrate_get_current();
@@ -238,6 +272,20 @@ bool migrate_mapped_ram(void)
     return s->capabilities[MIGRATION_CAPABILITY_MAPPED_RAM];
 }
 
+bool migrate_mapped_ram_delta(void)
+{
+    MigrationState *s = migrate_get_current();
+
+    return s->capabilities[MIGRATION_CAPABILITY_MAPPED_RAM_DELTA];
+}
+
+bool migrate_mapped_ram_lazy_load(void)
+{
+    MigrationState *s = migrate_get_current();
+
+    return s->capabilities[MIGRATION_CAPABILITY_MAPPED_RAM_LAZY_LOAD];
+}
+
 bool migrate_ignore_shared(void)
 {
     MigrationState *s = migrate_get_current();
@@ -259,6 +307,20 @@ bool migrate_multifd(void)
     return s->capabilities[MIGRATION_CAPABILITY_MULTIFD];
 }
 
+bool migrate_multifd_adaptive_channels(void)
+{
+    MigrationState *s = migrate_get_current();
+
+    return s->capabilities[MIGRATION_CAPABILITY_MULTIFD_ADAPTIVE_CHANNELS];
+}
+
+bool migrate_multifd_dedup(void)
+{
+    MigrationState *s = migrate_get_current();
+
+    return s->capabilities[MIGRATION_CAPABILITY_MULTIFD_DEDUP];
+}
+
 bool migrate_pause_before_switchover(void)
 {
     MigrationState *s = migrate_get_current();
@@ -426,6 +488,8 @@ INITIALIZE_MIGRATE_CAPS_SET(check_caps_background_snapshot,
     MIGRATION_CAPABILITY_XBZRLE,
     MIGRATION_CAPABILITY_X_COLO,
     MIGRATION_CAPABILITY_VALIDATE_UUID,
+    MIGRATION_CAPABILITY_DEFER_HOT_PAGES,
+    MIGRATION_CAPABILITY_MAPPED_RAM_DELTA,
     MIGRATION_CAPABILITY_ZERO_COPY_SEND);
 
 static bool migrate_incoming_started(void)
@@ -571,6 +635,13 @@ bool migrate_caps_check(bool *old_caps, bool *new_caps, Error **errp)
         }
     }
 
+    if (new_caps[MIGRATION_CAPABILITY_CONVERGENCE_CONTROL] &&
+        !new_caps[MIGRATION_CAPABILITY_DIRTY_LIMIT]) {
+        error_setg(errp, "Capability 'convergence-control' requires "
+                   "capability 'dirty-limit'");
+        return false;
+    }
+
     if (new_caps[MIGRATION_CAPABILITY_MULTIFD]) {
         if (new_caps[MIGRATION_CAPABILITY_XBZRLE]) {
             error_setg(errp, "Multifd is not compatible with xbzrle");
@@ -578,6 +649,36 @@ bool migrate_caps_check(bool *old_caps, bool *new_caps, Error **errp)
         }
     }
 
+    if (new_caps[MIGRATION_CAPABILITY_MULTIFD_ADAPTIVE_CHANNELS] &&
+        !new_caps[MIGRATION_CAPABILITY_MULTIFD]) {
+        error_setg(errp, "Capability 'multifd-adaptive-channels' requires "
+                   "capability 'multifd'");
+        return false;
+    }
+
+    if (new_caps[MIGRATION_CAPABILITY_DEFER_HOT_PAGES] &&
+        new_caps[MIGRATION_CAPABILITY_X_COLO]) {
+        error_setg(errp, "Capability 'defer-hot-pages' is not compatible "
+                   "with COLO");
+        return false;
+    }
+
+    if (new_caps[MIGRATION_CAPABILITY_MULTIFD_DEDUP]) {
+        if (!new_caps[MIGRATION_CAPABILITY_MULTIFD]) {
+            error_setg(errp, "Capability 'multifd-dedup' requires "
+                       "capability 'multifd'");
+            return false;
+        }
+        if (new_caps[MIGRATION_CAPABILITY_ZERO_COPY_SEND] ||
+            new_caps[MIGRATION_CAPABILITY_MAPPED_RAM] ||
+            migrate_multifd_compression()) {
+            error_setg(errp, "Capability 'multifd-dedup' is not compatible "
+                       "with multifd compression, zero-copy-send or "
+                       "mapped-ram");
+            return false;
+        }
+    }
+
     if (new_caps[MIGRATION_CAPABILITY_MAPPED_RAM]) {
         if (new_caps[MIGRATION_CAPABILITY_XBZRLE]) {
             error_setg(errp,
@@ -592,6 +693,35 @@ bool migrate_caps_check(bool *old_caps, bool *new_caps, Error **errp)
         }
     }
 
+    if (new_caps[MIGRATION_CAPABILITY_MAPPED_RAM_DELTA] &&
+        !new_caps[MIGRATION_CAPABILITY_MAPPED_RAM]) {
+        error_setg(errp, "Capability 'mapped-ram-delta' requires "
+                   "capability 'mapped-ram'");
+        return false;
+    }
+
+    if (new_caps[MIGRATION_CAPABILITY_MAPPED_RAM_LAZY_LOAD]) {
+        if (!new_caps[MIGRATION_CAPABILITY_MAPPED_RAM]) {
+            error_setg(errp, "Capability 'mapped-ram-lazy-load' requires "
+                       "capability 'mapped-ram'");
+            return false;
+        }
+
+        if (new_caps[MIGRATION_CAPABILITY_X_COLO]) {
+            error_setg(errp, "Capability 'mapped-ram-lazy-load' is not "
+                       "compatible with COLO");
+            return false;
+        }
+
+        /* Pages are placed with userfaultfd, as in postcopy */
+        if (!old_caps[MIGRATION_CAPABILITY_MAPPED_RAM_LAZY_LOAD] &&
+            runstate_check(RUN_STATE_INMIGRATE) &&
+            !postcopy_ram_supported_by_host(mis, errp)) {
+            error_prepend(errp, "Lazy loading is not supported: ");
+            return false;
+        }
+    }
+
     return true;
 }
 
@@ -656,6 +786,10 @@ void qmp_migrate_set_capabilities(MigrationCapabilityStatusList *params,
     for (cap = params; cap; cap = cap->next) {
         s->capabilities[cap->value->capability] = cap->value->state;
     }
+
+    if (!migrate_mapped_ram_delta()) {
+        ram_delta_tracking_stop();
+    }
 }
 
 /* parameters */
@@ -721,6 +855,13 @@ bool migrate_direct_io(void)
         s->capabilities[MIGRATION_CAPABILITY_MULTIFD];
 }
 
+uint64_t migrate_convergence_max_bandwidth(void)
+{
+    MigrationState *s = migrate_get_current();
+
+    return s->parameters.convergence_max_bandwidth;
+}
+
 uint64_t migrate_downtime_limit(void)
 {
     MigrationState *s = migrate_get_current();
@@ -728,6 +869,13 @@ uint64_t migrate_downtime_limit(void)
     return s->parameters.downtime_limit;
 }
 
+uint64_t migrate_mapped_ram_read_size(void)
+{
+    MigrationState *s = migrate_get_current();
+
+    return s->parameters.mapped_ram_read_size;
+}
+
 uint8_t migrate_max_cpu_throttle(void)
 {
     MigrationState *s = migrate_get_current();
@@ -829,6 +977,13 @@ uint64_t migrate_vcpu_dirty_limit_period(void)
     return s->parameters.x_vcpu_dirty_limit_period;
 }
 
+uint64_t migrate_vcpu_dirty_limit(void)
+{
+    MigrationState *s = migrate_get_current();
+
+    return s->parameters.vcpu_dirty_limit;
+}
+
 uint64_t migrate_xbzrle_cache_size(void)
 {
     MigrationState *s = migrate_get_current();
@@ -926,6 +1081,11 @@ MigrationParameters *qmp_query_migrate_parameters(Error **errp)
     params->zero_page_detection = s->parameters.zero_page_detection;
     params->has_direct_io = true;
     params->direct_io = s->parameters.direct_io;
+    params->has_mapped_ram_read_size = true;
+    params->mapped_ram_read_size = s->parameters.mapped_ram_read_size;
+    params->has_convergence_max_bandwidth = true;
+    params->convergence_max_bandwidth =
+        s->parameters.convergence_max_bandwidth;
 
     return params;
 }
@@ -959,6 +1119,8 @@ void migrate_params_init(MigrationParameters *params)
     params->has_mode = true;
     params->has_zero_page_detection = true;
     params->has_direct_io = true;
+    params->has_mapped_ram_read_size = true;
+    params->has_convergence_max_bandwidth = true;
 }
 
 /*
@@ -1004,6 +1166,15 @@ bool migrate_params_check(MigrationParameters *params, Error **errp)
         return false;
     }
 
+    if (params->has_convergence_max_bandwidth &&
+        (params->convergence_max_bandwidth > SIZE_MAX)) {
+        error_setg(errp, QERR_INVALID_PARAMETER_VALUE,
+                   "convergence_max_bandwidth",
+                   "an integer in the range of 0 to "stringify(SIZE_MAX)
+                   " bytes/second");
+        return false;
+    }
+
     if (params->has_avail_switchover_bandwidth &&
         (params->avail_switchover_bandwidth > SIZE_MAX)) {
         error_setg(errp, QERR_INVALID_PARAMETER_VALUE,
@@ -1109,6 +1280,14 @@ bool migrate_params_check(MigrationParameters *params, Error **errp)
     }
 #endif
 
+    if (migrate_multifd_dedup() &&
+        params->has_multifd_compression && params->multifd_compression) {
+        error_setg(errp,
+                   "Capability 'multifd-dedup' is not compatible with "
+                   "multifd compression");
+        return false;
+    }
+
     if (migrate_mapped_ram() &&
         (migrate_multifd_compression() || migrate_tls())) {
         error_setg(errp,
@@ -1137,6 +1316,16 @@ bool migrate_params_check(MigrationParameters *params, Error **errp)
         return false;
     }
 
+    if (params->has_mapped_ram_read_size &&
+        (params->mapped_ram_read_size < 64 * KiB ||
+         params->mapped_ram_read_size > 1 * GiB ||
+         !is_power_of_2(params->mapped_ram_read_size))) {
+        error_setg(errp, QERR_INVALID_PARAMETER_VALUE,
+                   "mapped-ram-read-size",
+                   "a power of 2 between 64 KiB and 1 GiB");
+        return false;
+    }
+
     return true;
 }
 
@@ -1247,6 +1436,14 @@ static void migrate_params_test_apply(MigrateSetParameters *params,
     if (params->has_direct_io) {
         dest->direct_io = params->direct_io;
     }
+
+    if (params->has_mapped_ram_read_size) {
+        dest->mapped_ram_read_size = params->mapped_ram_read_size;
+    }
+
+    if (params->has_convergence_max_bandwidth) {
+        dest->convergence_max_bandwidth = params->convergence_max_bandwidth;
+    }
 }
 
 static void migrate_params_apply(MigrateSetParameters *params, Error **errp)
@@ -1376,6 +1573,15 @@ static void migrate_params_apply(MigrateSetParameters *params, Error **errp)
     if (params->has_direct_io) {
         s->parameters.direct_io = params->direct_io;
     }
+
+    if (params->has_mapped_ram_read_size) {
+        s->parameters.mapped_ram_read_size = params->mapped_ram_read_size;
+    }
+
+    if (params->has_convergence_max_bandwidth) {
+        s->parameters.convergence_max_bandwidth =
+            params->convergence_max_bandwidth;
+    }
 }
 
 void qmp_migrate_set_parameters(MigrateSetParameters *params, Error **errp)
@@ -26,12 +26,18 @@ extern Property migration_properties[];
 
 bool migrate_auto_converge(void);
 bool migrate_colo(void);
+bool migrate_convergence_control(void);
+bool migrate_defer_hot_pages(void);
 bool migrate_dirty_bitmaps(void);
 bool migrate_events(void);
 bool migrate_mapped_ram(void);
+bool migrate_mapped_ram_delta(void);
+bool migrate_mapped_ram_lazy_load(void);
 bool migrate_ignore_shared(void);
 bool migrate_late_block_activate(void);
 bool migrate_multifd(void);
+bool migrate_multifd_adaptive_channels(void);
+bool migrate_multifd_dedup(void);
 bool migrate_pause_before_switchover(void);
 bool migrate_postcopy_blocktime(void);
 bool migrate_postcopy_preempt(void);
@@ -66,11 +72,13 @@ const BitmapMigrationNodeAliasList *migrate_block_bitmap_mapping(void);
 bool migrate_has_block_bitmap_mapping(void);
 
 uint32_t migrate_checkpoint_delay(void);
+uint64_t migrate_convergence_max_bandwidth(void);
 uint8_t migrate_cpu_throttle_increment(void);
 uint8_t migrate_cpu_throttle_initial(void);
 bool migrate_cpu_throttle_tailslow(void);
 bool migrate_direct_io(void);
 uint64_t migrate_downtime_limit(void);
+uint64_t migrate_mapped_ram_read_size(void);
 uint8_t migrate_max_cpu_throttle(void);
 uint64_t migrate_max_bandwidth(void);
 uint64_t migrate_avail_switchover_bandwidth(void);
@@ -83,6 +91,7 @@ uint8_t migrate_throttle_trigger_threshold(void);
 const char *migrate_tls_authz(void);
 const char *migrate_tls_creds(void);
 const char *migrate_tls_hostname(void);
+uint64_t migrate_vcpu_dirty_limit(void);
 uint64_t migrate_xbzrle_cache_size(void);
 ZeroPageDetection migrate_zero_page_detection(void);
 
@@ -17,12 +17,21 @@
 #include "qapi/qmp/qerror.h"
 #include "qapi/error.h"
 #include "qemu/host-utils.h"
+#include "qemu/stats64.h"
 #include "page_cache.h"
 #include "trace.h"
 
 /* the page in cache will not be replaced in two cycles */
 #define CACHED_PAGE_LIFETIME 2
 
+/*
+ * The cache is set-associative: a page can live in any of the ways of the
+ * set picked by its address, so that a few hot pages that happen to share
+ * a set do not keep evicting each other.  Consecutive pages map to
+ * consecutive sets.
+ */
+#define PAGE_CACHE_WAYS 8
+
 typedef struct CacheItem CacheItem;
 
 struct CacheItem {
@@ -31,11 +40,22 @@ struct CacheItem {
     uint8_t *it_data;
 };
 
+/*
+ * A PageCache has a single user at a time: the RAM cache is protected by
+ * the XBZRLE lock and every multifd channel has a cache of its own.  Only
+ * the statistics are read from other threads.
+ */
 struct PageCache {
+    /* num_sets * ways items, one set after the other */
     CacheItem *page_cache;
     size_t page_size;
     size_t max_num_items;
     size_t num_items;
+    size_t ways;
+    size_t num_sets;
+    Stat64 hits;
+    Stat64 misses;
+    Stat64 evictions;
 };
 
 PageCache *cache_init(uint64_t new_size, size_t page_size, Error **errp)
@@ -58,7 +78,7 @@ PageCache *cache_init(uint64_t new_size, size_t page_size, Error **errp)
     }
 
     /* We prefer not to abort if there is no memory */
-    cache = g_try_malloc(sizeof(*cache));
+    cache = g_try_malloc0(sizeof(*cache));
     if (!cache) {
         error_setg(errp, "Failed to allocate cache");
         return NULL;
@@ -66,8 +86,10 @@ PageCache *cache_init(uint64_t new_size, size_t page_size, Error **errp)
     cache->page_size = page_size;
     cache->num_items = 0;
     cache->max_num_items = num_pages;
+    cache->ways = MIN(PAGE_CACHE_WAYS, num_pages);
+    cache->num_sets = num_pages / cache->ways;
 
-    trace_migration_pagecache_init(cache->max_num_items);
+    trace_migration_pagecache_init(cache->max_num_items, cache->ways);
 
     /* We prefer not to abort if there is no memory */
     cache->page_cache = g_try_malloc((cache->max_num_items) *
@@ -103,42 +125,71 @@ void cache_fini(PageCache *cache)
     g_free(cache);
 }
 
-static size_t cache_get_cache_pos(const PageCache *cache,
-                                  uint64_t address)
+static CacheItem *cache_get_set(const PageCache *cache, uint64_t address)
 {
-    g_assert(cache->max_num_items);
-    return (address / cache->page_size) & (cache->max_num_items - 1);
+    size_t set;
+
+    g_assert(cache);
+    g_assert(cache->page_cache);
+
+    set = (address / cache->page_size) & (cache->num_sets - 1);
+    return &cache->page_cache[set * cache->ways];
 }
 
 static CacheItem *cache_get_by_addr(const PageCache *cache, uint64_t addr)
 {
-    size_t pos;
+    CacheItem *set = cache_get_set(cache, addr);
+    size_t i;
 
-    g_assert(cache);
-    g_assert(cache->page_cache);
+    for (i = 0; i < cache->ways; i++) {
+        if (set[i].it_data && set[i].it_addr == addr) {
+            return &set[i];
+        }
+    }
+    return NULL;
+}
 
-    pos = cache_get_cache_pos(cache, addr);
+/*
+ * Pick the way that a page not yet in the cache goes to: a free one if
+ * there is any, else the least recently used one.
+ */
+static CacheItem *cache_get_victim(const PageCache *cache, uint64_t addr)
+{
+    CacheItem *set = cache_get_set(cache, addr);
+    CacheItem *victim = &set[0];
+    size_t i;
 
-    return &cache->page_cache[pos];
+    for (i = 0; i < cache->ways; i++) {
+        if (!set[i].it_data) {
+            return &set[i];
+        }
+        if (set[i].it_age < victim->it_age) {
+            victim = &set[i];
+        }
+    }
+    return victim;
 }
 
 uint8_t *get_cached_data(const PageCache *cache, uint64_t addr)
 {
-    return cache_get_by_addr(cache, addr)->it_data;
+    CacheItem *it = cache_get_by_addr(cache, addr);
+
+    return it ? it->it_data : NULL;
 }
 
-bool cache_is_cached(const PageCache *cache, uint64_t addr,
-                     uint64_t current_age)
+bool cache_is_cached(PageCache *cache, uint64_t addr, uint64_t current_age)
 {
     CacheItem *it;
 
     it = cache_get_by_addr(cache, addr);
 
-    if (it->it_addr == addr) {
+    if (it) {
         /* update the it_age when the cache hit */
         it->it_age = current_age;
+        stat64_add(&cache->hits, 1);
         return true;
     }
+    stat64_add(&cache->misses, 1);
     return false;
 }
 
@@ -151,10 +202,15 @@ int cache_insert(PageCache *cache, uint64_t addr, const uint8_t *pdata,
     /* actual update of entry */
     it = cache_get_by_addr(cache, addr);
 
-    if (it->it_data && it->it_addr != addr &&
-        it->it_age + CACHED_PAGE_LIFETIME > current_age) {
-        /* the cache page is fresh, don't replace it */
-        return -1;
+    if (!it) {
+        it = cache_get_victim(cache, addr);
+        if (it->it_data) {
+            if (it->it_age + CACHED_PAGE_LIFETIME > current_age) {
+                /* the cache page is fresh, don't replace it */
+                return -1;
+            }
+            stat64_add(&cache->evictions, 1);
+        }
     }
     /* allocate page */
     if (!it->it_data) {
@@ -173,3 +229,51 @@ int cache_insert(PageCache *cache, uint64_t addr, const uint8_t *pdata,
 
     return 0;
 }
+
+void cache_move(PageCache *dst, PageCache *src)
+{
+    int64_t i;
+
+    g_assert(dst->page_size == src->page_size);
+
+    for (i = 0; i < src->max_num_items; i++) {
+        CacheItem *old = &src->page_cache[i];
+        CacheItem *it;
+
+        if (!old->it_data) {
+            continue;
+        }
+
+        it = cache_get_by_addr(dst, old->it_addr);
+        if (!it) {
+            it = cache_get_victim(dst, old->it_addr);
+        }
+
+        /* Keep whichever of the two pages was used more recently */
+        if (it->it_data && it->it_age >= old->it_age) {
+            g_free(old->it_data);
+        } else {
+            if (it->it_data) {
+                g_free(it->it_data);
+            } else {
+                dst->num_items++;
+            }
+            *it = *old;
+        }
+        old->it_data = NULL;
+        old->it_addr = -1;
+    }
+    trace_migration_pagecache_move(src->num_items, dst->num_items);
+    src->num_items = 0;
+
+    stat64_add(&dst->hits, stat64_get(&src->hits));
+    stat64_add(&dst->misses, stat64_get(&src->misses));
+    stat64_add(&dst->evictions, stat64_get(&src->evictions));
+}
+
+void cache_get_stats(const PageCache *cache, PageCacheStats *stats)
+{
+    stats->hits = stat64_get(&cache->hits);
+    stats->misses = stat64_get(&cache->misses);
+    stats->evictions = stat64_get(&cache->evictions);
+}
@@ -18,6 +18,15 @@
 /* Page cache for storing guest pages */
 typedef struct PageCache PageCache;
 
+typedef struct PageCacheStats {
+    /* lookups that found the page */
+    uint64_t hits;
+    /* lookups that did not find the page */
+    uint64_t misses;
+    /* cached pages replaced by a different page */
+    uint64_t evictions;
+} PageCacheStats;
+
 /**
  * cache_init: Initialize the page cache
  *
@@ -44,8 +53,7 @@ void cache_fini(PageCache *cache);
  * @addr: page addr
  * @current_age: current bitmap generation
  */
-bool cache_is_cached(const PageCache *cache, uint64_t addr,
-                     uint64_t current_age);
+bool cache_is_cached(PageCache *cache, uint64_t addr, uint64_t current_age);
 
 /**
  * get_cached_data: Get the data cached for an addr
@@ -61,6 +69,9 @@ uint8_t *get_cached_data(const PageCache *cache, uint64_t addr);
  * cache_insert: insert the page into the cache. the page cache
  * will dup the data on insert. the previous value will be overwritten
  *
+ * When every way of the set is taken by another page, the least
+ * recently used one is evicted unless it is still fresh.
+ *
  * Returns -1 when the page isn't inserted into cache
  *
  * @cache pointer to the PageCache struct
@@ -71,4 +82,26 @@ uint8_t *get_cached_data(const PageCache *cache, uint64_t addr);
 int cache_insert(PageCache *cache, uint64_t addr, const uint8_t *pdata,
                  uint64_t current_age);
 
+/**
+ * cache_move: move the pages of a cache into another one
+ *
+ * Pages that don't fit in @dst are dropped, the least recently used
+ * first.  The statistics of @src are added to those of @dst.  @src is
+ * left empty and must still be freed with cache_fini().
+ *
+ * @dst: destination PageCache
+ * @src: source PageCache
+ */
+void cache_move(PageCache *dst, PageCache *src);
+
+/**
+ * cache_get_stats: read the hit, miss and eviction counters
+ *
+ * The counters may be read while another thread uses the cache.
+ *
+ * @cache pointer to the PageCache struct
+ * @stats: filled with the counters
+ */
+void cache_get_stats(const PageCache *cache, PageCacheStats *stats);
+
 #endif
@@ -760,11 +760,18 @@ int postcopy_wake_shared(struct PostCopyFD *pcfd,
     return ret;
 }
 
+static int postcopy_lazy_load_page(MigrationIncomingState *mis,
+                                   RAMBlock *rb, ram_addr_t start);
+
 static int postcopy_request_page(MigrationIncomingState *mis, RAMBlock *rb,
                                  ram_addr_t start, uint64_t haddr)
 {
     void *aligned = (void *)(uintptr_t)ROUND_DOWN(haddr, qemu_ram_pagesize(rb));
 
+    if (mis->lazy_load) {
+        return postcopy_lazy_load_page(mis, rb, start);
+    }
+
     /*
      * Discarded pages (via RamDiscardManager) are never migrated. On unlikely
      * access, place a zeropage, which will also set the relevant bits in the
@@ -1009,7 +1016,7 @@ static void *postcopy_ram_fault_thread(void *opaque)
             break;
         }
 
-        if (!mis->to_src_file) {
+        if (!mis->to_src_file && !mis->lazy_load) {
             /*
              * Possibly someone tells us that the return path is
              * broken already using the event. We should hold until
@@ -1391,6 +1398,340 @@ int postcopy_place_page_zero(MigrationIncomingState *mis, void *host,
     }
 }
 
+/*
+ * Lazy loading of a mapped-ram migration file
+ *
+ * With the mapped-ram-lazy-load capability the destination does not read
+ * RAM while it loads the migration stream.  Guest memory is left empty
+ * and registered with userfaultfd, like for postcopy, and the fault
+ * thread serves each missing page by reading it from its fixed offset in
+ * the file.  Once the guest is started, a background thread walks the
+ * file bitmap and places the pages nobody faulted on yet.  Pages that are
+ * not in the file are zero and are never placed: they read as zero once
+ * userfaultfd is unregistered at the end of the load.
+ */
+
+/*
+ * Read @size bytes of @rb starting at @offset from the migration file
+ * into @buf.  Pages that are not present in the file are zeroed.
+ *
+ * Returns the number of target pages that were present in the file, or
+ * -1 on error.
+ */
+static long postcopy_lazy_load_read(MigrationIncomingState *mis,
+                                    RAMBlock *rb, ram_addr_t offset,
+                                    size_t size, uint8_t *buf, Error **errp)
+{
+    QIOChannel *ioc = qemu_file_get_ioc(mis->from_src_file);
+    int page_bits = qemu_target_page_bits();
+    unsigned long first = offset >> page_bits;
+    unsigned long end = first + (size >> page_bits);
+    unsigned long set, clear = first;
+    unsigned long done = first;
+    long data_pages = 0;
+
+    if (!rb->file_bmap ||
+        find_next_bit(rb->file_bmap, end, first) == end) {
+        return 0;
+    }
+
+    for (set = find_next_bit(rb->file_bmap, end, first);
+         set < end;
+         set = find_next_bit(rb->file_bmap, end, clear + 1)) {
+        size_t len;
+        ssize_t ret;
+
+        clear = find_next_zero_bit(rb->file_bmap, end, set + 1);
+        len = (clear - set) << page_bits;
+
+        memset(buf + ((done - first) << page_bits), 0,
+               (set - done) << page_bits);
+        ret = qio_channel_pread(ioc, (char *)buf + ((set - first) << page_bits),
+                                len, rb->pages_offset + (set << page_bits),
+                                errp);
+        if (ret < 0) {
+            return -1;
+        }
+        if (ret != len) {
+            error_setg(errp, "short read of %s at 0x%lx from the migration "
+                       "file", rb->idstr, set << page_bits);
+            return -1;
+        }
+
+        data_pages += clear - set;
+        done = clear;
+    }
+
+    memset(buf + ((done - first) << page_bits), 0, (end - done) << page_bits);
+    return data_pages;
+}
+
+/*
+ * Whether the host page of @rb at @offset still has to be placed by the
+ * lazy load thread: it is not there yet and holds data.
+ */
+static bool postcopy_lazy_load_wanted(RAMBlock *rb, ram_addr_t offset)
+{
+    int page_bits = qemu_target_page_bits();
+    unsigned long first = offset >> page_bits;
+    unsigned long end = first + (qemu_ram_pagesize(rb) >> page_bits);
+
+    return rb->file_bmap &&
+           !ramblock_recv_bitmap_test_byte_offset(rb, offset) &&
+           find_next_bit(rb->file_bmap, end, first) < end;
+}
+
+/*
+ * Record @err as the error of the incoming migration, which fails.  The
+ * caller keeps ownership of @err.
+ */
+static void postcopy_lazy_load_fail(MigrationIncomingState *mis,
+                                    const Error *err)
+{
+    migrate_set_error(migrate_get_current(), err);
+    migrate_set_state(&mis->state, MIGRATION_STATUS_ACTIVE,
+                      MIGRATION_STATUS_FAILED);
+}
+
+/*
+ * Called by the fault thread for a missing host page of @rb at @start.
+ * The lazy load thread may be placing the same page, so losing that race
+ * with EEXIST is fine.
+ *
+ * If the page cannot be placed, the faulting thread would wait for it
+ * forever: there is no source to recover from, the file is all we have.
+ * As when a postcopy load fails, there is no way to keep the guest
+ * running, so fail the migration and exit.
+ */
+static int postcopy_lazy_load_page(MigrationIncomingState *mis,
+                                   RAMBlock *rb, ram_addr_t start)
+{
+    size_t pagesize = qemu_ram_pagesize(rb);
+    void *host = rb->host + start;
+    /* The precopy channel temp page is unused while loading lazily */
+    void *buf = mis->postcopy_tmp_pages[RAM_CHANNEL_PRECOPY].tmp_huge_page;
+    Error *local_err = NULL;
+    void *from;
+    long data_pages;
+
+    if (ramblock_recv_bitmap_test_byte_offset(rb, start)) {
+        return 0;
+    }
+
+    data_pages = postcopy_lazy_load_read(mis, rb, start, pagesize, buf,
+                                         &local_err);
+    if (data_pages < 0) {
+        goto fail;
+    }
+    trace_postcopy_lazy_load_page(rb->idstr, start, data_pages);
+
+    if (data_pages) {
+        from = buf;
+    } else if (qemu_ram_is_uf_zeroable(rb)) {
+        from = NULL;
+    } else {
+        from = mis->postcopy_tmp_zero_page;
+    }
+
+    if (qemu_ufd_copy_ioctl(mis, host, from, pagesize, rb) &&
+        errno != EEXIST) {
+        error_setg_errno(&local_err, errno, "failed to place page of %s at "
+                         "0x" RAM_ADDR_FMT, rb->idstr, start);
+        goto fail;
+    }
+    return 0;
+
+fail:
+    error_prepend(&local_err, "lazy load of guest memory: ");
+    postcopy_lazy_load_fail(mis, local_err);
+    error_report_err(local_err);
+    exit(EXIT_FAILURE);
+}
+
+/*
+ * Place @len bytes at @host of @rb from @from, skipping host pages that
+ * the fault thread placed in the meantime.  As in qemu_ufd_copy_ioctl(),
+ * the receivedmap is updated under page_request_mutex; the placement is
+ * done under it too, so that a page is never seen placed but not marked
+ * received.
+ */
+static int postcopy_lazy_load_place(MigrationIncomingState *mis,
+                                    RAMBlock *rb, uint8_t *host,
+                                    uint8_t *from, size_t len)
+{
+    size_t pagesize = qemu_ram_pagesize(rb);
+
+    while (len) {
+        struct uffdio_copy copy_struct;
+        size_t done;
+        int ret;
+
+        copy_struct.dst = (uint64_t)(uintptr_t)host;
+        copy_struct.src = (uint64_t)(uintptr_t)from;
+        copy_struct.len = len;
+        copy_struct.mode = 0;
+
+        WITH_QEMU_LOCK_GUARD(&mis->page_request_mutex) {
+            ret = ioctl(mis->userfault_fd, UFFDIO_COPY, &copy_struct);
+
+            done = copy_struct.copy > 0 ? copy_struct.copy : 0;
+            if (done) {
+                ramblock_recv_bitmap_set_range(rb, host,
+                                               done / qemu_target_page_size());
+            }
+        }
+
+        if (ret) {
+            if (errno == EEXIST) {
+                /* Already placed by the fault thread */
+                done += pagesize;
+            } else if (errno != EAGAIN) {
+                return -errno;
+            }
+        }
+
+        host += done;
+        from += done;
+        len -= done;
+    }
+
+    return 0;
+}
+
+static void postcopy_lazy_load_complete_bh(void *opaque)
+{
+    MigrationIncomingState *mis = opaque;
+
+    trace_postcopy_lazy_load_complete();
+    postcopy_lazy_load_cleanup(mis);
+    migrate_set_state(&mis->state, MIGRATION_STATUS_ACTIVE,
+                      MIGRATION_STATUS_COMPLETED);
+    migration_incoming_state_destroy();
+}
+
+static void *postcopy_lazy_load_thread(void *opaque)
+{
+    MigrationIncomingState *mis = opaque;
+    size_t chunk = MAX(migrate_mapped_ram_read_size(), mis->largest_page_size);
+    uint8_t *buf = qemu_memalign(qemu_real_host_page_size(), chunk);
+    Error *local_err = NULL;
+    uint64_t placed = 0;
+    RAMBlock *rb;
+    int ret = 0;
+
+    trace_postcopy_lazy_load_thread_entry();
+    rcu_register_thread();
+    qemu_sem_post(&mis->thread_sync_sem);
+
+    WITH_RCU_READ_LOCK_GUARD() {
+        RAMBLOCK_FOREACH_NOT_IGNORED(rb) {
+            size_t pagesize = qemu_ram_pagesize(rb);
+            ram_addr_t offset;
+
+            for (offset = 0; offset < rb->postcopy_length && !ret;
+                 offset += chunk) {
+                size_t len = MIN(chunk, rb->postcopy_length - offset);
+                size_t start, end;
+                long data_pages;
+
+                if (qatomic_read(&mis->lazy_load_quit)) {
+                    goto out;
+                }
+
+                data_pages = postcopy_lazy_load_read(mis, rb, offset, len, buf,
+                                                     &local_err);
+                if (data_pages < 0) {
+                    ret = -EIO;
+                    break;
+                }
+
+                /* Place each run of host pages that are still missing */
+                for (start = 0; start < len && !ret; start = end) {
+                    while (start < len &&
+                           !postcopy_lazy_load_wanted(rb, offset + start)) {
+                        start += pagesize;
+                    }
+                    for (end = start; end < len &&
+                         postcopy_lazy_load_wanted(rb, offset + end);
+                         end += pagesize) {
+                    }
+                    if (end > start) {
+                        uint8_t *host = rb->host + offset + start;
+
+                        ret = postcopy_lazy_load_place(mis, rb, host,
+                                                       buf + start,
+                                                       end - start);
+                        placed += end - start;
+                    }
+                }
+                if (ret) {
+                    error_setg_errno(&local_err, -ret, "failed to place "
+                                     "pages of %s", rb->idstr);
+                }
+            }
+            if (ret) {
+                break;
+            }
+        }
+    }
+
+    if (ret) {
+        /*
+         * The load cannot complete.  The fault thread keeps serving the
+         * pages that are left, and exits if one of them fails too.
+         */
+        error_prepend(&local_err, "lazy load of guest memory: ");
+        postcopy_lazy_load_fail(mis, local_err);
+        error_report_err(local_err);
+    } else {
+        migration_bh_schedule(postcopy_lazy_load_complete_bh, mis);
+    }
+
+out:
+    trace_postcopy_lazy_load_thread_exit(placed, ret);
+    rcu_unregister_thread();
+    qemu_vfree(buf);
+    return NULL;
+}
+
+int postcopy_lazy_load_setup(MigrationIncomingState *mis)
+{
+    mis->lazy_load = true;
+
+    /* Same as a postcopy incoming migration: the pages must be missing */
+    if (foreach_not_ignored_block(nhp_range, mis) ||
+        postcopy_ram_incoming_init(mis)) {
+        return -1;
+    }
+
+    return postcopy_ram_incoming_setup(mis);
+}
+
+void postcopy_lazy_load_start(MigrationIncomingState *mis)
+{
+    postcopy_thread_create(mis, &mis->lazy_load_thread, "mig/dst/lazy",
+                           postcopy_lazy_load_thread, QEMU_THREAD_JOINABLE);
+    mis->have_lazy_load_thread = true;
+}
+
+void postcopy_lazy_load_cleanup(MigrationIncomingState *mis)
+{
+    if (!mis->lazy_load) {
+        return;
+    }
+
+    if (mis->have_lazy_load_thread) {
+        qatomic_set(&mis->lazy_load_quit, true);
+        qemu_thread_join(&mis->lazy_load_thread);
+        mis->have_lazy_load_thread = false;
+        mis->lazy_load_quit = false;
+    }
+
+    postcopy_ram_incoming_cleanup(mis);
+    ram_lazy_load_cleanup();
+    mis->lazy_load = false;
+}
+
 #else
 /* No target OS support, stubs just fail */
 void fill_destination_postcopy_migration_info(MigrationInfo *info)
@@ -1455,6 +1796,21 @@ int postcopy_wake_shared(struct PostCopyFD *pcfd,
     assert(0);
     return -1;
 }
+
+int postcopy_lazy_load_setup(MigrationIncomingState *mis)
+{
+    error_report("postcopy_lazy_load_setup: No OS support");
+    return -1;
+}
+
+void postcopy_lazy_load_start(MigrationIncomingState *mis)
+{
+    assert(0);
+}
+
+void postcopy_lazy_load_cleanup(MigrationIncomingState *mis)
+{
+}
 #endif
 
 /* ------------------------------------------------------------------------- */
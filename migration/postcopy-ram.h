@@ -37,6 +37,25 @@ int postcopy_ram_incoming_init(MigrationIncomingState *mis);
  */
 int postcopy_ram_incoming_cleanup(MigrationIncomingState *mis);
 
+/*
+ * Lazy loading of a mapped-ram file: empty guest RAM and serve its pages
+ * from the file on fault.  Called once the RAMBlocks have been parsed.
+ */
+int postcopy_lazy_load_setup(MigrationIncomingState *mis);
+
+/*
+ * Start loading the pages the guest has not touched yet in the
+ * background, called when the device state is loaded.  The incoming
+ * migration completes once all of them are in place.
+ */
+void postcopy_lazy_load_start(MigrationIncomingState *mis);
+
+/*
+ * Stop lazy loading and release everything postcopy_lazy_load_setup()
+ * set up.  Does nothing if the load was not lazy.
+ */
+void postcopy_lazy_load_cleanup(MigrationIncomingState *mis);
+
 /*
  * Userfault requires us to mark RAM as NOHUGEPAGE prior to discard
  * however leaving it until after precopy means that most of the precopy
@@ -66,6 +66,7 @@
 
 #if defined(__linux__)
 #include "qemu/userfaultfd.h"
+#include "qemu/uuid.h"
 #endif /* defined(__linux__) */
 
 /***********************************************************/
@@ -104,12 +105,6 @@
  */
 #define MAPPED_RAM_FILE_OFFSET_ALIGNMENT 0x100000
 
-/*
- * When doing mapped-ram migration, this is the amount we read from
- * the pages region in the migration file at a time.
- */
-#define MAPPED_RAM_LOAD_BUF_SIZE 0x100000
-
 XBZRLECacheStats xbzrle_counters;
 
 /* used by the search for pages to send */
@@ -169,6 +164,7 @@ static void XBZRLE_cache_unlock(void)
  * thread, possibly while a migration is in progress.  A running
  * migration may be using the cache and might finish during this call,
  * hence changes to the cache are protected by XBZRLE.lock().
+ * The pages cached so far are moved to the new cache, as many as fit.
  *
  * Returns 0 for success or -1 for error
  *
@@ -201,6 +197,7 @@ int xbzrle_cache_resize(uint64_t new_size, Error **errp)
             goto out;
         }
 
+        cache_move(new_cache, XBZRLE.cache);
         cache_fini(XBZRLE.cache);
         XBZRLE.cache = new_cache;
     }
@@ -383,10 +380,17 @@ struct RAMState {
     uint64_t xbzrle_pages_prev;
     /* Amount of xbzrle encoded bytes since the beginning of the period */
     uint64_t xbzrle_bytes_prev;
+    /* xbzrle cache hits and evictions already added to xbzrle_counters */
+    uint64_t xbzrle_cache_hit_prev;
+    uint64_t xbzrle_cache_eviction_prev;
     /* Are we really using XBZRLE (e.g., after the first round). */
     bool xbzrle_started;
     /* Are we on the last stage of migration */
     bool last_stage;
+    /* Only writing the pages dirtied since the previous mapped-ram file */
+    bool mapped_ram_delta;
+    /* Identity of the mapped-ram file being written, for the next delta */
+    QemuUUID mapped_ram_uuid;
 
     /* total handled target pages at the beginning of period */
     uint64_t target_page_count_prev;
@@ -394,6 +398,8 @@ struct RAMState {
     uint64_t target_page_count;
     /* number of dirty bits in the bitmap */
     uint64_t migration_dirty_pages;
+    /* number of those that were deferred as hot at the last sync */
+    uint64_t migration_hot_pages;
     /*
      * Protects:
      * - dirty/clear bitmap
@@ -419,6 +425,91 @@ typedef struct RAMState RAMState;
 
 static RAMState *ram_state;
 
+/*
+ * With mapped-ram-delta, dirty logging is left running once a mapped-ram
+ * migration completes, so that the next one only has to write the pages
+ * dirtied in between on top of a copy of that file.
+ */
+static struct {
+    /* GLOBAL_DIRTY_MIGRATION is still on since the last migration */
+    bool active;
+    /* ram_list.version when it was left on */
+    uint32_t ram_list_version;
+    /* The file the last migration wrote, and the uuid in its headers */
+    char *fname;
+    QemuUUID uuid;
+    /* Set by the file transport for the migration in progress */
+    char *next_fname;
+    bool next_delta;
+} delta_tracking;
+
+/**
+ * ram_delta_tracking_active: whether the next migration can be a delta
+ *
+ * True if dirty logging has been running since the last mapped-ram
+ * migration completed and the RAMBlocks did not change since.
+ */
+bool ram_delta_tracking_active(void)
+{
+    return delta_tracking.active &&
+           delta_tracking.ram_list_version == ram_list.version;
+}
+
+/**
+ * ram_delta_tracking_base: the file a delta can be written on top of
+ *
+ * Returns the name of the file written by the last mapped-ram migration
+ * if the next one can be a delta on top of it, or NULL.
+ */
+const char *ram_delta_tracking_base(void)
+{
+    return ram_delta_tracking_active() ? delta_tracking.fname : NULL;
+}
+
+/**
+ * ram_delta_tracking_set_file: record the file of an outgoing migration
+ *
+ * @fname: the file being written
+ * @delta: whether it starts as a copy of ram_delta_tracking_base(), so
+ *         that only the pages dirtied since need to be written
+ *
+ * Called by the file transport before the migration starts.  If the
+ * migration completes, @fname becomes the base of the next delta.
+ */
+void ram_delta_tracking_set_file(const char *fname, bool delta)
+{
+    g_free(delta_tracking.next_fname);
+    delta_tracking.next_fname = g_strdup(fname);
+    delta_tracking.next_delta = delta;
+}
+
+/**
+ * ram_delta_tracking_stop: stop the dirty logging kept for a delta
+ *
+ * Called when the next migration can no longer be a delta on top of the
+ * last one, e.g. because mapped-ram-delta was disabled.  The caller must
+ * hold the BQL.
+ */
+void ram_delta_tracking_stop(void)
+{
+    if (delta_tracking.active) {
+        delta_tracking.active = false;
+        memory_global_dirty_log_stop(GLOBAL_DIRTY_MIGRATION);
+        trace_ram_delta_tracking(false);
+    }
+}
+
+/*
+ * With defer-hot-pages, precopy iterations skip the pages in
+ * RAMBlock.hot_bmap.  They are sent once the guest is stopped, or by
+ * postcopy.
+ */
+static bool ram_defer_hot_pages(RAMState *rs)
+{
+    return migrate_defer_hot_pages() && !rs->last_stage &&
+           !migration_in_postcopy();
+}
+
 static NotifierWithReturnList precopy_notifier_list;
 
 /* Whether postcopy has queued requests? */
@@ -731,6 +822,14 @@ static void pss_find_next_dirty(PageSearchStatus *pss)
     }
 
     pss->page = find_next_bit(bitmap, size, pss->page);
+
+    /* Pages within a host page being sent can't be left behind */
+    if (rb->hot_bmap && !pss->host_page_sending &&
+        ram_defer_hot_pages(ram_state)) {
+        while (pss->page < size && test_bit(pss->page, rb->hot_bmap)) {
+            pss->page = find_next_bit(bitmap, size, pss->page + 1);
+        }
+    }
 }
 
 static void migration_clear_memory_region_dirty_bitmap(RAMBlock *rb,
@@ -912,11 +1011,69 @@ bool ramblock_page_is_discarded(RAMBlock *rb, ram_addr_t start)
     return false;
 }
 
+/*
+ * ramblock_sync_hot_pages: sync the dirty bitmap and reclassify hot pages
+ *
+ * A page is hot when it was written to both since the previous sync and
+ * between the two syncs before that.  The pages still pending from the
+ * last round are taken out of the bitmap during the sync, so that what
+ * the sync sets is exactly what the guest wrote since then.
+ *
+ * Returns the number of pages that became dirty, as
+ * cpu_physical_memory_sync_dirty_bitmap() does.
+ *
+ * Called with RCU critical section
+ */
+static uint64_t ramblock_sync_hot_pages(RAMState *rs, RAMBlock *rb)
+{
+    unsigned long pages = rb->used_length >> TARGET_PAGE_BITS;
+    unsigned long *pending = rb->pending_bmap;
+    uint64_t new_dirty_pages = 0;
+    unsigned long i, page;
+
+    bitmap_copy(pending, rb->bmap, pages);
+    bitmap_zero(rb->bmap, pages);
+    cpu_physical_memory_sync_dirty_bitmap(rb, 0, rb->used_length);
+
+    for (i = 0; i < BITS_TO_LONGS(pages); i++) {
+        unsigned long written = rb->bmap[i];
+
+        new_dirty_pages += ctpopl(written & ~pending[i]);
+        rb->hot_bmap[i] = written & rb->last_dirty_bmap[i];
+        rb->last_dirty_bmap[i] = written;
+        rb->bmap[i] = written | pending[i];
+        rs->migration_hot_pages += ctpopl(rb->hot_bmap[i]);
+    }
+
+    /*
+     * Hot pages are not sent, so nothing would clear their dirty log
+     * before the next sync and further writes would go unnoticed.  Do it
+     * here instead.
+     */
+    if (rb->clear_bmap) {
+        unsigned long chunk = 1UL << rb->clear_bmap_shift;
+
+        for (page = find_first_bit(rb->hot_bmap, pages); page < pages;
+             page = find_next_bit(rb->hot_bmap, pages,
+                                  QEMU_ALIGN_UP(page + 1, chunk))) {
+            migration_clear_memory_region_dirty_bitmap(rb, page);
+        }
+    }
+
+    return new_dirty_pages;
+}
+
 /* Called with RCU critical section */
 static void ramblock_sync_dirty_bitmap(RAMState *rs, RAMBlock *rb)
 {
-    uint64_t new_dirty_pages =
-        cpu_physical_memory_sync_dirty_bitmap(rb, 0, rb->used_length);
+    uint64_t new_dirty_pages;
+
+    if (rb->hot_bmap) {
+        new_dirty_pages = ramblock_sync_hot_pages(rs, rb);
+    } else {
+        new_dirty_pages =
+            cpu_physical_memory_sync_dirty_bitmap(rb, 0, rb->used_length);
+    }
 
     rs->migration_dirty_pages += new_dirty_pages;
     rs->num_dirty_pages_period += new_dirty_pages;
@@ -947,6 +1104,7 @@ uint64_t ram_get_total_transferred_pages(void)
 {
     return stat64_get(&mig_stats.normal_pages) +
         stat64_get(&mig_stats.zero_pages) +
+        stat64_get(&mig_stats.dedup_pages) +
         xbzrle_counters.pages;
 }
 
@@ -979,6 +1137,20 @@ static void migration_update_rates(RAMState *rs, int64_t end_time)
         }
         rs->xbzrle_pages_prev = xbzrle_counters.pages;
         rs->xbzrle_bytes_prev = xbzrle_counters.bytes;
+
+        XBZRLE_cache_lock();
+        if (XBZRLE.cache) {
+            PageCacheStats cache_stats;
+
+            cache_get_stats(XBZRLE.cache, &cache_stats);
+            xbzrle_counters.cache_hit += cache_stats.hits -
+                                         rs->xbzrle_cache_hit_prev;
+            xbzrle_counters.cache_eviction += cache_stats.evictions -
+                                              rs->xbzrle_cache_eviction_prev;
+            rs->xbzrle_cache_hit_prev = cache_stats.hits;
+            rs->xbzrle_cache_eviction_prev = cache_stats.evictions;
+        }
+        XBZRLE_cache_unlock();
     }
 }
 
@@ -1035,7 +1207,7 @@ static void migration_trigger_throttle(RAMState *rs)
             trace_migration_throttle();
             mig_throttle_guest_down(bytes_dirty_period,
                                     bytes_dirty_threshold);
-        } else if (migrate_dirty_limit()) {
+        } else if (migrate_dirty_limit() && !migrate_convergence_control()) {
             migration_dirty_limit_guest();
         }
     }
@@ -1057,6 +1229,7 @@ static void migration_bitmap_sync(RAMState *rs, bool last_stage)
 
     WITH_QEMU_LOCK_GUARD(&rs->bitmap_mutex) {
         WITH_RCU_READ_LOCK_GUARD() {
+            rs->migration_hot_pages = 0;
             RAMBLOCK_FOREACH_NOT_IGNORED(block) {
                 ramblock_sync_dirty_bitmap(rs, block);
             }
@@ -1066,6 +1239,9 @@ static void migration_bitmap_sync(RAMState *rs, bool last_stage)
 
     memory_global_after_dirty_log_sync();
     trace_migration_bitmap_sync_end(rs->num_dirty_pages_period);
+    if (migrate_defer_hot_pages()) {
+        trace_migration_bitmap_sync_hot(rs->migration_hot_pages);
+    }
 
     end_time = qemu_clock_get_ms(QEMU_CLOCK_REALTIME);
 
@@ -2362,6 +2538,12 @@ static void ram_bitmaps_destroy(void)
         block->bmap = NULL;
         g_free(block->file_bmap);
         block->file_bmap = NULL;
+        g_free(block->last_dirty_bmap);
+        block->last_dirty_bmap = NULL;
+        g_free(block->hot_bmap);
+        block->hot_bmap = NULL;
+        g_free(block->pending_bmap);
+        block->pending_bmap = NULL;
     }
 }
 
@@ -2374,7 +2556,17 @@ static void ram_save_cleanup(void *opaque)
         /* caller have hold BQL or is in a bh, so there is
          * no writing race against the migration bitmap
          */
-        if (global_dirty_tracking & GLOBAL_DIRTY_MIGRATION) {
+        if (migrate_mapped_ram_delta() &&
+            (global_dirty_tracking & GLOBAL_DIRTY_MIGRATION) &&
+            migrate_get_current()->state == MIGRATION_STATUS_COMPLETED) {
+            /* Keep tracking for the next delta */
+            delta_tracking.active = true;
+            delta_tracking.ram_list_version = ram_list.version;
+            delta_tracking.uuid = (*rsp)->mapped_ram_uuid;
+            g_free(delta_tracking.fname);
+            delta_tracking.fname = g_steal_pointer(&delta_tracking.next_fname);
+            trace_ram_delta_tracking(true);
+        } else if (global_dirty_tracking & GLOBAL_DIRTY_MIGRATION) {
             /*
              * do not stop dirty log without starting it, since
              * memory_global_dirty_log_stop will assert that
@@ -2384,6 +2576,8 @@ static void ram_save_cleanup(void *opaque)
         }
     }
 
+    g_clear_pointer(&delta_tracking.next_fname, g_free);
+    delta_tracking.next_delta = false;
     ram_bitmaps_destroy();
 
     xbzrle_cleanup();
@@ -2714,7 +2908,7 @@ static bool ram_state_init(RAMState **rsp, Error **errp)
     return true;
 }
 
-static void ram_list_init_bitmaps(void)
+static void ram_list_init_bitmaps(bool delta)
 {
     MigrationState *ms = migrate_get_current();
     RAMBlock *block;
@@ -2744,12 +2938,21 @@ static void ram_list_init_bitmaps(void)
              * new migration after a failed migration, ram_list.
              * dirty_memory[DIRTY_MEMORY_MIGRATION] don't include the whole
              * guest memory.
+             * A mapped-ram delta starts empty instead: the first sync
+             * brings in what was dirtied since the previous migration.
              */
             block->bmap = bitmap_new(pages);
-            bitmap_set(block->bmap, 0, pages);
+            if (!delta) {
+                bitmap_set(block->bmap, 0, pages);
+            }
             if (migrate_mapped_ram()) {
                 block->file_bmap = bitmap_new(pages);
             }
+            if (migrate_defer_hot_pages()) {
+                block->last_dirty_bmap = bitmap_new(pages);
+                block->hot_bmap = bitmap_new(pages);
+                block->pending_bmap = bitmap_new(pages);
+            }
             block->clear_bmap_shift = shift;
             block->clear_bmap = bitmap_new(clear_bmap_size(pages, shift));
         }
@@ -2775,8 +2978,20 @@ static bool ram_init_bitmaps(RAMState *rs, Error **errp)
 
     qemu_mutex_lock_ramlist();
 
+    rs->mapped_ram_delta = migrate_mapped_ram_delta() &&
+                           delta_tracking.next_delta &&
+                           ram_delta_tracking_active();
+    if (rs->mapped_ram_delta) {
+        rs->migration_dirty_pages = 0;
+    }
+    if (migrate_mapped_ram_delta()) {
+        qemu_uuid_generate(&rs->mapped_ram_uuid);
+    }
+    /* Dirty logging left on by the previous migration is ours now */
+    delta_tracking.active = false;
+
     WITH_RCU_READ_LOCK_GUARD() {
-        ram_list_init_bitmaps();
+        ram_list_init_bitmaps(rs->mapped_ram_delta);
         /* We don't use dirty log with background snapshots */
         if (!migrate_background_snapshot()) {
             ret = memory_global_dirty_log_start(GLOBAL_DIRTY_MIGRATION, errp);
@@ -2900,7 +3115,12 @@ void qemu_guest_free_page_hint(void *addr, size_t len)
     }
 }
 
-#define MAPPED_RAM_HDR_VERSION 1
+/*
+ * Version 2 adds the uuid.  It is only written with mapped-ram-delta, so
+ * that other files can still be loaded by QEMU versions that only know
+ * version 1.
+ */
+#define MAPPED_RAM_HDR_VERSION 2
 struct MappedRamHeader {
     uint32_t version;
     /*
@@ -2918,17 +3138,76 @@ struct MappedRamHeader {
      * are stored.
      */
     uint64_t pages_offset;
+    /*
+     * Identifies the file, so that a delta is only written on top of
+     * the file of the previous migration.  Version 2 only.
+     */
+    QemuUUID uuid;
 } QEMU_PACKED;
 typedef struct MappedRamHeader MappedRamHeader;
 
-static void mapped_ram_setup_ramblock(QEMUFile *file, RAMBlock *block)
+/*
+ * For a delta, the file starts as a copy of the previous migration.  Check
+ * that it is the file that migration wrote, that @block is laid out at the
+ * same place, and start from its bitmap, so that the pages that are not
+ * rewritten stay valid.
+ */
+static bool mapped_ram_delta_setup_ramblock(QEMUFile *file, RAMBlock *block,
+                                            off_t header_offset,
+                                            size_t bitmap_size, Error **errp)
+{
+    MappedRamHeader old;
+
+    if (qemu_get_buffer_at(file, (uint8_t *)&old, sizeof(old),
+                           header_offset) != sizeof(old)) {
+        error_setg(errp, "Could not read the mapped-ram header of ramblock "
+                   "%s from the previous migration", block->idstr);
+        return false;
+    }
+
+    if (be32_to_cpu(old.version) != MAPPED_RAM_HDR_VERSION ||
+        !qemu_uuid_is_equal(&old.uuid, &delta_tracking.uuid)) {
+        error_setg(errp, "Ramblock %s was not written by the previous "
+                   "migration, a full migration is needed", block->idstr);
+        return false;
+    }
+
+    if (be64_to_cpu(old.page_size) != TARGET_PAGE_SIZE ||
+        be64_to_cpu(old.bitmap_offset) != block->bitmap_offset ||
+        be64_to_cpu(old.pages_offset) != block->pages_offset) {
+        error_setg(errp, "Ramblock %s does not match the previous migration "
+                   "in the file, a full migration is needed", block->idstr);
+        return false;
+    }
+
+    if (qemu_get_buffer_at(file, (uint8_t *)block->file_bmap, bitmap_size,
+                           block->bitmap_offset) != bitmap_size) {
+        error_setg(errp, "Could not read the bitmap of ramblock %s from "
+                   "the previous migration", block->idstr);
+        return false;
+    }
+
+    trace_mapped_ram_delta_setup(block->idstr, block->pages_offset);
+    return true;
+}
+
+static bool mapped_ram_setup_ramblock(QEMUFile *file, RAMBlock *block,
+                                      RAMState *rs, Error **errp)
 {
     g_autofree MappedRamHeader *header = NULL;
     size_t header_size, bitmap_size;
+    off_t header_offset;
+    uint32_t version;
     long num_pages;
 
     header = g_new0(MappedRamHeader, 1);
-    header_size = sizeof(MappedRamHeader);
+    if (migrate_mapped_ram_delta()) {
+        version = MAPPED_RAM_HDR_VERSION;
+        header_size = sizeof(MappedRamHeader);
+    } else {
+        version = 1;
+        header_size = offsetof(MappedRamHeader, uuid);
+    }
 
     num_pages = block->used_length >> TARGET_PAGE_BITS;
     bitmap_size = BITS_TO_LONGS(num_pages) * sizeof(unsigned long);
@@ -2938,26 +3217,35 @@ static void mapped_ram_setup_ramblock(QEMUFile *file, RAMBlock *block)
      * go as they are written at the end of migration and during the
      * iterative phase, respectively.
      */
-    block->bitmap_offset = qemu_get_offset(file) + header_size;
+    header_offset = qemu_get_offset(file);
+    block->bitmap_offset = header_offset + header_size;
     block->pages_offset = ROUND_UP(block->bitmap_offset +
                                    bitmap_size,
                                    MAPPED_RAM_FILE_OFFSET_ALIGNMENT);
 
-    header->version = cpu_to_be32(MAPPED_RAM_HDR_VERSION);
+    if (rs->mapped_ram_delta &&
+        !mapped_ram_delta_setup_ramblock(file, block, header_offset,
+                                         bitmap_size, errp)) {
+        return false;
+    }
+
+    header->version = cpu_to_be32(version);
     header->page_size = cpu_to_be64(TARGET_PAGE_SIZE);
     header->bitmap_offset = cpu_to_be64(block->bitmap_offset);
     header->pages_offset = cpu_to_be64(block->pages_offset);
+    header->uuid = rs->mapped_ram_uuid;
 
     qemu_put_buffer(file, (uint8_t *) header, header_size);
 
     /* prepare offset for next ramblock */
     qemu_set_offset(file, block->pages_offset + block->used_length, SEEK_SET);
+    return true;
 }
 
 static bool mapped_ram_read_header(QEMUFile *file, MappedRamHeader *header,
                                    Error **errp)
 {
-    size_t ret, header_size = sizeof(MappedRamHeader);
+    size_t ret, header_size = offsetof(MappedRamHeader, uuid);
 
     ret = qemu_get_buffer(file, (uint8_t *)header, header_size);
     if (ret != header_size) {
@@ -2976,6 +3264,17 @@ static bool mapped_ram_read_header(QEMUFile *file, MappedRamHeader *header,
         return false;
     }
 
+    if (header->version >= 2) {
+        header_size = sizeof(header->uuid);
+        ret = qemu_get_buffer(file, (uint8_t *)&header->uuid, header_size);
+        if (ret != header_size) {
+            error_setg(errp, "Could not read whole mapped-ram migration "
+                       "header (expected %zd, got %zd bytes)", header_size,
+                       ret);
+            return false;
+        }
+    }
+
     header->page_size = be64_to_cpu(header->page_size);
     header->bitmap_offset = be64_to_cpu(header->bitmap_offset);
     header->pages_offset = be64_to_cpu(header->pages_offset);
@@ -3035,8 +3334,9 @@ static int ram_save_setup(QEMUFile *f, void *opaque, Error **errp)
                 qemu_put_be64(f, block->mr->addr);
             }
 
-            if (migrate_mapped_ram()) {
-                mapped_ram_setup_ramblock(f, block);
+            if (migrate_mapped_ram() &&
+                !mapped_ram_setup_ramblock(f, block, *rsp, errp)) {
+                return -1;
             }
         }
     }
@@ -3310,7 +3610,17 @@ static void ram_state_pending_estimate(void *opaque, uint64_t *must_precopy,
     RAMState **temp = opaque;
     RAMState *rs = *temp;
 
-    uint64_t remaining_size = rs->migration_dirty_pages * TARGET_PAGE_SIZE;
+    uint64_t remaining_pages = rs->migration_dirty_pages;
+    uint64_t remaining_size;
+
+    /*
+     * Leave the deferred hot pages out, so that once everything else has
+     * been sent we go for an exact sync, which reclassifies them.
+     */
+    if (ram_defer_hot_pages(rs)) {
+        remaining_pages -= MIN(rs->migration_hot_pages, remaining_pages);
+    }
+    remaining_size = remaining_pages * TARGET_PAGE_SIZE;
 
     if (migrate_postcopy_ram()) {
         /* We can do postcopy, and all the data is postcopiable */
@@ -3630,12 +3940,17 @@ static int ram_load_cleanup(void *opaque)
 {
     RAMBlock *rb;
 
+    xbzrle_load_cleanup();
+
+    /* RAM is still being loaded, see ram_lazy_load_cleanup() */
+    if (migration_incoming_get_current()->lazy_load) {
+        return 0;
+    }
+
     RAMBLOCK_FOREACH_NOT_IGNORED(rb) {
         qemu_ram_block_writeback(rb);
     }
 
-    xbzrle_load_cleanup();
-
     RAMBLOCK_FOREACH_NOT_IGNORED(rb) {
         g_free(rb->receivedmap);
         rb->receivedmap = NULL;
@@ -3644,6 +3959,26 @@ static int ram_load_cleanup(void *opaque)
     return 0;
 }
 
+/**
+ * ram_lazy_load_cleanup: release the state of a lazy mapped-ram load
+ *
+ * Called once the pages are all in place, or the load failed.
+ */
+void ram_lazy_load_cleanup(void)
+{
+    RAMBlock *rb;
+
+    WITH_RCU_READ_LOCK_GUARD() {
+        RAMBLOCK_FOREACH_NOT_IGNORED(rb) {
+            qemu_ram_block_writeback(rb);
+            g_free(rb->file_bmap);
+            rb->file_bmap = NULL;
+            g_free(rb->receivedmap);
+            rb->receivedmap = NULL;
+        }
+    }
+}
+
 /**
  * ram_postcopy_incoming_init: allocate postcopy data structures
  *
@@ -3915,6 +4250,7 @@ static bool read_ramblock_mapped_ram(QEMUFile *f, RAMBlock *block,
     ram_addr_t offset;
     void *host;
     size_t read, unread, size;
+    size_t read_size = migrate_mapped_ram_read_size();
 
     for (set_bit_idx = find_first_bit(bitmap, num_pages);
          set_bit_idx < num_pages;
@@ -3933,7 +4269,7 @@ static bool read_ramblock_mapped_ram(QEMUFile *f, RAMBlock *block,
                 return false;
             }
 
-            size = MIN(unread, MAPPED_RAM_LOAD_BUF_SIZE);
+            size = MIN(unread, read_size);
 
             if (migrate_multifd()) {
                 read = ram_load_multifd_pages(host, size,
@@ -3998,7 +4334,11 @@ static void parse_ramblock_mapped_ram(QEMUFile *f, RAMBlock *block,
         return;
     }
 
-    if (!read_ramblock_mapped_ram(f, block, num_pages, bitmap, errp)) {
+    if (migrate_mapped_ram_lazy_load()) {
+        /* Pages are read on demand, see postcopy_lazy_load_setup() */
+        g_free(block->file_bmap);
+        block->file_bmap = g_steal_pointer(&bitmap);
+    } else if (!read_ramblock_mapped_ram(f, block, num_pages, bitmap, errp)) {
         return;
     }
 
@@ -4212,6 +4552,9 @@ static int ram_load_precopy(QEMUFile *f)
             if (migrate_mapped_ram()) {
                 multifd_recv_sync_main();
             }
+            if (!ret && migrate_mapped_ram_lazy_load()) {
+                ret = postcopy_lazy_load_setup(mis);
+            }
             break;
 
         case RAM_SAVE_FLAG_ZERO:
@@ -4508,6 +4851,9 @@ static void ram_mig_ram_block_resized(RAMBlockNotifier *n, void *host,
         error_setg(&err, "RAM block '%s' resized during precopy.", rb->idstr);
         migration_cancel(err);
         error_free(err);
+    } else {
+        /* The next mapped-ram file will not have the same layout */
+        ram_delta_tracking_stop();
     }
 
     switch (ps) {
@@ -4541,7 +4887,22 @@ static void ram_mig_ram_block_resized(RAMBlockNotifier *n, void *host,
     }
 }
 
+/* RAMBlocks coming or going also change the layout of the next file */
+static void ram_mig_ram_block_added(RAMBlockNotifier *n, void *host,
+                                    size_t size, size_t max_size)
+{
+    ram_delta_tracking_stop();
+}
+
+static void ram_mig_ram_block_removed(RAMBlockNotifier *n, void *host,
+                                      size_t size, size_t max_size)
+{
+    ram_delta_tracking_stop();
+}
+
 static RAMBlockNotifier ram_mig_ram_notifier = {
+    .ram_block_added = ram_mig_ram_block_added,
+    .ram_block_removed = ram_mig_ram_block_removed,
     .ram_block_resized = ram_mig_ram_block_resized,
 };
 
@@ -58,6 +58,11 @@ void ram_postcopy_send_discard_bitmap(MigrationState *ms);
 /* For incoming postcopy discard */
 int ram_discard_range(const char *block_name, uint64_t start, size_t length);
 int ram_postcopy_incoming_init(MigrationIncomingState *mis);
+void ram_lazy_load_cleanup(void);
+bool ram_delta_tracking_active(void);
+const char *ram_delta_tracking_base(void);
+void ram_delta_tracking_set_file(const char *fname, bool delta);
+void ram_delta_tracking_stop(void);
 int ram_load_postcopy(QEMUFile *f, int channel);
 
 void ram_handle_zero(void *host, uint64_t size);
@@ -15,9 +15,165 @@
 #include "qemu/host-utils.h"
 #include "xbzrle.h"
 
-#if defined(CONFIG_AVX512BW_OPT)
+#if defined(CONFIG_AVX2_OPT) || defined(CONFIG_AVX512BW_OPT)
 #include <immintrin.h>
 #include "host/cpuinfo.h"
+#define XBZRLE_ACCEL
+#endif
+
+#if defined(__aarch64__) && !HOST_BIG_ENDIAN
+#include <arm_neon.h>
+#define XBZRLE_NEON
+#define XBZRLE_ACCEL
+#endif
+
+#if defined(CONFIG_AVX2_OPT) || defined(XBZRLE_NEON)
+static inline int xbzrle_put_nzrun(uint8_t *dst, int d, int dlen,
+                                   uint8_t *src, uint32_t len)
+{
+    if (d + 2 > dlen) {
+        return -1;
+    }
+    d += uleb128_encode_small(dst + d, len);
+    if (d + len > dlen) {
+        return -1;
+    }
+    memcpy(dst + d, src, len);
+    return d + len;
+}
+
+/* Equality mask of the first @n < 64 bytes, one bit per byte */
+static uint64_t xbzrle_eq_mask_tail(uint8_t *old_buf, uint8_t *new_buf, int n)
+{
+    uint64_t mask = 0;
+    int i;
+
+    for (i = 0; i < n; i++) {
+        mask |= (uint64_t)(old_buf[i] == new_buf[i]) << i;
+    }
+    return mask;
+}
+
+/*
+ * Encoder shared by the vector implementations: @eq_mask compares 64
+ * bytes and returns a mask with bit i set if byte i is unchanged, and
+ * the runs are then found with ctz64.  Being always inlined, it picks
+ * up the target attribute of its caller.
+ */
+static inline int QEMU_ALWAYS_INLINE
+xbzrle_encode_buffer_mask64(uint8_t *old_buf, uint8_t *new_buf, int slen,
+                            uint8_t *dst, int dlen,
+                            uint64_t (*eq_mask)(uint8_t *, uint8_t *))
+{
+    uint32_t run_len = 0;
+    bool in_zrun = true;
+    int d = 0, i = 0;
+
+    while (i < slen) {
+        int n = MIN(slen - i, 64);
+        uint64_t eq = n == 64 ? eq_mask(old_buf + i, new_buf + i)
+                              : xbzrle_eq_mask_tail(old_buf + i,
+                                                    new_buf + i, n);
+        int pos = 0;
+
+        /* 64 bytes that extend the current run, the common case */
+        if (n == 64 && eq == (in_zrun ? UINT64_MAX : 0)) {
+            run_len += 64;
+            i += 64;
+            continue;
+        }
+
+        while (pos < n) {
+            int k = in_zrun ? ctz64(~(eq >> pos)) : ctz64(eq >> pos);
+
+            k = MIN(k, n - pos);
+            run_len += k;
+            pos += k;
+            if (pos == n) {
+                break;
+            }
+
+            /* the current run ends at i + pos */
+            if (in_zrun) {
+                if (d + 2 > dlen) {
+                    return -1;
+                }
+                d += uleb128_encode_small(dst + d, run_len);
+            } else {
+                d = xbzrle_put_nzrun(dst, d, dlen,
+                                     new_buf + i + pos - run_len, run_len);
+                if (d < 0) {
+                    return -1;
+                }
+            }
+            run_len = 0;
+            in_zrun = !in_zrun;
+        }
+        i += n;
+    }
+
+    /* A trailing zero run, like an unchanged buffer, is not encoded */
+    if (!in_zrun) {
+        d = xbzrle_put_nzrun(dst, d, dlen, new_buf + slen - run_len, run_len);
+    }
+    return d;
+}
+#endif
+
+#if defined(CONFIG_AVX2_OPT)
+static inline uint64_t __attribute__((target("avx2")))
+xbzrle_eq_mask_avx2(uint8_t *old_buf, uint8_t *new_buf)
+{
+    __m256i o0 = _mm256_loadu_si256((__m256i *)old_buf);
+    __m256i o1 = _mm256_loadu_si256((__m256i *)(old_buf + 32));
+    __m256i n0 = _mm256_loadu_si256((__m256i *)new_buf);
+    __m256i n1 = _mm256_loadu_si256((__m256i *)(new_buf + 32));
+    uint32_t lo = _mm256_movemask_epi8(_mm256_cmpeq_epi8(o0, n0));
+    uint32_t hi = _mm256_movemask_epi8(_mm256_cmpeq_epi8(o1, n1));
+
+    return ((uint64_t)hi << 32) | lo;
+}
+
+static int __attribute__((target("avx2")))
+xbzrle_encode_buffer_avx2(uint8_t *old_buf, uint8_t *new_buf, int slen,
+                          uint8_t *dst, int dlen)
+{
+    return xbzrle_encode_buffer_mask64(old_buf, new_buf, slen, dst, dlen,
+                                       xbzrle_eq_mask_avx2);
+}
+#endif
+
+#if defined(XBZRLE_NEON)
+static inline uint64_t xbzrle_eq_mask_neon(uint8_t *old_buf, uint8_t *new_buf)
+{
+    static const uint8_t bits[16] = {
+        1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128
+    };
+    uint8x16_t w = vld1q_u8(bits);
+    uint8x16_t c0, c1, c2, c3;
+
+    c0 = vandq_u8(vceqq_u8(vld1q_u8(old_buf), vld1q_u8(new_buf)), w);
+    c1 = vandq_u8(vceqq_u8(vld1q_u8(old_buf + 16), vld1q_u8(new_buf + 16)), w);
+    c2 = vandq_u8(vceqq_u8(vld1q_u8(old_buf + 32), vld1q_u8(new_buf + 32)), w);
+    c3 = vandq_u8(vceqq_u8(vld1q_u8(old_buf + 48), vld1q_u8(new_buf + 48)), w);
+
+    /* Three rounds of pairwise adds fold each group of 8 bytes into one */
+    c0 = vpaddq_u8(c0, c1);
+    c2 = vpaddq_u8(c2, c3);
+    c0 = vpaddq_u8(c0, c2);
+    c0 = vpaddq_u8(c0, c0);
+    return vgetq_lane_u64(vreinterpretq_u64_u8(c0), 0);
+}
+
+static int xbzrle_encode_buffer_neon(uint8_t *old_buf, uint8_t *new_buf,
+                                     int slen, uint8_t *dst, int dlen)
+{
+    return xbzrle_encode_buffer_mask64(old_buf, new_buf, slen, dst, dlen,
+                                       xbzrle_eq_mask_neon);
+}
+#endif
+
+#if defined(CONFIG_AVX512BW_OPT)
 
 static int __attribute__((target("avx512bw")))
 xbzrle_encode_buffer_avx512(uint8_t *old_buf, uint8_t *new_buf, int slen,
@@ -136,20 +292,35 @@ xbzrle_encode_buffer_avx512(uint8_t *old_buf, uint8_t *new_buf, int slen,
     }
     return d;
 }
+#endif
 
-static int xbzrle_encode_buffer_int(uint8_t *old_buf, uint8_t *new_buf,
-                                    int slen, uint8_t *dst, int dlen);
+#if defined(XBZRLE_ACCEL)
+static int G_GNUC_UNUSED
+xbzrle_encode_buffer_int(uint8_t *old_buf, uint8_t *new_buf,
+                         int slen, uint8_t *dst, int dlen);
 
 static int (*accel_func)(uint8_t *, uint8_t *, int, uint8_t *, int);
 
 static void __attribute__((constructor)) init_accel(void)
 {
+#if defined(XBZRLE_NEON)
+    /* Advanced SIMD is part of the base AArch64 architecture */
+    accel_func = xbzrle_encode_buffer_neon;
+#else
     unsigned info = cpuinfo_init();
+
+    accel_func = xbzrle_encode_buffer_int;
+#if defined(CONFIG_AVX2_OPT)
+    if (info & CPUINFO_AVX2) {
+        accel_func = xbzrle_encode_buffer_avx2;
+    }
+#endif
+#if defined(CONFIG_AVX512BW_OPT)
     if (info & CPUINFO_AVX512BW) {
         accel_func = xbzrle_encode_buffer_avx512;
-    } else {
-        accel_func = xbzrle_encode_buffer_int;
     }
+#endif
+#endif
 }
 
 int xbzrle_encode_buffer(uint8_t *old_buf, uint8_t *new_buf, int slen,
@@ -1273,6 +1273,32 @@ static int is_allocated_sectors_min(const uint8_t *buf, int n, int *pnum,
     return 1;
 }
 
+/*
+ * Returns true iff the first cluster of buf contains at least one non-zero
+ * byte, and sets *pnum to the number of sectors of the whole clusters at the
+ * start of buf that are all zero or all contain non-zero data, like it.
+ * buf must start at a cluster boundary.
+ */
+static bool is_allocated_clusters(const uint8_t *buf, int n, int *pnum,
+                                  int cluster_sectors)
+{
+    int i = MIN(n, cluster_sectors);
+    bool is_zero = buffer_is_zero(buf, i * BDRV_SECTOR_SIZE);
+
+    while (i < n) {
+        int len = MIN(n - i, cluster_sectors);
+
+        if (buffer_is_zero(buf + i * BDRV_SECTOR_SIZE,
+                           len * BDRV_SECTOR_SIZE) != is_zero) {
+            break;
+        }
+        i += len;
+    }
+
+    *pnum = i;
+    return !is_zero;
+}
+
 /*
  * Compares two buffers chunk by chunk, where @chsize is the chunk size.
  * If @chsize is 0, default chunk size of BDRV_SECTOR_SIZE is used.
@@ -1682,6 +1708,7 @@ typedef struct ImgConvertState {
     BlockBackend *target;
     bool has_zero_init;
     bool compressed;
+    bool compressed_multi_cluster;
     bool target_is_new;
     bool target_has_backing;
     int64_t target_backing_sectors; /* negative if unknown */
@@ -1897,14 +1924,14 @@ static int coroutine_fn convert_co_write(ImgConvertState *s, int64_t sector_num,
              * is real non-zero data, we must write it. Otherwise we can treat
              * it as zero sectors.
              * Compressed clusters need to be written as a whole, so in that
-             * case we can only save the write if the buffer is completely
-             * zeroed. */
+             * case we can only save the write of completely zeroed
+             * clusters. */
             if (!s->min_sparse ||
                 (!s->compressed &&
                  is_allocated_sectors_min(buf, n, &n, s->min_sparse,
                                           sector_num, s->alignment)) ||
                 (s->compressed &&
-                 !buffer_is_zero(buf, n * BDRV_SECTOR_SIZE)))
+                 is_allocated_clusters(buf, n, &n, s->cluster_sectors)))
             {
                 ret = blk_co_pwrite(s->target, sector_num << BDRV_SECTOR_BITS,
                                     n << BDRV_SECTOR_BITS, buf, flags);
@@ -2105,14 +2132,20 @@ static int convert_do_copy(ImgConvertState *s)
         bdrv_graph_rdunlock_main_loop();
     }
 
-    /* Allocate buffer for copied data. For compressed images, only one cluster
-     * can be copied at a time. */
+    /* Allocate buffer for copied data. For compressed images, only whole
+     * clusters can be copied, and only one at a time unless the target can
+     * compress several clusters in one request (in parallel). */
     if (s->compressed) {
         if (s->cluster_sectors <= 0 || s->cluster_sectors > s->buf_sectors) {
             error_report("invalid cluster size");
             return -EINVAL;
         }
-        s->buf_sectors = s->cluster_sectors;
+        if (s->compressed_multi_cluster) {
+            s->buf_sectors = QEMU_ALIGN_DOWN(s->buf_sectors,
+                                             s->cluster_sectors);
+        } else {
+            s->buf_sectors = s->cluster_sectors;
+        }
     }
 
     while (sector_num < s->total_sectors) {
@@ -2776,6 +2809,7 @@ static int img_convert(int argc, char **argv)
         }
     } else {
         s.compressed = s.compressed || bdi.needs_compressed_writes;
+        s.compressed_multi_cluster = bdi.multi_cluster_compressed_writes;
         s.cluster_sectors = bdi.cluster_size / BDRV_SECTOR_SIZE;
     }
 
@@ -187,6 +187,8 @@ DEF("accel", HAS_ARG, QEMU_OPTION_accel,
     "                one-insn-per-tb=on|off (one guest instruction per TCG translation block)\n"
     "                split-wx=on|off (enable TCG split w^x mapping)\n"
     "                tb-size=n (TCG translation block cache size)\n"
+    "                victim-tlb-size=n (TCG victim TLB entries per MMU mode, default 8)\n"
+    "                victim-tlb-policy=fifo|lru (TCG victim TLB replacement policy)\n"
     "                dirty-ring-size=n (KVM dirty ring GFN count, default 0)\n"
     "                eager-split-size=n (KVM Eager Page Split chunk size, default 0, disabled. ARM only)\n"
     "                notify-vmexit=run|internal-error|disable,notify-window=n (enable notify VM exit and set notify window, x86 only)\n"
@@ -230,6 +232,21 @@ SRST
     ``tb-size=n``
         Controls the size (in MiB) of the TCG translation block cache.
 
+    ``victim-tlb-size=n``
+        Controls the number of entries (1 to 64, default 8) in the fully
+        associative victim TLB that backs each of the TCG softmmu TLBs.
+        Larger values can help guests whose working set conflicts in
+        the direct mapped TLB, at the cost of a longer search on each
+        TLB miss.
+
+    ``victim-tlb-policy=fifo|lru``
+        Selects which victim TLB entry is replaced when an entry is
+        evicted from the main TCG softmmu TLB. ``fifo`` (the default)
+        cycles through the entries in order; ``lru`` replaces the entry
+        that has gone longest without being used. TLB miss, victim hit
+        and fill counts are available per vCPU from ``query-stats``
+        with the ``tcg`` provider.
+
     ``thread=single|multi``
         Controls number of TCG threads. When the TCG is multi-threaded
         there will be one thread per vCPU therefore taking advantage of
@@ -6032,7 +6049,7 @@ SRST
 
             CN=laptop.example.com,O=Example Home,L=London,ST=London,C=GB
 
-    ``-object iothread,id=id,poll-max-ns=poll-max-ns,poll-grow=poll-grow,poll-shrink=poll-shrink,aio-max-batch=aio-max-batch``
+    ``-object iothread,id=id,poll-max-ns=poll-max-ns,poll-grow=poll-grow,poll-shrink=poll-shrink,aio-max-batch=aio-max-batch,io-uring-sqpoll-idle=io-uring-sqpoll-idle``
         Creates a dedicated event loop thread that devices can be
         assigned to. This is known as an IOThread. By default device
         emulation happens in vCPU threads or the main event loop thread.
@@ -6072,6 +6089,12 @@ SRST
         in a batch for the AIO engine, 0 means that the engine will use
         its default.
 
+        The ``io-uring-sqpoll-idle`` parameter, if non-zero, makes the
+        io_uring AIO engine submit requests through a kernel thread that
+        polls the submission queue, and that goes to sleep after this
+        many milliseconds without requests. It only takes effect if set
+        before the IOThread first uses io_uring.
+
         The IOThread parameters can be modified at run-time using the
         ``qom-set`` command (where ``iothread1`` is the IOThread's
         ``id``):
@@ -289,7 +289,16 @@ enum {
     USES_CC_SRCT = 8,
 };
 
-/* Bit set if the global variable is live after setting CC_OP to X.  */
+/*
+ * Bit set if the global variable is live after setting CC_OP to X.
+ *
+ * Liveness of the CC globals is only tracked within a TB.  At the end of
+ * a TB, CC_OP and the globals still live for it are always written back
+ * to CPUX86State: the successor is not known at translation time (direct
+ * jumps are chained lazily and may be reset at any point), and the same
+ * state must be visible to interrupt delivery, exceptions raised by the
+ * next TB and to gdbstub/migration, all of which read env directly.
+ */
 static const uint8_t cc_op_live[CC_OP_NB] = {
     [CC_OP_DYNAMIC] = USES_CC_DST | USES_CC_SRC | USES_CC_SRC2,
     [CC_OP_EFLAGS] = USES_CC_SRC,
@@ -148,32 +148,47 @@ static inline void vext_set_elem_mask(void *v0, int index,
 /* elements operations for load and store */
 typedef void vext_ldst_elem_fn(CPURISCVState *env, abi_ptr addr,
                                uint32_t idx, void *vd, uintptr_t retaddr);
+typedef void vext_ldst_elem_fn_host(void *vd, uint32_t idx, void *host);
 
-#define GEN_VEXT_LD_ELEM(NAME, ETYPE, H, LDSUF)            \
+#define GEN_VEXT_LD_ELEM(NAME, ETYPE, H, LDSUF, HOSTSUF)   \
 static void NAME(CPURISCVState *env, abi_ptr addr,         \
                  uint32_t idx, void *vd, uintptr_t retaddr)\
 {                                                          \
     ETYPE *cur = ((ETYPE *)vd + H(idx));                   \
     *cur = cpu_##LDSUF##_data_ra(env, addr, retaddr);      \
 }                                                          \
+                                                           \
+static inline QEMU_ALWAYS_INLINE                           \
+void NAME##_host(void *vd, uint32_t idx, void *host)       \
+{                                                          \
+    ETYPE *cur = ((ETYPE *)vd + H(idx));                   \
+    *cur = (ETYPE)HOSTSUF##_p(host);                       \
+}
 
-GEN_VEXT_LD_ELEM(lde_b, int8_t,  H1, ldsb)
-GEN_VEXT_LD_ELEM(lde_h, int16_t, H2, ldsw)
-GEN_VEXT_LD_ELEM(lde_w, int32_t, H4, ldl)
-GEN_VEXT_LD_ELEM(lde_d, int64_t, H8, ldq)
+GEN_VEXT_LD_ELEM(lde_b, int8_t,  H1, ldsb, ldsb)
+GEN_VEXT_LD_ELEM(lde_h, int16_t, H2, ldsw, ldsw_le)
+GEN_VEXT_LD_ELEM(lde_w, int32_t, H4, ldl, ldl_le)
+GEN_VEXT_LD_ELEM(lde_d, int64_t, H8, ldq, ldq_le)
 
-#define GEN_VEXT_ST_ELEM(NAME, ETYPE, H, STSUF)            \
+#define GEN_VEXT_ST_ELEM(NAME, ETYPE, H, STSUF, HOSTSUF)   \
 static void NAME(CPURISCVState *env, abi_ptr addr,         \
                  uint32_t idx, void *vd, uintptr_t retaddr)\
 {                                                          \
     ETYPE data = *((ETYPE *)vd + H(idx));                  \
     cpu_##STSUF##_data_ra(env, addr, data, retaddr);       \
+}                                                          \
+                                                           \
+static inline QEMU_ALWAYS_INLINE                           \
+void NAME##_host(void *vd, uint32_t idx, void *host)       \
+{                                                          \
+    ETYPE data = *((ETYPE *)vd + H(idx));                  \
+    HOSTSUF##_p(host, data);                               \
 }
 
-GEN_VEXT_ST_ELEM(ste_b, int8_t,  H1, stb)
-GEN_VEXT_ST_ELEM(ste_h, int16_t, H2, stw)
-GEN_VEXT_ST_ELEM(ste_w, int32_t, H4, stl)
-GEN_VEXT_ST_ELEM(ste_d, int64_t, H8, stq)
+GEN_VEXT_ST_ELEM(ste_b, int8_t,  H1, stb, stb)
+GEN_VEXT_ST_ELEM(ste_h, int16_t, H2, stw, stw_le)
+GEN_VEXT_ST_ELEM(ste_w, int32_t, H4, stl, stl_le)
+GEN_VEXT_ST_ELEM(ste_d, int64_t, H8, stq, stq_le)
 
 static void vext_set_tail_elems_1s(target_ulong vl, void *vd,
                                    uint32_t desc, uint32_t nf,
@@ -264,27 +279,87 @@ GEN_VEXT_ST_STRIDE(vsse64_v, int64_t, ste_d)
  * unit-stride: access elements stored contiguously in memory
  */
 
+/*
+ * Access the segments [env->vstart, evl) of a unit-stride operation, all of
+ * which lie within a single guest page. The page is probed once; if it is
+ * plain RAM the elements are accessed directly through the host address
+ * instead of going through the softmmu TLB for each of them.
+ */
+static void
+vext_page_ldst_us(CPURISCVState *env, void *vd, target_ulong addr,
+                  uint32_t evl, uint32_t nf, uint32_t max_elems,
+                  uint32_t log2_esz, bool is_load, int mmu_index,
+                  vext_ldst_elem_fn *ldst_elem,
+                  vext_ldst_elem_fn_host *ldst_host, uintptr_t ra)
+{
+    uint32_t i, k;
+    uint32_t esz = 1 << log2_esz;
+    uint32_t size = ((evl - env->vstart) * nf) << log2_esz;
+    MMUAccessType access_type = is_load ? MMU_DATA_LOAD : MMU_DATA_STORE;
+    void *host;
+    int flags;
+
+    /*
+     * Probe without faulting: if any part of the page is not directly
+     * accessible, the per-element loop below raises the fault with vstart
+     * set to the element that caused it.
+     */
+    flags = probe_access_flags(env, adjust_addr(env, addr), size, access_type,
+                               mmu_index, true, &host, ra);
+
+    if (likely(flags == 0)) {
+        for (i = env->vstart; i < evl; i++) {
+            for (k = 0; k < nf; k++) {
+                ldst_host(vd, i + k * max_elems, host);
+                host += esz;
+            }
+        }
+        env->vstart = evl;
+    } else {
+        for (i = env->vstart; i < evl; env->vstart = ++i) {
+            for (k = 0; k < nf; k++) {
+                ldst_elem(env, adjust_addr(env, addr), i + k * max_elems,
+                          vd, ra);
+                addr += esz;
+            }
+        }
+    }
+}
+
 /* unmasked unit-stride load and store operation */
 static void
 vext_ldst_us(void *vd, target_ulong base, CPURISCVState *env, uint32_t desc,
-             vext_ldst_elem_fn *ldst_elem, uint32_t log2_esz, uint32_t evl,
-             uintptr_t ra)
+             vext_ldst_elem_fn *ldst_elem, vext_ldst_elem_fn_host *ldst_host,
+             uint32_t log2_esz, uint32_t evl, bool is_load, uintptr_t ra)
 {
     uint32_t i, k;
     uint32_t nf = vext_nf(desc);
     uint32_t max_elems = vext_max_elems(desc, log2_esz);
     uint32_t esz = 1 << log2_esz;
+    uint32_t seg_size = nf << log2_esz;
+    int mmu_index = riscv_env_mmu_index(env, false);
 
     VSTART_CHECK_EARLY_EXIT(env);
 
-    /* load bytes from guest memory */
-    for (i = env->vstart; i < evl; env->vstart = ++i) {
-        k = 0;
-        while (k < nf) {
-            target_ulong addr = base + ((i * nf + k) << log2_esz);
+    while (env->vstart < evl) {
+        target_ulong addr = base + env->vstart * seg_size;
+        target_ulong page_left = -(adjust_addr(env, addr) | TARGET_PAGE_MASK);
+        uint32_t nseg = MIN(page_left / seg_size, evl - env->vstart);
+
+        if (likely(nseg != 0)) {
+            vext_page_ldst_us(env, vd, addr, env->vstart + nseg, nf,
+                              max_elems, log2_esz, is_load, mmu_index,
+                              ldst_elem, ldst_host, ra);
+            continue;
+        }
+
+        /* This segment crosses a page boundary. */
+        i = env->vstart;
+        for (k = 0; k < nf; k++) {
+            addr = base + ((i * nf + k) << log2_esz);
             ldst_elem(env, adjust_addr(env, addr), i + k * max_elems, vd, ra);
-            k++;
         }
+        env->vstart = i + 1;
     }
     env->vstart = 0;
 
@@ -308,8 +383,8 @@ void HELPER(NAME##_mask)(void *vd, void *v0, target_ulong base,         \
 void HELPER(NAME)(void *vd, void *v0, target_ulong base,                \
                   CPURISCVState *env, uint32_t desc)                    \
 {                                                                       \
-    vext_ldst_us(vd, base, env, desc, LOAD_FN,                          \
-                 ctzl(sizeof(ETYPE)), env->vl, GETPC());                \
+    vext_ldst_us(vd, base, env, desc, LOAD_FN, LOAD_FN##_host,          \
+                 ctzl(sizeof(ETYPE)), env->vl, true, GETPC());          \
 }
 
 GEN_VEXT_LD_US(vle8_v,  int8_t,  lde_b)
@@ -329,8 +404,8 @@ void HELPER(NAME##_mask)(void *vd, void *v0, target_ulong base,          \
 void HELPER(NAME)(void *vd, void *v0, target_ulong base,                 \
                   CPURISCVState *env, uint32_t desc)                     \
 {                                                                        \
-    vext_ldst_us(vd, base, env, desc, STORE_FN,                          \
-                 ctzl(sizeof(ETYPE)), env->vl, GETPC());                 \
+    vext_ldst_us(vd, base, env, desc, STORE_FN, STORE_FN##_host,         \
+                 ctzl(sizeof(ETYPE)), env->vl, false, GETPC());          \
 }
 
 GEN_VEXT_ST_US(vse8_v,  int8_t,  ste_b)
@@ -346,8 +421,8 @@ void HELPER(vlm_v)(void *vd, void *v0, target_ulong base,
 {
     /* evl = ceil(vl/8) */
     uint8_t evl = (env->vl + 7) >> 3;
-    vext_ldst_us(vd, base, env, desc, lde_b,
-                 0, evl, GETPC());
+    vext_ldst_us(vd, base, env, desc, lde_b, lde_b_host,
+                 0, evl, true, GETPC());
 }
 
 void HELPER(vsm_v)(void *vd, void *v0, target_ulong base,
@@ -355,8 +430,8 @@ void HELPER(vsm_v)(void *vd, void *v0, target_ulong base,
 {
     /* evl = ceil(vl/8) */
     uint8_t evl = (env->vl + 7) >> 3;
-    vext_ldst_us(vd, base, env, desc, ste_b,
-                 0, evl, GETPC());
+    vext_ldst_us(vd, base, env, desc, ste_b, ste_b_host,
+                 0, evl, false, GETPC());
 }
 
 /*
@@ -974,6 +974,15 @@ static void finish_folding(OptContext *ctx, TCGOp *op)
      * and is not a conditional branch, reset all temp data.
      */
     if (def->flags & TCG_OPF_BB_END) {
+        /*
+         * A label whose branches have all been folded away can only be
+         * reached by falling through, and will be removed by
+         * reachable_code_pass.  Continue the extended basic block.
+         */
+        if (op->opc == INDEX_op_set_label &&
+            QSIMPLEQ_EMPTY(&arg_label(op->args[0])->branches)) {
+            return;
+        }
         ctx->prev_mb = NULL;
         if (!(def->flags & TCG_OPF_COND_BRANCH)) {
             memset(&ctx->temps_used, 0, sizeof(ctx->temps_used));
@@ -127,6 +127,7 @@ static enum op operation;
 static enum tester tester;
 static uint64_t n_completed_ops;
 static unsigned int duration = DEFAULT_DURATION_SECS;
+static bool clear_flags;
 static int64_t ns_elapsed;
 /* disable optimizations with volatile */
 static volatile union fp res;
@@ -318,6 +319,9 @@ static void bench(enum precision prec, enum op op, int n_ops, bool no_neg)
                 float32 b = ops[1].f32;
                 float32 c = ops[2].f32;
 
+                if (clear_flags) {
+                    soft_status.float_exception_flags = 0;
+                }
                 switch (op) {
                 case OP_ADD:
                     res.f32 = float32_add(a, b, &soft_status);
@@ -353,6 +357,9 @@ static void bench(enum precision prec, enum op op, int n_ops, bool no_neg)
                 float64 b = ops[1].f64;
                 float64 c = ops[2].f64;
 
+                if (clear_flags) {
+                    soft_status.float_exception_flags = 0;
+                }
                 switch (op) {
                 case OP_ADD:
                     res.f64 = float64_add(a, b, &soft_status);
@@ -388,6 +395,9 @@ static void bench(enum precision prec, enum op op, int n_ops, bool no_neg)
                 float128 b = ops[1].f128;
                 float128 c = ops[2].f128;
 
+                if (clear_flags) {
+                    soft_status.float_exception_flags = 0;
+                }
                 switch (op) {
                 case OP_ADD:
                     res.f128 = float128_add(a, b, &soft_status);
@@ -524,6 +534,8 @@ static void usage_complete(int argc, char *argv[])
             "Default: even\n");
     fprintf(stderr, " -t = tester (%s). Default: %s\n",
             tester_list, tester_names[0]);
+    fprintf(stderr, " -x = clear the exception flags before each operation "
+            "(soft tester only). Default: disabled\n");
     fprintf(stderr, " -z = flush inputs to zero (soft tester only). "
             "Default: disabled\n");
     fprintf(stderr, " -Z = flush output to zero (soft tester only). "
@@ -615,7 +627,7 @@ static void parse_args(int argc, char *argv[])
     int rounding = ROUND_EVEN;
 
     for (;;) {
-        c = getopt(argc, argv, "d:ho:p:r:t:zZ");
+        c = getopt(argc, argv, "d:ho:p:r:t:xzZ");
         if (c < 0) {
             break;
         }
@@ -661,6 +673,9 @@ static void parse_args(int argc, char *argv[])
             }
             tester = val;
             break;
+        case 'x':
+            clear_flags = true;
+            break;
         case 'z':
             soft_status.flush_inputs_to_zero = 1;
             break;
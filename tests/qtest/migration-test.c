@@ -2305,6 +2305,81 @@ static void test_precopy_file_mapped_ram(void)
     test_file_common(&args, true);
 }
 
+/*
+ * Migrate to a file twice: a full migration, then a delta into a new file
+ * with only the pages the guest wrote in between, and load the result.
+ */
+static void test_precopy_file_mapped_ram_delta(void)
+{
+    g_autofree char *uri = g_strdup_printf("file:%s/%s", tmpfs,
+                                           FILE_TEST_FILENAME);
+    g_autofree char *delta_uri = g_strdup_printf("file:%s/%s.delta", tmpfs,
+                                                 FILE_TEST_FILENAME);
+    MigrateStart args = {};
+    QTestState *from, *to;
+    unsigned char byte_a, byte_b;
+
+    if (test_migrate_start(&from, &to, "defer", &args)) {
+        return;
+    }
+
+    migrate_mapped_ram_start(from, to);
+    migrate_set_capability(from, "mapped-ram-delta", true);
+
+    migrate_ensure_converge(from);
+    wait_for_serial("src_serial");
+
+    qtest_qmp_assert_success(from, "{ 'execute' : 'stop'}");
+    wait_for_stop(from, &src_state);
+    migrate_qmp(from, to, uri, NULL, "{}");
+    wait_for_migration_complete(from);
+
+    /* Let the guest write to its memory again */
+    qtest_qmp_assert_success(from, "{ 'execute' : 'cont'}");
+    qtest_memread(from, start_address, &byte_a, 1);
+    do {
+        qtest_memread(from, start_address, &byte_b, 1);
+        usleep(1000 * 10);
+    } while (byte_a == byte_b);
+
+    qtest_qmp_assert_success(from, "{ 'execute' : 'stop'}");
+    migrate_qmp(from, to, delta_uri, NULL, "{}");
+    wait_for_migration_complete(from);
+
+    migrate_incoming_qmp(to, delta_uri, "{}");
+    wait_for_migration_complete(to);
+
+    qtest_qmp_assert_success(to, "{ 'execute' : 'cont'}");
+    wait_for_resume(to, &dst_state);
+    wait_for_serial("dest_serial");
+
+    test_migrate_end(from, to, true);
+    cleanup(FILE_TEST_FILENAME ".delta");
+}
+
+static void *migrate_mapped_ram_lazy_load_start(QTestState *from,
+                                                QTestState *to)
+{
+    migrate_mapped_ram_start(from, to);
+
+    migrate_set_capability(to, "mapped-ram-lazy-load", true);
+
+    return NULL;
+}
+
+static void test_precopy_file_mapped_ram_lazy_load(void)
+{
+    g_autofree char *uri = g_strdup_printf("file:%s/%s", tmpfs,
+                                           FILE_TEST_FILENAME);
+    MigrateCommon args = {
+        .connect_uri = uri,
+        .listen_uri = "defer",
+        .start_hook = migrate_mapped_ram_lazy_load_start,
+    };
+
+    test_file_common(&args, true);
+}
+
 static void *migrate_multifd_mapped_ram_start(QTestState *from, QTestState *to)
 {
     migrate_mapped_ram_start(from, to);
@@ -2344,6 +2419,30 @@ static void test_multifd_file_mapped_ram(void)
     test_file_common(&args, true);
 }
 
+static void *multifd_mapped_ram_read_size_start(QTestState *from,
+                                                QTestState *to)
+{
+    migrate_multifd_mapped_ram_start(from, to);
+
+    /* Smallest allowed value, so that each channel gets many reads */
+    migrate_set_parameter_int(to, "mapped-ram-read-size", 64 * 1024);
+
+    return NULL;
+}
+
+static void test_multifd_file_mapped_ram_read_size(void)
+{
+    g_autofree char *uri = g_strdup_printf("file:%s/%s", tmpfs,
+                                           FILE_TEST_FILENAME);
+    MigrateCommon args = {
+        .connect_uri = uri,
+        .listen_uri = "defer",
+        .start_hook = multifd_mapped_ram_read_size_start,
+    };
+
+    test_file_common(&args, true);
+}
+
 static void *multifd_mapped_ram_dio_start(QTestState *from, QTestState *to)
 {
     migrate_multifd_mapped_ram_start(from, to);
@@ -2493,6 +2592,25 @@ static void test_precopy_tcp_switchover_ack(void)
     test_precopy_common(&args);
 }
 
+static void *test_migrate_defer_hot_pages_start(QTestState *from,
+                                                QTestState *to)
+{
+    migrate_set_capability(from, "defer-hot-pages", true);
+    return NULL;
+}
+
+static void test_precopy_tcp_defer_hot_pages(void)
+{
+    MigrateCommon args = {
+        .listen_uri = "tcp:127.0.0.1:0",
+        .start_hook = test_migrate_defer_hot_pages_start,
+        /* The guest has to keep writing for pages to become hot */
+        .live = true,
+    };
+
+    test_precopy_common(&args);
+}
+
 #ifdef CONFIG_GNUTLS
 static void test_precopy_tcp_tls_psk_match(void)
 {
@@ -2952,6 +3070,25 @@ test_migrate_precopy_tcp_multifd_start(QTestState *from,
     return test_migrate_precopy_tcp_multifd_start_common(from, to, "none");
 }
 
+static void *
+test_migrate_precopy_tcp_multifd_start_adaptive(QTestState *from,
+                                                QTestState *to)
+{
+    test_migrate_precopy_tcp_multifd_start_common(from, to, "none");
+    migrate_set_capability(from, "multifd-adaptive-channels", true);
+    return NULL;
+}
+
+static void *
+test_migrate_precopy_tcp_multifd_start_dedup(QTestState *from,
+                                             QTestState *to)
+{
+    test_migrate_precopy_tcp_multifd_start_common(from, to, "none");
+    migrate_set_capability(from, "multifd-dedup", true);
+    migrate_set_capability(to, "multifd-dedup", true);
+    return NULL;
+}
+
 static void *
 test_migrate_precopy_tcp_multifd_start_zero_page_legacy(QTestState *from,
                                                         QTestState *to)
@@ -2996,6 +3133,25 @@ test_migrate_precopy_tcp_multifd_zstd_start(QTestState *from,
 }
 #endif /* CONFIG_ZSTD */
 
+static void *
+test_migrate_precopy_tcp_multifd_xbzrle_start(QTestState *from,
+                                              QTestState *to)
+{
+    migrate_set_parameter_int(from, "xbzrle-cache-size", 33554432);
+    migrate_set_parameter_int(to, "xbzrle-cache-size", 33554432);
+
+    return test_migrate_precopy_tcp_multifd_start_common(from, to, "xbzrle");
+}
+
+#ifdef CONFIG_LZ4
+static void *
+test_migrate_precopy_tcp_multifd_lz4_start(QTestState *from,
+                                           QTestState *to)
+{
+    return test_migrate_precopy_tcp_multifd_start_common(from, to, "lz4");
+}
+#endif /* CONFIG_LZ4 */
+
 #ifdef CONFIG_QPL
 static void *
 test_migrate_precopy_tcp_multifd_qpl_start(QTestState *from,
@@ -3043,6 +3199,32 @@ static void test_multifd_tcp_zero_page_legacy(void)
     test_precopy_common(&args);
 }
 
+static void test_multifd_tcp_adaptive_channels(void)
+{
+    MigrateCommon args = {
+        .listen_uri = "defer",
+        .start_hook = test_migrate_precopy_tcp_multifd_start_adaptive,
+        /* Keep dirtying memory so that the channel count gets tuned */
+        .live = true,
+    };
+    test_precopy_common(&args);
+}
+
+static void test_multifd_tcp_dedup(void)
+{
+    MigrateCommon args = {
+        .listen_uri = "defer",
+        .start_hook = test_migrate_precopy_tcp_multifd_start_dedup,
+        /*
+         * Multifd is more complicated than most of the features, it
+         * directly takes guest page buffers when sending, make sure
+         * everything will work alright even if guest page is changing.
+         */
+        .live = true,
+    };
+    test_precopy_common(&args);
+}
+
 static void test_multifd_tcp_no_zero_page(void)
 {
     MigrateCommon args = {
@@ -3093,6 +3275,28 @@ static void test_multifd_tcp_zstd(void)
 }
 #endif
 
+static void test_multifd_tcp_xbzrle(void)
+{
+    MigrateCommon args = {
+        .listen_uri = "defer",
+        .start_hook = test_migrate_precopy_tcp_multifd_xbzrle_start,
+        /* Make sure some pages are sent again, as deltas */
+        .iterations = 2,
+    };
+    test_precopy_common(&args);
+}
+
+#ifdef CONFIG_LZ4
+static void test_multifd_tcp_lz4(void)
+{
+    MigrateCommon args = {
+        .listen_uri = "defer",
+        .start_hook = test_migrate_precopy_tcp_multifd_lz4_start,
+    };
+    test_precopy_common(&args);
+}
+#endif
+
 #ifdef CONFIG_QPL
 static void test_multifd_tcp_qpl(void)
 {
@@ -3593,6 +3797,71 @@ static void test_vcpu_dirty_limit(void)
     dirtylimit_stop_vm(vm);
 }
 
+static void wait_for_calc_dirtyrate_measured(QTestState *who)
+{
+    int max_try_count = 1000;
+    QDict *rsp_return;
+    bool measured;
+
+    do {
+        usleep(10000);
+        rsp_return = query_dirty_rate(who);
+        measured = g_str_equal(qdict_get_str(rsp_return, "status"),
+                               "measured");
+        qobject_unref(rsp_return);
+    } while (!measured && --max_try_count);
+
+    g_assert_cmpint(max_try_count, !=, 0);
+}
+
+static void test_dirty_rate_continuous(void)
+{
+    MigrateStart args = {};
+    QTestState *from, *to;
+    QDict *rsp_return;
+    QList *blocks;
+
+    if (test_migrate_start(&from, &to, "defer", &args)) {
+        return;
+    }
+
+    wait_for_serial("src_serial");
+
+    qtest_qmp_assert_success(from,
+                             "{ 'execute': 'calc-dirty-rate',"
+                             "'arguments': { 'calc-time': 100,"
+                             "'calc-time-unit': 'millisecond',"
+                             "'continuous': true } }");
+    wait_for_calc_dirtyrate_measured(from);
+
+    /* A rolling estimate per RAMBlock is available right away */
+    rsp_return = query_dirty_rate(from);
+    g_assert(qdict_get_bool(rsp_return, "continuous"));
+    g_assert(qdict_haskey(rsp_return, "dirty-rate"));
+    blocks = qdict_get_qlist(rsp_return, "ramblock-dirty-rate");
+    g_assert(blocks && !qlist_empty(blocks));
+    qobject_unref(rsp_return);
+
+    /* Keeps being updated while the guest runs */
+    usleep(300000);
+    rsp_return = query_dirty_rate(from);
+    g_assert_cmpstr(qdict_get_str(rsp_return, "status"), ==, "measured");
+    qobject_unref(rsp_return);
+
+    /* A new measurement replaces the continuous one */
+    qtest_qmp_assert_success(from,
+                             "{ 'execute': 'calc-dirty-rate',"
+                             "'arguments': { 'calc-time': 100,"
+                             "'calc-time-unit': 'millisecond' } }");
+    usleep(100000);
+    wait_for_calc_dirtyrate_measured(from);
+    rsp_return = query_dirty_rate(from);
+    g_assert(!qdict_get_bool(rsp_return, "continuous"));
+    qobject_unref(rsp_return);
+
+    test_migrate_end(from, to, false);
+}
+
 static void migrate_dirty_limit_wait_showup(QTestState *from,
                                             const int64_t period,
                                             const int64_t value)
@@ -3753,6 +4022,59 @@ static void test_migrate_dirty_limit(void)
     test_migrate_end(from, to, true);
 }
 
+/*
+ * Migrate with a bandwidth that is too low for the guest dirty rate,
+ * and check that the convergence controller limits the vCPU before the
+ * migration is allowed to converge.
+ */
+static void test_migrate_convergence_control(void)
+{
+    g_autofree char *uri = g_strdup_printf("unix:%s/migsocket", tmpfs);
+    QTestState *from, *to;
+    QDict *rsp, *data;
+    const int64_t dirtylimit_value = 10;
+    MigrateCommon args = {
+        .start = {
+            .hide_stderr = true,
+            .use_dirty_ring = true,
+        },
+        .listen_uri = uri,
+        .connect_uri = uri,
+    };
+
+    if (test_migrate_start(&from, &to, args.listen_uri, &args.start)) {
+        return;
+    }
+
+    migrate_set_capability(from, "dirty-limit", true);
+    migrate_set_capability(from, "convergence-control", true);
+    migrate_set_parameter_int(from, "vcpu-dirty-limit", dirtylimit_value);
+    /* The guest dirties memory much faster than this */
+    migrate_set_parameter_int(from, "max-bandwidth", 30 * 1000 * 1000);
+    migrate_set_parameter_int(from, "downtime-limit", 1);
+
+    wait_for_serial("src_serial");
+
+    migrate_qmp(from, to, args.connect_uri, NULL, "{}");
+
+    rsp = qtest_qmp_eventwait_ref(from, "MIGRATION_CONVERGENCE");
+    data = qdict_get_qdict(rsp, "data");
+    g_assert_cmpstr(qdict_get_str(data, "action"), ==, "limit-dirty-rate");
+    g_assert(!qlist_empty(qdict_get_qlist(data, "vcpu-dirty-limits")));
+    qobject_unref(rsp);
+
+    g_assert_cmpint(get_limit_rate(from), >=, dirtylimit_value);
+
+    migrate_ensure_converge(from);
+
+    qtest_qmp_eventwait(to, "RESUME");
+
+    wait_for_serial("dest_serial");
+    wait_for_migration_complete(from);
+
+    test_migrate_end(from, to, true);
+}
+
 static bool kvm_dirty_ring_supported(void)
 {
 #if defined(__linux__) && defined(HOST_X86_64)
@@ -3879,11 +4201,19 @@ int main(int argc, char **argv)
                        test_precopy_file_mapped_ram);
     migration_test_add("/migration/precopy/file/mapped-ram/live",
                        test_precopy_file_mapped_ram_live);
+    migration_test_add("/migration/precopy/file/mapped-ram/delta",
+                       test_precopy_file_mapped_ram_delta);
+    if (has_uffd) {
+        migration_test_add("/migration/precopy/file/mapped-ram/lazy-load",
+                           test_precopy_file_mapped_ram_lazy_load);
+    }
 
     migration_test_add("/migration/multifd/file/mapped-ram",
                        test_multifd_file_mapped_ram);
     migration_test_add("/migration/multifd/file/mapped-ram/live",
                        test_multifd_file_mapped_ram_live);
+    migration_test_add("/migration/multifd/file/mapped-ram/read-size",
+                       test_multifd_file_mapped_ram_read_size);
 
     migration_test_add("/migration/multifd/file/mapped-ram/dio",
                        test_multifd_file_mapped_ram_dio);
@@ -3926,6 +4256,8 @@ int main(int argc, char **argv)
 
     migration_test_add("/migration/precopy/tcp/plain/switchover-ack",
                        test_precopy_tcp_switchover_ack);
+    migration_test_add("/migration/precopy/tcp/plain/defer-hot-pages",
+                       test_precopy_tcp_defer_hot_pages);
 
 #ifdef CONFIG_GNUTLS
     migration_test_add("/migration/precopy/tcp/tls/psk/match",
@@ -3978,6 +4310,8 @@ int main(int argc, char **argv)
             has_kvm && kvm_dirty_ring_supported()) {
             migration_test_add("/migration/dirty_limit",
                                test_migrate_dirty_limit);
+            migration_test_add("/migration/convergence_control",
+                               test_migrate_convergence_control);
         }
     }
     migration_test_add("/migration/multifd/tcp/uri/plain/none",
@@ -3988,6 +4322,10 @@ int main(int argc, char **argv)
                        test_multifd_tcp_zero_page_legacy);
     migration_test_add("/migration/multifd/tcp/plain/zero-page/none",
                        test_multifd_tcp_no_zero_page);
+    migration_test_add("/migration/multifd/tcp/plain/adaptive-channels",
+                       test_multifd_tcp_adaptive_channels);
+    migration_test_add("/migration/multifd/tcp/plain/dedup",
+                       test_multifd_tcp_dedup);
     migration_test_add("/migration/multifd/tcp/plain/cancel",
                        test_multifd_tcp_cancel);
     migration_test_add("/migration/multifd/tcp/plain/zlib",
@@ -3995,6 +4333,12 @@ int main(int argc, char **argv)
 #ifdef CONFIG_ZSTD
     migration_test_add("/migration/multifd/tcp/plain/zstd",
                        test_multifd_tcp_zstd);
+#endif
+    migration_test_add("/migration/multifd/tcp/plain/xbzrle",
+                       test_multifd_tcp_xbzrle);
+#ifdef CONFIG_LZ4
+    migration_test_add("/migration/multifd/tcp/plain/lz4",
+                       test_multifd_tcp_lz4);
 #endif
 #ifdef CONFIG_QPL
     migration_test_add("/migration/multifd/tcp/plain/qpl",
@@ -4023,6 +4367,9 @@ int main(int argc, char **argv)
 #endif /* CONFIG_TASN1 */
 #endif /* CONFIG_GNUTLS */
 
+    migration_test_add("/migration/dirty_rate/continuous",
+                       test_dirty_rate_continuous);
+
     if (g_str_equal(arch, "x86_64") && has_kvm && kvm_dirty_ring_supported()) {
         migration_test_add("/migration/dirty_ring",
                            test_precopy_unix_dirty_ring);
@@ -502,6 +502,60 @@ static void test_io_channel_unix_fd_pass(void)
 }
 #endif /* _WIN32 */
 
+static gpointer test_io_channel_waitall_writer(gpointer opaque)
+{
+    QIOChannel *src = opaque;
+
+    /* Split the data so that the reader sees it arrive in two parts */
+    qio_channel_write_all(src, "Hello ", 6, &error_abort);
+    g_usleep(100 * 1000);
+    qio_channel_write_all(src, "World", 6, &error_abort);
+    return NULL;
+}
+
+static void test_io_channel_unix_waitall(void)
+{
+    SocketAddress *listen_addr = g_new0(SocketAddress, 1);
+    SocketAddress *connect_addr = g_new0(SocketAddress, 1);
+    QIOChannel *src, *dst, *srv;
+    GThread *writer;
+    char buf1[6], buf2[6];
+    struct iovec iov[] = {
+        { .iov_base = buf1, .iov_len = sizeof(buf1) },
+        { .iov_base = buf2, .iov_len = sizeof(buf2) },
+    };
+
+#define TEST_SOCKET "test-io-channel-socket.sock"
+    listen_addr->type = SOCKET_ADDRESS_TYPE_UNIX;
+    listen_addr->u.q_unix.path = g_strdup(TEST_SOCKET);
+
+    connect_addr->type = SOCKET_ADDRESS_TYPE_UNIX;
+    connect_addr->u.q_unix.path = g_strdup(TEST_SOCKET);
+
+    test_io_channel_setup_sync(listen_addr, connect_addr, &srv, &src, &dst);
+
+    writer = g_thread_new("waitall-writer", test_io_channel_waitall_writer,
+                          src);
+
+    /* A single read returns both parts */
+    g_assert_cmpint(qio_channel_readv_full(dst, iov, G_N_ELEMENTS(iov),
+                                           NULL, NULL,
+                                           QIO_CHANNEL_READ_FLAG_WAITALL,
+                                           &error_abort),
+                    ==, sizeof(buf1) + sizeof(buf2));
+    g_assert(memcmp(buf1, "Hello ", sizeof(buf1)) == 0);
+    g_assert_cmpstr(buf2, ==, "World");
+
+    g_thread_join(writer);
+
+    object_unref(OBJECT(src));
+    object_unref(OBJECT(dst));
+    object_unref(OBJECT(srv));
+    qapi_free_SocketAddress(listen_addr);
+    qapi_free_SocketAddress(connect_addr);
+    unlink(TEST_SOCKET);
+}
+
 static void test_io_channel_unix_listen_cleanup(void)
 {
     QIOChannelSocket *ioc;
@@ -605,6 +659,8 @@ int main(int argc, char **argv)
         g_test_add_func("/io/channel/socket/unix-fd-pass",
                         test_io_channel_unix_fd_pass);
 #endif
+        g_test_add_func("/io/channel/socket/unix-waitall",
+                        test_io_channel_unix_waitall);
         g_test_add_func("/io/channel/socket/unix-listen-cleanup",
                         test_io_channel_unix_listen_cleanup);
     }
@@ -0,0 +1,169 @@
+/*
+ * Migration page cache unit tests.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ *
+ */
+#include "qemu/osdep.h"
+#include "qapi/error.h"
+#include "../migration/page_cache.h"
+
+#define CACHE_PAGE_SIZE 4096
+/* The cache has 8 ways, so this makes two sets */
+#define CACHE_PAGES 16
+#define CACHE_SETS 2
+#define CACHE_WAYS 8
+#define CACHE_SIZE (CACHE_PAGES * CACHE_PAGE_SIZE)
+
+/* Address of the n-th page that maps to set 0 */
+static uint64_t set0_addr(int n)
+{
+    return (uint64_t)n * CACHE_SETS * CACHE_PAGE_SIZE;
+}
+
+static void fill_page(uint8_t *page, uint64_t addr)
+{
+    memset(page, addr / CACHE_PAGE_SIZE, CACHE_PAGE_SIZE);
+}
+
+static void check_page(PageCache *cache, uint64_t addr)
+{
+    uint8_t *data = get_cached_data(cache, addr);
+
+    g_assert(data);
+    g_assert_cmpint(data[0], ==, (uint8_t)(addr / CACHE_PAGE_SIZE));
+    g_assert_cmpint(data[CACHE_PAGE_SIZE - 1], ==,
+                    (uint8_t)(addr / CACHE_PAGE_SIZE));
+}
+
+static void test_init(void)
+{
+    Error *err = NULL;
+
+    g_assert_null(cache_init(CACHE_PAGE_SIZE - 1, CACHE_PAGE_SIZE, &err));
+    error_free_or_abort(&err);
+    g_assert_null(cache_init(3 * CACHE_PAGE_SIZE, CACHE_PAGE_SIZE, &err));
+    error_free_or_abort(&err);
+
+    /* Fewer pages than ways */
+    cache_fini(cache_init(CACHE_PAGE_SIZE, CACHE_PAGE_SIZE, &error_abort));
+    cache_fini(cache_init(4 * CACHE_PAGE_SIZE, CACHE_PAGE_SIZE, &error_abort));
+}
+
+static void test_insert_lookup(void)
+{
+    PageCache *cache = cache_init(CACHE_SIZE, CACHE_PAGE_SIZE, &error_abort);
+    uint8_t page[CACHE_PAGE_SIZE];
+    PageCacheStats stats;
+    uint64_t addr;
+
+    g_assert_false(cache_is_cached(cache, 0, 0));
+    g_assert_null(get_cached_data(cache, 0));
+
+    for (addr = 0; addr < CACHE_SIZE; addr += CACHE_PAGE_SIZE) {
+        fill_page(page, addr);
+        g_assert_cmpint(cache_insert(cache, addr, page, 0), ==, 0);
+    }
+    for (addr = 0; addr < CACHE_SIZE; addr += CACHE_PAGE_SIZE) {
+        g_assert_true(cache_is_cached(cache, addr, 1));
+        check_page(cache, addr);
+    }
+
+    /* Inserting a cached page again overwrites it */
+    memset(page, 0xaa, CACHE_PAGE_SIZE);
+    g_assert_cmpint(cache_insert(cache, 0, page, 1), ==, 0);
+    g_assert_cmpint(get_cached_data(cache, 0)[0], ==, 0xaa);
+
+    cache_get_stats(cache, &stats);
+    g_assert_cmpint(stats.hits, ==, CACHE_PAGES);
+    g_assert_cmpint(stats.misses, ==, 1);
+    g_assert_cmpint(stats.evictions, ==, 0);
+
+    cache_fini(cache);
+}
+
+static void test_associativity(void)
+{
+    PageCache *cache = cache_init(CACHE_SIZE, CACHE_PAGE_SIZE, &error_abort);
+    uint8_t page[CACHE_PAGE_SIZE];
+    PageCacheStats stats;
+    int i;
+
+    /* Pages sharing a set don't replace each other until it is full */
+    for (i = 0; i < CACHE_WAYS; i++) {
+        fill_page(page, set0_addr(i));
+        g_assert_cmpint(cache_insert(cache, set0_addr(i), page, 0), ==, 0);
+    }
+    for (i = 0; i < CACHE_WAYS; i++) {
+        check_page(cache, set0_addr(i));
+    }
+
+    /* A full set of fresh pages refuses new ones */
+    fill_page(page, set0_addr(CACHE_WAYS));
+    g_assert_cmpint(cache_insert(cache, set0_addr(CACHE_WAYS), page, 1),
+                    ==, -1);
+    g_assert_null(get_cached_data(cache, set0_addr(CACHE_WAYS)));
+
+    /* Once they get old, the least recently used one goes */
+    for (i = 1; i < CACHE_WAYS; i++) {
+        g_assert_true(cache_is_cached(cache, set0_addr(i), 1));
+    }
+    g_assert_cmpint(cache_insert(cache, set0_addr(CACHE_WAYS), page, 2),
+                    ==, 0);
+    g_assert_null(get_cached_data(cache, set0_addr(0)));
+    for (i = 1; i <= CACHE_WAYS; i++) {
+        check_page(cache, set0_addr(i));
+    }
+
+    cache_get_stats(cache, &stats);
+    g_assert_cmpint(stats.evictions, ==, 1);
+
+    cache_fini(cache);
+}
+
+static void test_move(void)
+{
+    PageCache *old = cache_init(4 * CACHE_SIZE, CACHE_PAGE_SIZE, &error_abort);
+    PageCache *new = cache_init(CACHE_SIZE, CACHE_PAGE_SIZE, &error_abort);
+    uint8_t page[CACHE_PAGE_SIZE];
+    PageCacheStats stats;
+    int i;
+
+    /* Twice as many pages of set 0 as the new cache can hold */
+    for (i = 0; i < 2 * CACHE_WAYS; i++) {
+        fill_page(page, set0_addr(i));
+        g_assert_cmpint(cache_insert(old, set0_addr(i), page, i), ==, 0);
+    }
+    g_assert_true(cache_is_cached(old, set0_addr(0), 2 * CACHE_WAYS));
+    g_assert_false(cache_is_cached(old, set0_addr(2 * CACHE_WAYS), 0));
+
+    cache_move(new, old);
+    cache_fini(old);
+
+    /* The most recently used pages are kept */
+    check_page(new, set0_addr(0));
+    for (i = 1; i <= CACHE_WAYS; i++) {
+        g_assert_null(get_cached_data(new, set0_addr(i)));
+    }
+    for (i = CACHE_WAYS + 1; i < 2 * CACHE_WAYS; i++) {
+        check_page(new, set0_addr(i));
+    }
+
+    cache_get_stats(new, &stats);
+    g_assert_cmpint(stats.hits, ==, 1);
+    g_assert_cmpint(stats.misses, ==, 1);
+
+    cache_fini(new);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+    g_test_add_func("/page-cache/init", test_init);
+    g_test_add_func("/page-cache/insert_lookup", test_insert_lookup);
+    g_test_add_func("/page-cache/associativity", test_associativity);
+    g_test_add_func("/page-cache/move", test_move);
+
+    return g_test_run();
+}